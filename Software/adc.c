@@ -2,18 +2,33 @@
 
 ISR(ADC0_RESRDY_vect)
 {
-	// Empty ISR — needed to wake from ADC sleep mode
+	/* Scan sequencer owns ADC0 -> store result and start the next channel */
+	if (adc_scan_running == 0x01)
+		ADC_scan_service();
+	// Otherwise the blocking reads poll RESRDY, ISR is only needed to wake from ADC sleep mode
 }
 
+/* Acquisition profiles, indexed by ADC_PROFILES. Up to 16 samples ADC0.RES holds the
+   plain sum, above 16 samples the hardware truncates the sum to 16 bits, so the
+   average is always at most 4 shifts away. */
+const adc_profile adc_profiles[ADC_PROFILE_COUNT] = {
+	{"FAST",	VREF_REFSEL_2V048_gc,	ADC_SAMPNUM_ACC4_gc,	ADC_PRESC_DIV8_gc,	0,	0,						2},	// 500 kHz ADC clock
+	{"NORMAL",	VREF_REFSEL_2V048_gc,	ADC_SAMPNUM_ACC16_gc,	ADC_PRESC_DIV16_gc,	0,	0,						4},
+	{"PRECISE",	VREF_REFSEL_2V048_gc,	ADC_SAMPNUM_ACC128_gc,	ADC_PRESC_DIV16_gc,	8,	(2 << ADC_SAMPDLY_gp),	4},	// longer sampling for the divider impedance
+	{"WIDE",	VREF_REFSEL_VDD_gc,		ADC_SAMPNUM_ACC16_gc,	ADC_PRESC_DIV16_gc,	0,	0,						4}	// 3.3 V full scale
+};
+
 //***************************************************************************
 //
 // Function Name : "ADC_init"
 // Target MCU : AVR128DB48
 // DESCRIPTION
 // Initializes the ADC0 module of the AVR128DB48 for differential or
-// single-ended mode, VDD reference, 12-bit resolution, free-run mode,
-// 16 sample accumulation, and clock prescalar divided by 4.
-// Enables interrupts and ADC0 module.
+// single-ended mode, 12-bit resolution, single conversion mode and the
+// NORMAL acquisition profile (2.048V reference, 16 sample accumulation,
+// clock prescalar divided by 16).
+// Enables interrupts and ADC0 module. Every register is written, the
+// configuration cache is only trusted after this call.
 //
 // Inputs : 
 //		uint8_t mode: 0 -> single ended, 1 -> differential
@@ -23,22 +38,336 @@ ISR(ADC0_RESRDY_vect)
 //**************************************************************************
 void ADC_init(uint8_t mode)
 {
-	adc_mode = mode;	// single-ended or differential mode
+	ADC_scan_stop();	// blocking reads take ADC0 away from the scan sequencer
+	ADC_conversion_timer_start();
+	
+	/* Force a write of every register */
+	adc_config_valid = 0x00;
 	
-	// Use 2.048V as reference
-	VREF.ADC0REF = VREF_REFSEL_2V048_gc;
+	ADC_profile_select(mode, ADC_PROFILE_NORMAL);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_conversion_timer_start"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts TCB2 free running at CLK_PER / 2, the conversion times of the
+//	profiles are read from it in 0.5 us steps instead of the 30.5 us ticks
+//	of the timebase. The longest conversion (PRECISE) is well inside one
+//	wrap of the counter. A running timer is left alone.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_conversion_timer_start(void)
+{
+	if (TCB2.CTRLA & TCB_ENABLE_bm)
+		return;
 	
-	// 12-bit resolution, Free-Run mode, differential/single-ended, Right adjusted, Enable
-	ADC0.CTRLA = (ADC_RESSEL_12BIT_gc | (ADC_FREERUN_bm) | (adc_mode << 5) | ADC_ENABLE_bm);
+	TCB2.CTRLB = TCB_CNTMODE_INT_gc;	// periodic interrupt mode, no interrupt enabled
+	TCB2.CCMP = 0xFFFF;
+	TCB2.CNT = 0;
+	TCB2.CTRLA = (TCB_CLKSEL_DIV2_gc | TCB_ENABLE_bm);
+}
 
-	//enables interrupt
-	ADC0.INTCTRL |= ADC_RESRDY_bm;
+//***************************************************************************
+//
+// Function Name : "ADC_conversion_time_us"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the time since a count of the conversion timer.
+//
+// Inputs : 
+//		uint16_t start: TCB2.CNT when the conversion was started
+//
+// Outputs : 
+//		uint16_t time: elapsed time in us
+//
+//**************************************************************************
+uint16_t ADC_conversion_time_us(uint16_t start)
+{
+	return (uint16_t)(TCB2.CNT - start) / ADC_CONVERSION_COUNTS_PER_US;
+}
 
-	// Set to accumulate 64 samples
-	ADC0.CTRLB = ADC_SAMPNUM_ACC64_gc;
+//***************************************************************************
+//
+// Function Name : "ADC_profile_config"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Fills an ADC0 configuration descriptor from an acquisition profile.
+//
+// Inputs : 
+//		adc_config *config: descriptor to fill
+//		uint8_t mode: 0 -> single ended, 1 -> differential
+//		uint8_t profile: index into adc_profiles[]
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_profile_config(adc_config *config, uint8_t mode, uint8_t profile)
+{
+	config->mode = mode;
+	config->ref = adc_profiles[profile].ref;
+	config->sampnum = adc_profiles[profile].sampnum;
+	config->presc = adc_profiles[profile].presc;
+	config->sampctrl = adc_profiles[profile].sampctrl;
+	config->sampdly = adc_profiles[profile].sampdly;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_profile_vref_mv"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the reference voltage of an acquisition profile.
+//
+// Inputs : 
+//		uint8_t profile: index into adc_profiles[]
+//
+// Outputs : 
+//		uint16_t vref: reference voltage in mV
+//
+//**************************************************************************
+uint16_t ADC_profile_vref_mv(uint8_t profile)
+{
+	return ADC_ref_mv(adc_profiles[profile].ref);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_ref_mv"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the voltage of a VREF.ADC0REF reference selection.
+//
+// Inputs : 
+//		uint8_t ref: VREF_REFSEL value
+//
+// Outputs : 
+//		uint16_t vref: reference voltage in mV
+//
+//**************************************************************************
+uint16_t ADC_ref_mv(uint8_t ref)
+{
+	switch (ref)
+	{
+		case VREF_REFSEL_1V024_gc:
+			return 1024;
+		case VREF_REFSEL_2V500_gc:
+			return 2500;
+		case VREF_REFSEL_4V096_gc:
+			return 4096;
+		case VREF_REFSEL_VDD_gc:
+			return 3300;
+		default:
+			return 2048;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_counts_to_uv"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts a raw accumulated result to the voltage at the ADC pins. One
+//	single-ended LSB is vref/4096, held in Q8 uV (vref_mv * 62.5), so every
+//	supported reference is exact and the product stays below 2^31.
+//
+// Inputs : 
+//		uint16_t result: raw ADC0.RES value, two's complement in differential mode
+//		uint8_t mode: 0 -> single ended, 1 -> differential
+//		uint16_t vref_mv: reference the result was taken with in mV
+//		uint8_t shift: right shift that averages the accumulated result
+//
+// Outputs : 
+//		int32_t uv: voltage at the ADC pins in uV
+//
+//**************************************************************************
+int32_t ADC_counts_to_uv(uint16_t result, uint8_t mode, uint16_t vref_mv, uint8_t shift)
+{
+	int32_t lsb_uv_q8 = ((uint32_t)vref_mv * 125) / 2;	// uV per single-ended LSB, Q8
+	
+	/* accumulated result, shift right to average, only differential results are signed */
+	if (mode == 0x00)
+		return ((int32_t)(result >> shift) * lsb_uv_q8) / 256;	// single-ended resolution is 12 bits -> 4096 values
+	else
+		return ((int32_t)((int16_t)result >> shift) * lsb_uv_q8 * 2) / 256;	// differential resolution is 11 bits -> 2048 values
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_uv_to_cell_mv"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Undoes the attenuation of the battery voltage divider with the
+//	calibration of the channel: the offset is removed at the pins, then the
+//	pin voltage is taken in 10 uV steps so the product with the per mille
+//	ratio fits 32 bits. Negative pin voltages read as 0 mV. Channels
+//	without calibration use the nominal divider.
+//
+// Inputs : 
+//		int32_t uv: voltage at the ADC pins in uV
+//		uint8_t channel: ADC_SCAN_CHANNELS value the voltage was read on
+//
+// Outputs : 
+//		uint16_t mv: battery voltage in mV
+//
+//**************************************************************************
+uint16_t ADC_uv_to_cell_mv(int32_t uv, uint8_t channel)
+{
+	uint16_t divider_permille = CALIBRATION_DEFAULT_DIVIDER_PERMILLE;
+	
+	if (channel < CALIBRATION_CHANNELS)
+	{
+		uv -= calibration_data.offset_uv[channel];
+		divider_permille = calibration_data.divider_permille[channel];
+	}
+	
+	if (uv <= 0)
+		return 0;
+	
+	return (uint16_t)((((uint32_t)uv / 10) * divider_permille) / 100000);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_profile_select"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Configures ADC0 for an acquisition profile. ADC_read() scales its result
+//	and files its conversion time under this profile.
+//
+// Inputs : 
+//		uint8_t mode: 0 -> single ended, 1 -> differential
+//		uint8_t profile: index into adc_profiles[]
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_profile_select(uint8_t mode, uint8_t profile)
+{
+	adc_config config;
 	
-	// Divided CLK_PER by 16
-	ADC0.CTRLC = ADC_PRESC_DIV16_gc;
+	ADC_profile_config(&config, mode, profile);
+	ADC_configure(&config);
+	adc_active_profile = profile;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_configure"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Applies an ADC0 configuration descriptor. The configuration that is
+//	currently programmed is cached, only the registers that differ from it
+//	are written. Switching between voltage and current reads then only
+//	touches CTRLA, and the reference is only rewritten (and allowed to
+//	settle) when it really changes.
+//
+// Inputs : 
+//		const adc_config *config: conversion mode, reference, accumulation,
+//								  prescaler and sample timing to use
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_configure(const adc_config *config)
+{
+	if (ADC_configure_registers(config) == 0x01)
+		_delay_us(ADC_VREF_SETTLE_US);	// only wait for the reference when it changes
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_configure_registers"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// The register writes of ADC_configure() without the wait for a new
+//	reference, for the scan ISR: it throws conversions away until the
+//	reference has settled instead of blocking. A call that changes nothing
+//	writes nothing and only counts as a request.
+//
+// Inputs : 
+//		const adc_config *config: conversion mode, reference, accumulation,
+//								  prescaler and sample timing to use
+//
+// Outputs : 
+//		uint8_t changed: 0x01 -> VREF.ADC0REF was written, the reference
+//						 needs ADC_VREF_SETTLE_US to settle
+//
+//**************************************************************************
+uint8_t ADC_configure_registers(const adc_config *config)
+{
+	uint8_t ref_changed = 0x00;
+	
+	adc_config_requests++;
+	
+	/* Cache is invalid after reset or ADC_init() -> program every register */
+	if (adc_config_valid == 0x00)
+	{
+		VREF.ADC0REF = config->ref;
+		// 12-bit resolution, single conversion, differential/single-ended, Right adjusted, Enable
+		ADC0.CTRLA = (ADC_RESSEL_12BIT_gc | (config->mode << 5) | ADC_ENABLE_bm);
+		ADC0.CTRLB = config->sampnum;
+		ADC0.CTRLC = config->presc;
+		ADC0.CTRLD = config->sampdly;
+		ADC0.SAMPCTRL = config->sampctrl;
+		ADC0.INTCTRL |= ADC_RESRDY_bm;	// enables interrupt
+		ref_changed = 0x01;
+		
+		adc_config_full_writes++;
+		adc_config_valid = 0x01;
+	}
+	else
+	{
+		uint8_t written = 0x00;
+		
+		if (config->ref != adc_active_config.ref)
+		{
+			VREF.ADC0REF = config->ref;
+			ref_changed = 0x01;
+			written = 0x01;
+		}
+		if (config->mode != adc_active_config.mode)
+		{
+			ADC0.CTRLA = (ADC_RESSEL_12BIT_gc | (config->mode << 5) | ADC_ENABLE_bm);
+			written = 0x01;
+		}
+		if (config->sampnum != adc_active_config.sampnum)
+		{
+			ADC0.CTRLB = config->sampnum;
+			written = 0x01;
+		}
+		if (config->presc != adc_active_config.presc)
+		{
+			ADC0.CTRLC = config->presc;
+			written = 0x01;
+		}
+		if (config->sampdly != adc_active_config.sampdly)
+		{
+			ADC0.CTRLD = config->sampdly;
+			written = 0x01;
+		}
+		if (config->sampctrl != adc_active_config.sampctrl)
+		{
+			ADC0.SAMPCTRL = config->sampctrl;
+			written = 0x01;
+		}
+			
+		if (written == 0x01)
+			adc_config_avoided++;	// configuration changed, full reconfiguration avoided
+	}
+	
+	adc_active_config = *config;
+	
+	/* Keep the globals used by ADC_read() and ADC_channelSEL() in sync */
+	adc_mode = config->mode;
+	adc_vref_mv = ADC_ref_mv(config->ref);
+	
+	return ref_changed;
 }
 
 //***************************************************************************
@@ -127,31 +456,138 @@ void ADC_channelSEL(uint8_t AIN_POS, uint8_t AIN_NEG)
 }
 //***************************************************************************
 //
-// Function Name : "ADC_read"
+// Function Name : "ADC_read_raw"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-//	Reads an integer value from the ADC and converts it to a floating point
-//	voltage based on reference voltage and conversion resolution
+//	Performs one conversion with the current configuration and returns the
+//	raw (accumulated) result register.
 //
 // Inputs : None
 //
 // Outputs : 
-//		float result: A floating point voltage converted by the ADC
+//		uint16_t result: ADC0.RES, two's complement in differential mode
 //
 //**************************************************************************
-float ADC_read(void)
-{	
-	/* ADC conversions in free running mode */
+uint16_t ADC_read_raw(void)
+{
 	ADC_startConversion();
 	
 	while(ADC_isConversionDone() != 0x01);	// wait for conversion to finish
 	ADC_stopConversion();
 	
-	/* 12 bit result was left adjusted, so shift right 4 places to fix, reading ADC.RES clears interrupt flag */
-	if (adc_mode == 0x00)		
-		return (float)(adc_vref * (ADC0.RES >> 4) / 4096);	// single-ended resolution is 12 bits -> 4096 values
+	return ADC0.RES;	// reading ADC.RES clears interrupt flag
+}
+//***************************************************************************
+//
+// Function Name : "ADC_read"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+//	Reads an integer value from the ADC and converts it to a voltage in uV
+//	based on reference voltage, conversion resolution and the
+//	accumulation depth of the active profile. The conversion time is
+//	recorded for the profile (TCB2 resolution 0.5 us).
+//
+// Inputs : None
+//
+// Outputs : 
+//		int32_t result: voltage at the ADC pins in uV
+//
+//**************************************************************************
+int32_t ADC_read(void)
+{	
+	uint8_t shift = adc_profiles[adc_active_profile].shift;
+	uint16_t start = TCB2.CNT;
+	uint16_t result = ADC_read_raw();
+	adc_profile_conversion_us[adc_active_profile] = ADC_conversion_time_us(start);
+	
+	return ADC_counts_to_uv(result, adc_mode, adc_vref_mv, shift);
+}
+//***************************************************************************
+//
+// Function Name : "ADC_settle_compare"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+//	Compares two consecutive settling conversions against the configured
+//	agreement band. Differential results are two's complement and are sign
+//	extended first, so a reading crossing 0 V is not 65534 LSB apart.
+//
+// Inputs : 
+//		uint16_t result: latest raw conversion
+//		uint16_t previous: previous raw conversion
+//		uint8_t mode: 0 -> single ended, 1 -> differential
+//
+// Outputs : 
+//		uint8_t agree: 0x01 -> results within adc_settle_band_lsb, 0x00 otherwise
+//
+//**************************************************************************
+uint8_t ADC_settle_compare(uint16_t result, uint16_t previous, uint8_t mode)
+{
+	int32_t difference;
+	
+	if (mode == 0x01)
+		difference = (int32_t)(int16_t)result - (int16_t)previous;
 	else
-		return (float)(adc_vref * (ADC0.RES >> 4) / 2048);	// differential resolution is 11 bits -> 2048 values
+		difference = (int32_t)result - previous;
+	
+	if (difference < 0)
+		difference = -difference;
+	
+	return (difference <= adc_settle_band_lsb);
+}
+//***************************************************************************
+//
+// Function Name : "ADC_wait_settled"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+//	Waits for the input selected by ADC_channelSEL() to settle. In the fixed
+//	settling mode this is the original 10 ms delay. In the adaptive mode
+//	single, non-accumulated conversions are taken back-to-back until
+//	ADC_SETTLE_MATCHES consecutive results agree within adc_settle_band_lsb,
+//	or ADC_SETTLE_TIMEOUT_US expires. The settle time is recorded for the
+//	channel and the caller's configuration is restored afterwards.
+//
+// Inputs : 
+//		uint8_t channel: diagnostics slot, index into adc_scan_channels[]
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_wait_settled(uint8_t channel)
+{
+	if (adc_settle_mode == 0x00)
+	{
+		_delay_ms(10);
+		return;
+	}
+	
+	adc_config measure_config = adc_active_config;
+	adc_config settle_config = adc_active_config;
+	settle_config.sampnum = ADC_SAMPNUM_NONE_gc;	// one sample per conversion
+	ADC_configure(&settle_config);
+	
+	uint32_t start = timebase_ticks();
+	uint32_t elapsed_us;
+	uint8_t matches = 0;
+	uint16_t previous = ADC_read_raw();
+	
+	/* Convert until consecutive results agree or the timeout expires */
+	do
+	{
+		uint16_t result = ADC_read_raw();
+		if (ADC_settle_compare(result, previous, settle_config.mode))
+			matches++;
+		else
+			matches = 0;
+		previous = result;
+		elapsed_us = TIMEBASE_TICKS_TO_US(timebase_ticks() - start);
+	} while ((matches < ADC_SETTLE_MATCHES) && (elapsed_us < ADC_SETTLE_TIMEOUT_US));
+	
+	if (matches < ADC_SETTLE_MATCHES)
+		adc_settle_timeouts++;
+	if (channel < SCAN_CHANNEL_COUNT)
+		adc_settle_time_us[channel] = elapsed_us;
+	
+	ADC_configure(&measure_config);
 }
 //***************************************************************************
 //
@@ -160,38 +596,33 @@ float ADC_read(void)
 // DESCRIPTION
 // Starts a conversion on ADC0 for one battery in the quad pack,
 // reads the result, and converts the result back to an
-// analog voltage
+// analog voltage. Uses the acquisition profile chosen in the settings menu.
+// The reading is added to the noise statistics of its channel.
 //
 // Inputs : 
 //	uint8_t BAT_POS: Positive battery terminal
 //	uint8_t BAT_NEG: Negative battery terminal
 //
 // Outputs :
-//	float result: the analog voltage across the battery
+//	uint16_t result: the analog voltage across the battery in mV
 //
 //**************************************************************************
-float batteryCell_read(uint8_t BAT_POS, uint8_t BAT_NEG)
+uint16_t batteryCell_read(uint8_t BAT_POS, uint8_t BAT_NEG)
 {	
 	/* Differential measurement */
-	ADC_init(0x01);	
+	ADC_scan_stop();
+	
+	ADC_profile_select(0x01, adc_cell_profile);
 	
-	if (voltage_precision == 0x01) //Low precision = 3.3 V voltage reference			
-	{				
-		VREF.ADC0REF = VREF_REFSEL_VDD_gc;
-		adc_vref = 3.3;
-	}
-	else //high precision = 2.048 V voltage reference
-	{
-		VREF.ADC0REF = VREF_REFSEL_2V048_gc;
-		adc_vref = 2.048;
-	}
 	/* Select ADC channel and wait for it to settle*/	
 	ADC_channelSEL(BAT_POS, BAT_NEG);
-	_delay_ms(10);
-	adc_value = ADC_read();
+	uint8_t channel = ADC_scan_lookup(BAT_POS, BAT_NEG);
+	ADC_wait_settled(channel);
+	adc_value_uv = ADC_read();
+	ADC_stats_add(channel, adc_value_uv);
 	
 	/* Multiply by voltage divider ratio to undo attenuation */
-	return (float) (adc_value * battery_voltage_divider_ratios);
+	return ADC_uv_to_cell_mv(adc_value_uv, channel);
 }
 //***************************************************************************
 //
@@ -199,7 +630,10 @@ float batteryCell_read(uint8_t BAT_POS, uint8_t BAT_NEG)
 // Target MCU : AVR128DB48
 // DESCRIPTION
 //  Reads the voltage across each battery cell input and stores the results 
-//	in the UNLOADED_battery_voltgaes array
+//	in the UNLOADED_battery_voltgaes array. All cells come from one sweep of
+//	the scan sequencer, readings still in the measurement cache (e.g. from
+//	the safety check just before the test) are reused. The record takes
+//	the cell count of the test and the ambient temperature of the sweep.
 // Inputs : none
 //
 // Outputs : none
@@ -208,11 +642,21 @@ float batteryCell_read(uint8_t BAT_POS, uint8_t BAT_NEG)
 //**************************************************************************
 void read_UNLOADED_battery_voltages(void)
 {
-	/* Read voltage of each cell and store in array when unloaded */
-	current_test_result.UNLOADED_battery_voltages[0] = batteryCell_read(B1_ADC_CHANNEL, GND_ADC_CHANNEL);	// B1_POS - GND
-	current_test_result.UNLOADED_battery_voltages[1] = batteryCell_read(B2_ADC_CHANNEL, B1_ADC_CHANNEL);	// B2_POS - B1_POS
-	current_test_result.UNLOADED_battery_voltages[2] = batteryCell_read(B3_ADC_CHANNEL, B2_ADC_CHANNEL);	// B3_POS - B2_POS
-	current_test_result.UNLOADED_battery_voltages[3] = batteryCell_read(B4_ADC_CHANNEL, B3_ADC_CHANNEL);	// B4_POS - B3_POS
+	cell_balance_accumulator balance;
+	cell_balance unloaded_balance;
+	
+	/* Read voltage of each cell and store in array when unloaded, the balance is kept as the cells arrive */
+	ADC_cache_acquire();
+	cell_balance_reset(&balance);
+	current_test_result.cell_count = cell_count;
+	for (uint8_t i = 0; i < cell_count; i++)
+	{
+		current_test_result.UNLOADED_battery_voltages[i] = ADC_cache_cell_voltage(SCAN_B1 + i);	// Bi_POS - B(i-1)_POS
+		cell_balance_add(&balance, i, current_test_result.UNLOADED_battery_voltages[i], 0);
+	}
+	cell_balance_store(&balance, &unloaded_balance);
+	current_test_result.unloaded_balance = unloaded_balance;
+	current_test_result.ampient_temp = temperature_record(temperature_ambient());	// sensor is in the same sweep
 }
 //***************************************************************************
 //
@@ -220,7 +664,20 @@ void read_UNLOADED_battery_voltages(void)
 // Target MCU : AVR128DB48
 // DESCRIPTION
 //  Reads the voltage across each battery cell input and stores the results
-//	in the LOADED_battery_voltgaes array
+//	in the LOADED_battery_voltgaes array. The cells are taken as one
+//	time-aligned snapshot: the load current is sampled before and after
+//	every cell, and the current at the moment each cell was sampled is
+//	interpolated from the timestamps and stored in LOADED_load_currents
+//	(amps) and loaded_cell_current_ma.
+//	load_current_ma is updated with the mean current of the snapshot.
+//	The snapshot is taken with the NORMAL acquisition profile, 16 samples
+//	per slot keep the 2 x cell_count + 1 slots within a few ms of each
+//	other while the pile heats. The sweep is copied in one piece before it
+//	is converted, the scan keeps running and may publish the next sweep
+//	meanwhile. The balance
+//	of the loaded cells and the worst sag from the UNLOADED voltages are
+//	kept as the cells arrive and stored with the result, with the settle
+//	time and overshoot of the load current controller.
 // Inputs : none
 //
 // Outputs : none
@@ -229,48 +686,218 @@ void read_UNLOADED_battery_voltages(void)
 //**************************************************************************
 void read_LOADED_battery_voltages(void)
 {
-	/* Read voltage of each cell and store in array once load current reaches 500A */
-	current_test_result.LOADED_battery_voltages[0] = batteryCell_read(B1_ADC_CHANNEL, GND_ADC_CHANNEL);	// B1_POS - GND
-	current_test_result.LOADED_battery_voltages[1] = batteryCell_read(B2_ADC_CHANNEL, B1_ADC_CHANNEL);	// B2_POS - B1_POS
-	current_test_result.LOADED_battery_voltages[2] = batteryCell_read(B3_ADC_CHANNEL, B2_ADC_CHANNEL);	// B3_POS - B2_POS
-	current_test_result.LOADED_battery_voltages[3] = batteryCell_read(B4_ADC_CHANNEL, B3_ADC_CHANNEL);	// B4_POS - B3_POS
+	int32_t current_sum = 0;
+	cell_balance_accumulator balance;
+	cell_balance loaded_balance;
+	uint16_t results[ADC_SCAN_MAX_SLOTS];
+	uint32_t times[ADC_SCAN_MAX_SLOTS];
+	uint8_t ranges[ADC_SCAN_MAX_SLOTS];
+	
+	/* Read voltage of each cell and the current around it once load current reaches 500A */
+	ADC_scan_acquire_sequence(adc_snapshot_sequence, adc_snapshot_length, ADC_PROFILE_NORMAL);
+	ADC_scan_copy(results, times, ranges);
+	cell_balance_reset(&balance);
+	
+	for (uint8_t i = 0; i < cell_count; i++)
+	{
+		/* Slot 2i+1 holds cell i, slots 2i and 2i+2 hold the current before and after it */
+		uint8_t cell_slot = (2*i) + 1;
+		int32_t current_before = load_current_convert(current_range_voltage(results[cell_slot - 1], ADC_PROFILE_NORMAL), ranges[cell_slot - 1]);
+		int32_t current_after = load_current_convert(current_range_voltage(results[cell_slot + 1], ADC_PROFILE_NORMAL), ranges[cell_slot + 1]);
+		uint32_t time_before = times[cell_slot - 1];
+		int32_t span = times[cell_slot + 1] - time_before;
+		int32_t cell_current = current_before;
+		
+		/* Linear interpolation of the load current to the time the cell was sampled, the span is a few ticks */
+		if (span != 0)
+			cell_current += ((current_after - current_before) * (int32_t)(times[cell_slot] - time_before)) / span;
+		
+		current_test_result.LOADED_battery_voltages[i] = ADC_uv_to_cell_mv(ADC_scan_convert(results[cell_slot], adc_snapshot_sequence[cell_slot], ADC_PROFILE_NORMAL), adc_snapshot_sequence[cell_slot]);
+		current_test_result.LOADED_load_currents[i] = (cell_current + 500) / 1000;	// round to nearest amp
+		loaded_cell_current_ma[i] = cell_current;
+		current_sum += cell_current;
+		cell_balance_add(&balance, i, current_test_result.LOADED_battery_voltages[i], current_test_result.UNLOADED_battery_voltages[i]);
+	}
+	
+	load_current_ma = current_sum / cell_count;
+	cell_balance_store(&balance, &loaded_balance);
+	current_test_result.loaded_balance = loaded_balance;
+	current_test_result.sag_permille = balance.sag_permille;
+	current_test_result.sag_cell = balance.sag_cell;
+	current_test_result.settle_ms = control_settle_ms;	// log of the set_load_current() that reached this point
+	current_test_result.overshoot_ma = control_overshoot_ma;
 }
 
 //***************************************************************************
 //
-// Function Name : "OPAMP_Instrumentation_init"
+// Function Name : "load_current_Read"
 // Target MCU : AVR128DB48
 // DESCRIPTION
 // This function reads output of the instrumentation amplifier and converts
-//	it to a current based on the shunt resistance value.
+//	it to a current based on the shunt resistance value. The read is taken
+//	in the active current range and repeated while the result moves the
+//	range, so it always comes from the best range for the current.
 //
-// Inputs : none
+// Inputs : 
+//		uint8_t profile: acquisition profile, FAST inside control loops
 //
 // Outputs : none
-//		float load_current: Analog Load current through shunt in amps
+//		int32_t load_current: Analog Load current through shunt in mA
 //
 //**************************************************************************
-float load_current_Read(void)
+int32_t load_current_Read(uint8_t profile)
 {	
-	/* Put ADC in single-ended mode */
-	ADC_init(0x00);
-	adc_vref = 2.048; //use 2.048 voltage reference
+	adc_config config;
+	uint8_t range;
 	
-	ADC_channelSEL(OPAMP_ADC_CHANNEL, GND_ADC_CHANNEL); //select OPAMP ADC Channel and GND ADC Channel
-	adc_value = ADC_read();		
+	ADC_scan_stop();
+	for (uint8_t attempt = 0; attempt < CURRENT_RANGE_COUNT; attempt++)
+	{
+		/* Put ADC in single-ended mode on the ladder tap of the range */
+		ADC_profile_config(&config, 0x00, profile);
+		range = current_range_apply();
+		ADC_configure(&config);
+		adc_active_profile = profile;
+		_delay_us(CURRENT_RANGE_SETTLE_US);	// OPAMP output after a wiper move
+		
+		ADC_channelSEL(OPAMP_ADC_CHANNEL, GND_ADC_CHANNEL); //select OPAMP ADC Channel and GND ADC Channel
+		adc_value_uv = ADC_read();
+		
+		/* Back to averaged counts: one LSB is vref_mv * 62.5 in Q8 uV */
+		if (current_range_update((uint16_t)((adc_value_uv * 256) / (((uint32_t)adc_vref_mv * 125) / 2))) == 0x00)
+			break;
+	}
 	
-	/* Multiply by divider ratio to undo attenuation, divide by gain to undo gain, divide by resistance to convert to amps */
-	load_current_amps = ((adc_value - 0.096) / (OPAMP_gain*shunt_resistance_ohms));	
+	load_current_ma = load_current_convert(adc_value_uv, range);
+	return load_current_ma;
+}
 
-	if (voltage_precision == 0x01) //Low precision = 3.3 V voltage reference			
-	{				
-		VREF.ADC0REF = VREF_REFSEL_VDD_gc;
-		adc_vref = 3.3;
-	}
+//***************************************************************************
+//
+// Function Name : "load_current_convert"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts the instrumentation amplifier output voltage at the ADC pin to
+//	the load current, shared by the blocking, scan and cached reads. Uses
+//	the auto-zeroed output of the range and the calibrated shunt and gain.
+//
+// Inputs : 
+//		int32_t adc_uv: OPAMP output voltage in uV
+//		uint8_t range: CURRENT_RANGES value the voltage was read in
+//
+// Outputs : 
+//		int32_t load_current: Analog Load current through shunt in mA
+//
+//**************************************************************************
+int32_t load_current_convert(int32_t adc_uv, uint8_t range)
+{
+	/* Subtract the zero of the range, divide by gain of the range to undo gain, divide by resistance to convert to mA
+	   (uV / uOhm = A, x1000 -> mA; at most 2.048 V x 1000 fits 31 bits), then apply the gain trim */
+	int32_t current = ((adc_uv - current_zero_uv[range]) * 1000) / ((int32_t)current_ranges[range].gain * calibration_data.shunt_uohm);
+	current = (current * calibration_data.current_gain_permille) / 1000;
+
+	if(current < CURRENT_NOISE_FLOOR_MA) //if load current is less than 0.2 A, return 0
+		return 0;
+	else //else return current
+		return current;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_stats_reset"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Empties the noise statistics of every scan channel. Called when the
+//	channels are remapped, when the acquisition profile changes and from
+//	the remote interface.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_stats_reset(void)
+{
+	for (uint8_t channel = 0; channel < SCAN_CHANNEL_COUNT; channel++)
+		stream_stats_reset(&adc_channel_stats[channel]);
+	adc_stats_profile = adc_cell_profile;
+	adc_stats_sweep = adc_scan_sweep_count;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_stats_add"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adds one unloaded reading to the streaming statistics of its channel.
+//	Readings taken under load are not added, like the measurement cache,
+//	so the deviation is the noise of a steady input and not the sag.
+//
+// Inputs :
+//		uint8_t channel: ADC_SCAN_CHANNELS value, others are ignored
+//		int32_t value: uV at the ADC pins, 0.1 C for SCAN_TEMPERATURE
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_stats_add(uint8_t channel, int32_t value)
+{
+	if (adc_stats_profile != adc_cell_profile)
+		ADC_stats_reset();	// noise of another profile
+	if (channel >= SCAN_CHANNEL_COUNT)
+		return;
 	
+	/* The remote interface reads the statistics from its ISR */
+	uint8_t sreg = SREG;
+	cli();
+	stream_stats_add(&adc_channel_stats[channel], value);
+	SREG = sreg;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_stats_sweep"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adds every slot of the latest sweep of the background sequence to the
+//	statistics of its channel. Called from the main loop, the sweeps are
+//	taken anyway, so every cached reading comes with a noise figure without
+//	extra conversions and without work in the ADC ISR. Sweeps published
+//	while the main loop was busy are skipped.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_stats_sweep(void)
+{
+	uint16_t raw[ADC_SCAN_MAX_SLOTS];
+	uint8_t length;
 	
-	if(load_current_amps < 0.2) //if load current is less than 0.2, return 0
-		return 0;
-	else //else return load_current_amps
-		return load_current_amps;
+	/* Copy the front buffer with interrupts off so the ISR cannot swap it mid-read */
+	uint8_t sreg = SREG;
+	cli();
+	if ((adc_scan_sweep_count == adc_stats_sweep) || (adc_scan_sequence != adc_scan_default_sequence) || (adc_scan_profile != adc_cell_profile))
+	{
+		SREG = sreg;
+		return;
+	}
+	adc_stats_sweep = adc_scan_sweep_count;
+	length = adc_scan_length;
+	for (uint8_t slot = 0; slot < length; slot++)
+		raw[slot] = adc_scan_table[adc_scan_front][slot];
+	SREG = sreg;
+	
+	for (uint8_t slot = 0; slot < length; slot++)
+	{
+		uint8_t channel = adc_scan_default_sequence[slot];
+		
+		if (channel == SCAN_LOAD_CURRENT)
+			ADC_stats_add(channel, current_range_voltage(raw[slot], adc_cell_profile));	// OPAMP output
+		else if (channel == SCAN_TEMPERATURE)
+			ADC_stats_add(channel, temperature_convert(raw[slot], adc_cell_profile));
+		else
+			ADC_stats_add(channel, ADC_scan_convert(raw[slot], channel, adc_cell_profile));
+	}
 }
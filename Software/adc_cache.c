@@ -0,0 +1,160 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "ADC_cache_sweep"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Called by the scan sequencer when a sweep of the default sequence is
+//	published. Copies the raw result, conversion time and profile of every
+//	channel into the measurement cache. Loaded sequences (monitor, snapshot)
+//	do not feed the cache, so it only ever holds unloaded readings.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_cache_sweep(void)
+{
+	for (uint8_t slot = 0; slot < adc_scan_length; slot++)
+	{
+		uint8_t channel = adc_scan_sequence[slot];
+
+		adc_cache_raw[channel] = adc_scan_table[adc_scan_front][slot];
+		adc_cache_time[channel] = adc_scan_time[adc_scan_front][slot];
+		adc_cache_profile[channel] = adc_scan_profile;
+		if (channel == SCAN_LOAD_CURRENT)
+			adc_cache_current_range = adc_scan_range[adc_scan_front][slot];
+		adc_cache_valid |= (1U << channel);
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_cache_is_fresh"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Checks whether the cached reading of a channel is younger than the
+//	freshness window and was taken with the current cell acquisition profile.
+//
+// Inputs :
+//		uint8_t channel: ADC_SCAN_CHANNELS value
+//
+// Outputs :
+//		uint8_t fresh: 0x01 -> reading can be reused, 0x00 -> re-acquire
+//
+//**************************************************************************
+uint8_t ADC_cache_is_fresh(uint8_t channel)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t valid = (adc_cache_valid >> channel) & 0x01;
+	uint32_t age = timebase_ticks() - adc_cache_time[channel];
+	uint8_t profile = adc_cache_profile[channel];
+	SREG = sreg;
+
+	/* Compare in ticks, an old timestamp must not wrap into the window */
+	if ((valid == 0x00) || (profile != adc_cell_profile))
+		return 0x00;
+	return (age <= (((uint32_t)adc_cache_window_ms * TIMEBASE_HZ) / 1000));
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_cache_acquire"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Makes sure every channel of the default sequence has a fresh reading in
+//	the cache. A hit reuses the cache, a miss acquires one new sweep. The
+//	background scan keeps the cache fresh while the main loop runs, so a
+//	test that starts right after the safety check reuses its readings.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_cache_acquire(void)
+{
+	for (uint8_t slot = 0; slot < adc_scan_default_length; slot++)
+	{
+		if (ADC_cache_is_fresh(adc_scan_default_sequence[slot]) == 0x00)
+		{
+			adc_cache_misses++;
+			ADC_scan_acquire();	// publishes a default sweep, which refills the cache
+			return;
+		}
+	}
+	adc_cache_hits++;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_cache_voltage"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts the cached reading of a channel to the voltage at the ADC pins.
+//
+// Inputs :
+//		uint8_t channel: ADC_SCAN_CHANNELS value
+//
+// Outputs :
+//		int32_t result: voltage at the ADC pins in uV
+//
+//**************************************************************************
+int32_t ADC_cache_voltage(uint8_t channel)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t result = adc_cache_raw[channel];
+	uint8_t profile = adc_cache_profile[channel];
+	SREG = sreg;
+
+	return ADC_scan_convert(result, channel, profile);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_cache_cell_voltage"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the cached battery voltage of a channel with the attenuation of
+//	the battery voltage divider undone.
+//
+// Inputs :
+//		uint8_t channel: SCAN_B1..SCAN_B8 or SCAN_PACK
+//
+// Outputs :
+//		uint16_t result: battery voltage in mV
+//
+//**************************************************************************
+uint16_t ADC_cache_cell_voltage(uint8_t channel)
+{
+	return ADC_uv_to_cell_mv(ADC_cache_voltage(channel), channel);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_cache_load_current"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the cached load current, converted in the range it was taken in.
+//
+// Inputs : None
+//
+// Outputs :
+//		int32_t result: load current through the shunt in mA
+//
+//**************************************************************************
+int32_t ADC_cache_load_current(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t result = adc_cache_raw[SCAN_LOAD_CURRENT];
+	uint8_t profile = adc_cache_profile[SCAN_LOAD_CURRENT];
+	uint8_t range = adc_cache_current_range;
+	SREG = sreg;
+
+	return load_current_convert(current_range_voltage(result, profile), range);
+}
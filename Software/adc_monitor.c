@@ -0,0 +1,171 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "ISR(ADC0_WCMP_vect)"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Window comparator interrupt, a monitored cell conversion fell below the
+//	floor. Normally the RESRDY interrupt has priority and trips first from
+//	ADC_scan_service(), this vector covers a comparator flag on its own.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+ISR(ADC0_WCMP_vect)
+{
+	if (adc_monitor_active == 0x01)
+		ADC_monitor_trip();
+	else
+		ADC0.INTFLAGS = ADC_WCMP_bm;	// stale flag, clear it
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_monitor_start"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts the scan sequencer on the monitor sequence with the FAST
+//	acquisition profile, one slot every adc_sample_period_us, and arms the
+//	ADC0 window comparator below chemistry_active->min_loaded_mv. The floor is computed at the
+//	pins of every cell with its calibration. Only the stored conversions
+//	of the cell slots are compared, the load current slots and the settling
+//	conversions are not, so no cell is compared in software while the load
+//	is ramped.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_monitor_start(void)
+{
+	uint8_t profile = ADC_PROFILE_FAST;
+
+	adc_monitor_tripped = 0x00;
+	adc_monitor_trip_cell = 0;
+	adc_monitor_trip_current = 0;
+
+	/* Floor at the ADC pins of each cell in accumulated differential counts of the profile */
+	for (uint8_t channel = SCAN_B1; channel < (SCAN_B1 + cell_count); channel++)
+	{
+		int32_t floor_uv = (((uint32_t)chemistry_active->min_loaded_mv * 1000000) / calibration_data.divider_permille[channel]) + calibration_data.offset_uv[channel];
+		if (floor_uv < 0)
+			floor_uv = 0;
+		
+		/* 2048 / (vref_mv x 1000) reduced to 256 / (vref_mv x 125), so the product stays inside 32 bits at the lowest divider ratio */
+		uint32_t counts = ((uint32_t)floor_uv * 256) / ((uint32_t)ADC_profile_vref_mv(profile) * 125);
+		if (counts > 2047)
+			counts = 2047;	// floor above full scale, every conversion trips
+		adc_monitor_winlt[channel] = (int16_t)(counts << adc_profiles[profile].shift);
+	}
+	ADC0.INTFLAGS = ADC_WCMP_bm;
+	ADC0.INTCTRL |= ADC_WCMP_bm;	// enables window comparator interrupt
+	adc_monitor_active = 0x01;
+
+	ADC_scan_start_sequence(adc_monitor_sequence, adc_monitor_length, profile, adc_sample_period_us);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_monitor_stop"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Disarms the window comparator. The scan sequencer keeps running until it
+//	is stopped or restarted on another sequence.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_monitor_stop(void)
+{
+	adc_monitor_active = 0x00;
+	ADC0.CTRLE = ADC_WINCM_NONE_gc;
+	ADC0.INTCTRL &= ~ADC_WCMP_bm;
+	ADC0.INTFLAGS = ADC_WCMP_bm;	// clear flag of a pending comparison
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_monitor_window"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Called by the scan sequencer before each conversion. While monitoring,
+//	arms the window comparator with the floor of the cell when the
+//	conversion is a stored cell result and disarms it for everything else.
+//
+// Inputs :
+//		uint8_t channel: ADC_SCAN_CHANNELS value of a stored conversion,
+//						 SCAN_CHANNEL_COUNT for discarded or settling ones
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_monitor_window(uint8_t channel)
+{
+	if (adc_monitor_active == 0x00)
+		return;
+
+	if (channel < (SCAN_B1 + CELL_COUNT_MAX))
+	{
+		ADC0.WINLT = adc_monitor_winlt[channel];
+		ADC0.CTRLE = ADC_WINCM_BELOW_gc;	// flag results below WINLT
+	}
+	else
+		ADC0.CTRLE = ADC_WINCM_NONE_gc;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_monitor_trip"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// A cell fell below chemistry_active->min_loaded_mv. Records the cell of the slot being
+//	converted and the load current of the last monitor sweep, releases ADC0
+//	and stops the knob. Runs from the scan ISR, or polled from a wait on
+//	the scan or the motion engine, so nothing here may block: the control
+//	loop sees adc_monitor_tripped and opens the load at task level.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_monitor_trip(void)
+{
+	adc_monitor_trip_cell = adc_scan_sequence[adc_scan_index] + 1;	// SCAN_B1..SCAN_B8 -> cell 1-8
+	adc_monitor_trip_current = MA_WHOLE(load_current_ma);
+	adc_monitor_tripped = 0x01;
+
+	ADC_monitor_stop();
+	ADC_scan_stop();
+	motion_stop();	// no further step into the pile, a profiled move ramps down
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_monitor_current"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Waits for the next sweep of the monitor sequence and returns the load
+//	current of its last current slot. Returns 0 if the monitor tripped.
+//
+// Inputs : None
+//
+// Outputs :
+//		int32_t current: load current through the shunt in mA
+//
+//**************************************************************************
+int32_t ADC_monitor_current(void)
+{
+	ADC_scan_wait_sweep();
+
+	if (adc_monitor_tripped == 0x01)
+		return 0;
+
+	return ADC_scan_load_current(adc_monitor_length - 2);	// last current slot of the sweep
+}
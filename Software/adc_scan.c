@@ -0,0 +1,658 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_select"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Points ADC0 at one entry of the scan channel list. Applies the scan
+//	profile for the channel and writes both MUX registers, then arms
+//	the settling logic: in the fixed mode a number of conversions is thrown
+//	away, in the adaptive mode single fast conversions are taken until two
+//	in a row agree. In the timed mode every triggered conversion is stored,
+//	the input settles during the rest of the sample period.
+//
+// Inputs :
+//		uint8_t channel: index into adc_scan_channels[]
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_select(uint8_t channel)
+{
+	/* Only CTRLA changes between channels, the configuration cache skips the rest */
+	adc_config config;
+	ADC_profile_config(&config, adc_scan_channels[channel].mode, adc_scan_profile);
+	
+	/* The load current channel is read on the ladder tap of its range */
+	if (channel == SCAN_LOAD_CURRENT)
+		adc_scan_select_range = current_range_apply();
+	else if (channel == SCAN_TEMPERATURE)
+		temperature_apply(&config);
+	
+	/* Timed mode: the next trigger is a full sample period away, no settling needed */
+	if (adc_scan_timed == 0x00)
+		ADC_scan_arm_settling(&config);
+	ADC_scan_configure(&config);
+	
+	ADC0.MUXPOS = adc_scan_channels[channel].muxpos;
+	ADC0.MUXNEG = adc_scan_channels[channel].muxneg;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_configure"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Applies a configuration from the scan ISR. A new reference is not
+//	waited for here: the conversions taken in the next ADC_VREF_SETTLE_US
+//	are thrown away by ADC_scan_service() instead.
+//
+// Inputs :
+//		const adc_config *config: configuration to apply
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_configure(const adc_config *config)
+{
+	if (ADC_configure_registers(config) == 0x01)
+	{
+		adc_scan_vref_settling = 0x01;
+		adc_scan_vref_start = timebase_ticks();
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_arm_settling"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Arms the settling logic of the free running mode for a newly selected
+//	channel, switching the configuration to single conversions in the
+//	adaptive mode.
+//
+// Inputs :
+//		adc_config *config: configuration of the selected channel
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_arm_settling(adc_config *config)
+{
+	if (adc_settle_mode == 0x01)
+	{
+		config->sampnum = ADC_SAMPNUM_NONE_gc;	// fast single conversions while settling
+		adc_scan_settling = 0x01;
+		adc_scan_settle_matches = 0;
+		adc_scan_settle_first = 0x01;
+		adc_scan_settle_start = timebase_ticks();
+	}
+	else
+	{
+		adc_scan_discard = ADC_SCAN_SETTLE_CONVERSIONS;	// let the input settle before storing results
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_lookup"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Finds the scan channel list entry that measures a MUX pair, used to
+//	file settling diagnostics of the blocking reads under the same channel.
+//
+// Inputs :
+//		uint8_t AIN_POS: Positive differential or single-ended input
+//		uint8_t AIN_NEG: Negative differential input
+//
+// Outputs :
+//		uint8_t channel: index into adc_scan_channels[], SCAN_CHANNEL_COUNT
+//						 if the pair is not in the list
+//
+//**************************************************************************
+uint8_t ADC_scan_lookup(uint8_t AIN_POS, uint8_t AIN_NEG)
+{
+	for (uint8_t i = 0; i < SCAN_CHANNEL_COUNT; i++)
+	{
+		if ((adc_scan_channels[i].muxpos == AIN_POS) && (adc_scan_channels[i].muxneg == AIN_NEG))
+			return i;
+	}
+	return SCAN_CHANNEL_COUNT;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_start"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts the background scan sequencer on the default sequence, one slot
+//	per cell, the pack, the load current and the temperature sensor, with
+//	the cell acquisition profile.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_start(void)
+{
+	ADC_scan_start_sequence(adc_scan_default_sequence, adc_scan_default_length, adc_cell_profile, 0);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_start_sequence"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts the scan sequencer at the first slot of a sequence of channels.
+//	Each conversion accumulates the samples of the acquisition profile and
+//	raises the RESRDY interrupt, the ISR stores the result and moves ADC0 to
+//	the channel of the next slot. A channel may appear in several slots.
+//	Calling this while a scan is running restarts the sweep from the first
+//	slot. With a sample period the conversions are started by TCB0 through
+//	the event system (see "adc_timed.c") instead of back-to-back. A longer
+//	sequence than the sample table holds is cut to ADC_SCAN_MAX_SLOTS, an
+//	empty one leaves the scan stopped.
+//
+// Inputs :
+//		const uint8_t *sequence: list of ADC_SCAN_CHANNELS, one per slot
+//		uint8_t length: number of slots, at most ADC_SCAN_MAX_SLOTS
+//		uint8_t profile: acquisition profile used for every slot
+//		uint16_t period_us: sample period of the timed mode, 0 -> free running
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_start_sequence(const uint8_t *sequence, uint8_t length, uint8_t profile, uint16_t period_us)
+{
+	adc_scan_running = 0x00;	// keep the ISR away while ADC0 is reprogrammed
+	ADC_timed_stop();
+	ADC_stopConversion();
+	if (length == 0)
+		return;
+	if (length > ADC_SCAN_MAX_SLOTS)
+		length = ADC_SCAN_MAX_SLOTS;	// the sample table has no room for more slots
+	adc_scan_discard = 0;
+	adc_scan_settling = 0x00;
+	adc_scan_vref_settling = 0x00;
+
+	adc_scan_profile = profile;
+	if (period_us != 0)
+		adc_scan_timed = 0x01;
+	else
+		adc_scan_timed = 0x00;
+
+	adc_scan_sequence = sequence;
+	adc_scan_length = length;
+	adc_scan_index = 0;
+	ADC_scan_select(adc_scan_sequence[adc_scan_index]);
+
+	/* Discard any stale result and enable the RESRDY interrupt */
+	ADC0.INTFLAGS = ADC_RESRDY_bm;
+	ADC0.INTCTRL |= ADC_RESRDY_bm;
+
+	adc_scan_running = 0x01;
+	ADC_scan_begin_conversion();
+	if (adc_scan_timed == 0x01)
+		ADC_timed_start(period_us);	// first conversion on the first trigger
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_stop"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Stops the background scan sequencer so ADC0 can be used by the blocking
+//	read functions. The last published sweep stays in the sample table.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_stop(void)
+{
+	adc_scan_running = 0x00;
+	ADC_timed_stop();
+	adc_scan_timed = 0x00;
+	ADC_stopConversion();
+	ADC0.INTFLAGS = ADC_RESRDY_bm;	// clear flag of a conversion that was in progress
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_service"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Called from the ADC0 RESRDY ISR (or polled when interrupts are disabled).
+//	Stores the finished conversion and its timestamp in the back buffer of
+//	the sample table, switches to the channel of the next slot and starts
+//	the next conversion. When the last slot of the sequence is stored the
+//	buffers are swapped, so readers always see one complete sweep. The
+//	conversion time of every stored result is filed under the scan profile.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_service(void)
+{
+	/* Window comparator flagged a monitored cell below the floor -> open the load first */
+	if ((adc_monitor_active == 0x01) && (ADC0.INTFLAGS & ADC_WCMP_bm))
+	{
+		ADC_monitor_trip();
+		return;
+	}
+
+	uint16_t result = ADC0.RES;	// reading ADC0.RES clears the interrupt flag
+
+	/* Thrown away conversions must not show up as missed results in the jitter report */
+	if ((adc_scan_timed == 0x01) && ((adc_scan_vref_settling == 0x01) || (adc_scan_discard != 0) || (adc_scan_settling == 0x01)))
+		ADC_timed_discard();
+
+	/* The scan changed the reference -> throw conversions away until it has settled */
+	if (adc_scan_vref_settling == 0x01)
+	{
+		if ((uint32_t)(timebase_ticks() - adc_scan_vref_start) >= ADC_VREF_SETTLE_TICKS)
+			adc_scan_vref_settling = 0x00;	// the next conversion starts on the settled reference
+		ADC_scan_begin_conversion();
+		return;
+	}
+
+	/* Fixed settling mode: conversions taken while the input settles are thrown away */
+	if (adc_scan_discard != 0)
+	{
+		adc_scan_discard--;
+	}
+	/* Adaptive settling mode: accept the channel once consecutive conversions agree */
+	else if (adc_scan_settling == 0x01)
+	{
+		uint32_t elapsed_us = TIMEBASE_TICKS_TO_US(timebase_ticks() - adc_scan_settle_start);
+		
+		/* The first conversion after the switch has nothing to be compared with */
+		if ((adc_scan_settle_first == 0x00) && ADC_settle_compare(result, adc_scan_settle_previous, adc_scan_channels[adc_scan_sequence[adc_scan_index]].mode))
+			adc_scan_settle_matches++;
+		else
+			adc_scan_settle_matches = 0;
+		adc_scan_settle_previous = result;
+		adc_scan_settle_first = 0x00;
+		
+		if ((adc_scan_settle_matches >= ADC_SETTLE_MATCHES) || (elapsed_us >= ADC_SETTLE_TIMEOUT_US))
+		{
+			if (adc_scan_settle_matches < ADC_SETTLE_MATCHES)
+				adc_settle_timeouts++;
+			adc_settle_time_us[adc_scan_sequence[adc_scan_index]] = elapsed_us;
+			adc_scan_settling = 0x00;
+			
+			/* Next conversion is the accumulated one that gets stored */
+			adc_config config;
+			ADC_profile_config(&config, adc_scan_channels[adc_scan_sequence[adc_scan_index]].mode, adc_scan_profile);
+			if (adc_scan_sequence[adc_scan_index] == SCAN_TEMPERATURE)
+				temperature_apply(&config);
+			ADC_scan_configure(&config);
+		}
+	}
+	else
+	{
+		/* Write into back buffer */
+		uint32_t now = timebase_ticks();
+		adc_scan_table[adc_scan_front ^ 0x01][adc_scan_index] = result;
+		adc_scan_time[adc_scan_front ^ 0x01][adc_scan_index] = now;
+		if (adc_scan_sequence[adc_scan_index] == SCAN_LOAD_CURRENT)
+		{
+			adc_scan_range[adc_scan_front ^ 0x01][adc_scan_index] = adc_scan_select_range;
+			current_range_update((uint16_t)result >> adc_profiles[adc_scan_profile].shift);	// takes effect at the next selection
+		}
+		if (adc_scan_timed == 0x01)
+			ADC_timed_record();	// conversion started by the trigger, measure the sample interval instead
+		else
+			adc_profile_conversion_us[adc_scan_profile] = ADC_conversion_time_us(adc_scan_convert_start);
+		adc_scan_index++;
+
+		/* End of sequence -> publish the sweep and start over */
+		if (adc_scan_index >= adc_scan_length)
+		{
+			adc_scan_front ^= 0x01;
+			adc_scan_sweep_count++;
+			adc_scan_index = 0;
+			sag_capture_sweep();
+			if (adc_scan_sequence == adc_scan_default_sequence)
+				ADC_cache_sweep();
+		}
+		ADC_scan_select(adc_scan_sequence[adc_scan_index]);
+	}
+
+	ADC_scan_begin_conversion();
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_begin_conversion"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts the next conversion on the active slot. Conversions that will be
+//	stored are timed for the profile and, while the undervoltage monitor is
+//	active, checked by the window comparator. In the timed mode only the
+//	comparator is armed, the trigger starts the conversion.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_begin_conversion(void)
+{
+	if ((adc_scan_discard == 0) && (adc_scan_settling == 0x00) && (adc_scan_vref_settling == 0x00))
+	{
+		adc_scan_convert_start = TCB2.CNT;
+		ADC_monitor_window(adc_scan_sequence[adc_scan_index]);
+	}
+	else
+		ADC_monitor_window(SCAN_CHANNEL_COUNT);	// settling conversions are never compared
+	
+	if (adc_scan_timed == 0x00)
+		ADC_startConversion();
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_acquire"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Acquires one fresh sweep of the default sequence with the cell
+//	acquisition profile.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_acquire(void)
+{
+	ADC_scan_acquire_sequence(adc_scan_default_sequence, adc_scan_default_length, adc_cell_profile);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_acquire_sequence"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Restarts the scan sequencer on a sequence and waits until one complete
+//	sweep has been published, so every slot of the sample table was
+//	converted after this call. The FSMs run inside pushbutton and USART
+//	interrupts with global interrupts disabled, in that case the RESRDY
+//	flag is polled here instead.
+//
+// Inputs :
+//		const uint8_t *sequence: list of ADC_SCAN_CHANNELS, one per slot
+//		uint8_t length: number of slots, at most ADC_SCAN_MAX_SLOTS
+//		uint8_t profile: acquisition profile used for every slot
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_acquire_sequence(const uint8_t *sequence, uint8_t length, uint8_t profile)
+{
+	ADC_scan_start_sequence(sequence, length, profile, 0);
+	ADC_scan_wait_sweep();
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_wait_sweep"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Waits until the running scan publishes its next sweep. When global
+//	interrupts are disabled the RESRDY flag, and the step count of a move
+//	of the knob, are polled here instead. Returns
+//	early if the scan is stopped, e.g. by an undervoltage trip.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_wait_sweep(void)
+{
+	uint16_t sweep = adc_scan_sweep_count;
+
+	/* Wait for the sweep count to change */
+	while ((sweep == adc_scan_sweep_count) && (adc_scan_running == 0x01))
+	{
+		if (!(SREG & CPU_I_bm) && ADC_isConversionDone())
+			ADC_scan_service();
+		motion_poll();
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_poll_ms"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Delay that keeps the running scan (and with it the sag capture) and a
+//	move of the knob going while global interrupts are disabled, replaces _delay_ms() in the test
+//	loops that run inside the FSM interrupts.
+//
+// Inputs :
+//		uint16_t ms: delay in milliseconds
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_poll_ms(uint16_t ms)
+{
+	uint32_t start = timebase_ticks();
+
+	while (TIMEBASE_TICKS_TO_MS(timebase_ticks() - start) < ms)
+	{
+		if (!(SREG & CPU_I_bm) && (adc_scan_running == 0x01) && ADC_isConversionDone())
+			ADC_scan_service();
+		motion_poll();
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_poll_us"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Same as ADC_scan_poll_ms() for short delays, resolution is one timebase
+//	tick (30.5 us).
+//
+// Inputs :
+//		uint16_t us: delay in microseconds
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_poll_us(uint16_t us)
+{
+	uint32_t start = timebase_ticks();
+
+	while (TIMEBASE_TICKS_TO_US(timebase_ticks() - start) < us)
+	{
+		if (!(SREG & CPU_I_bm) && (adc_scan_running == 0x01) && ADC_isConversionDone())
+			ADC_scan_service();
+		motion_poll();
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_latest_current"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the load current of the last SCAN_LOAD_CURRENT slot of the
+//	active sequence, 0 if the sequence has none.
+//
+// Inputs : None
+//
+// Outputs :
+//		int32_t result: load current through the shunt in mA
+//
+//**************************************************************************
+int32_t ADC_scan_latest_current(void)
+{
+	for (uint8_t slot = adc_scan_length; slot > 0; slot--)
+	{
+		if (adc_scan_sequence[slot - 1] == SCAN_LOAD_CURRENT)
+			return ADC_scan_load_current(slot - 1);
+	}
+	return 0;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_voltage"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts the most recent published result of a sequence slot to the
+//	voltage at the ADC pins. In the default sequence slot i holds cell i,
+//	followed by the pack and the load current.
+//
+// Inputs :
+//		uint8_t slot: slot of the active sequence
+//
+// Outputs :
+//		int32_t result: voltage at the ADC pins in uV
+//
+//**************************************************************************
+int32_t ADC_scan_voltage(uint8_t slot)
+{
+	/* Read the front buffer with interrupts off so the ISR cannot swap it mid-read */
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t result = adc_scan_table[adc_scan_front][slot];
+	SREG = sreg;
+
+	return ADC_scan_convert(result, adc_scan_sequence[slot], adc_scan_profile);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_convert"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts a raw accumulated result of a scan channel to the voltage at
+//	the ADC pins, using the accumulation depth and reference of the profile
+//	it was taken with.
+//
+// Inputs :
+//		uint16_t result: raw ADC0.RES value
+//		uint8_t channel: ADC_SCAN_CHANNELS value the result belongs to
+//		uint8_t profile: acquisition profile the result was taken with
+//
+// Outputs :
+//		int32_t result: voltage at the ADC pins in uV
+//
+//**************************************************************************
+int32_t ADC_scan_convert(uint16_t result, uint8_t channel, uint8_t profile)
+{
+	return ADC_counts_to_uv(result, adc_scan_channels[channel].mode, ADC_profile_vref_mv(profile), adc_profiles[profile].shift);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_cell_voltage"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the most recent battery voltage of a sequence slot with the
+//	attenuation of the battery voltage divider undone.
+//
+// Inputs :
+//		uint8_t slot: slot measuring SCAN_B1..SCAN_B8 or SCAN_PACK
+//
+// Outputs :
+//		uint16_t result: battery voltage in mV
+//
+//**************************************************************************
+uint16_t ADC_scan_cell_voltage(uint8_t slot)
+{
+	return ADC_uv_to_cell_mv(ADC_scan_voltage(slot), adc_scan_sequence[slot]);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_load_current"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the most recent load current of a sequence slot, using the
+//	same conversion as load_current_Read() in the range the slot was
+//	converted in.
+//
+// Inputs :
+//		uint8_t slot: slot measuring SCAN_LOAD_CURRENT
+//
+// Outputs :
+//		int32_t result: load current through the shunt in mA
+//
+//**************************************************************************
+int32_t ADC_scan_load_current(uint8_t slot)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t result = adc_scan_table[adc_scan_front][slot];
+	uint8_t range = adc_scan_range[adc_scan_front][slot];
+	SREG = sreg;
+
+	return load_current_convert(current_range_voltage(result, adc_scan_profile), range);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_time"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the timebase count at which the most recent published result of
+//	a sequence slot finished converting.
+//
+// Inputs :
+//		uint8_t slot: slot of the active sequence
+//
+// Outputs :
+//		uint32_t ticks: timebase ticks, see timebase_ticks()
+//
+//**************************************************************************
+uint32_t ADC_scan_time(uint8_t slot)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t ticks = adc_scan_time[adc_scan_front][slot];
+	SREG = sreg;
+	
+	return ticks;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_scan_copy"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Copies every slot of the most recent published sweep: raw results,
+//	timestamps and current ranges. The copy is taken with interrupts off,
+//	so all slots come from the same sweep even while the scan keeps
+//	swapping the buffers.
+//
+// Inputs :
+//		uint16_t *results: raw ADC0.RES values, ADC_SCAN_MAX_SLOTS long
+//		uint32_t *times: timebase ticks, ADC_SCAN_MAX_SLOTS long
+//		uint8_t *ranges: current range of the load current slots, ADC_SCAN_MAX_SLOTS long
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_scan_copy(uint16_t *results, uint32_t *times, uint8_t *ranges)
+{
+	uint8_t sreg = SREG;
+	cli();
+	for (uint8_t slot = 0; slot < adc_scan_length; slot++)
+	{
+		results[slot] = adc_scan_table[adc_scan_front][slot];
+		times[slot] = adc_scan_time[adc_scan_front][slot];
+		ranges[slot] = adc_scan_range[adc_scan_front][slot];
+	}
+	SREG = sreg;
+}
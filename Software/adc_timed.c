@@ -0,0 +1,139 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "ADC_timed_start"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts the hardware trigger of the timed acquisition mode. TCB0 runs in
+//	periodic interrupt mode and its CAPT event is routed through EVSYS
+//	channel 0 to the ADC0 start-of-conversion input, so every conversion
+//	starts exactly one period after the previous one, whatever the CPU is
+//	doing. TCB1 runs free at the same clock to timestamp the results for
+//	the jitter report.
+//
+// Inputs :
+//		uint16_t period_us: sample period, ADC_TIMED_MIN_PERIOD_US to
+//							ADC_TIMED_MAX_PERIOD_US
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_timed_start(uint16_t period_us)
+{
+	if (period_us < ADC_TIMED_MIN_PERIOD_US)
+		period_us = ADC_TIMED_MIN_PERIOD_US;
+	if (period_us > ADC_TIMED_MAX_PERIOD_US)
+		period_us = ADC_TIMED_MAX_PERIOD_US;
+
+	adc_timed_period_us = period_us;
+	adc_timed_samples = 0;
+	adc_timed_intervals = 0;
+	adc_timed_restart = 0x01;
+	adc_timed_discarded = 0;
+	adc_timed_interval_sum = 0;
+	adc_timed_interval_min = 0xFFFF;
+	adc_timed_interval_max = 0;
+	adc_timed_missed = 0;
+
+	/* TCB1: free running timestamp counter, 0.5 us per count */
+	TCB1.CTRLA = 0x00;
+	TCB1.CTRLB = TCB_CNTMODE_INT_gc;
+	TCB1.CCMP = 0xFFFF;
+	TCB1.CNT = 0;
+	TCB1.CTRLA = (TCB_CLKSEL_DIV2_gc | TCB_ENABLE_bm);
+
+	/* TCB0: CAPT event every period */
+	TCB0.CTRLA = 0x00;
+	TCB0.CTRLB = TCB_CNTMODE_INT_gc;	// periodic interrupt mode, no interrupt enabled
+	TCB0.CCMP = (period_us * ADC_TIMED_COUNTS_PER_US) - 1;
+	TCB0.CNT = 0;
+
+	/* TCB0 CAPT -> EVSYS channel 0 -> ADC0 start of conversion */
+	EVSYS.CHANNEL0 = EVSYS_CHANNEL0_TCB0_CAPT_gc;
+	EVSYS.USERADC0START = EVSYS_USER_CHANNEL0_gc;
+	ADC0.EVCTRL = ADC_STARTEI_bm;
+
+	TCB0.CTRLA = (TCB_CLKSEL_DIV2_gc | TCB_ENABLE_bm);
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_timed_stop"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Stops the hardware trigger, conversions are started by software again.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_timed_stop(void)
+{
+	TCB0.CTRLA = 0x00;
+	ADC0.EVCTRL = 0x00;
+	EVSYS.USERADC0START = 0x00;
+	TCB1.CTRLA = 0x00;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_timed_record"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Called by the scan sequencer for every timed result. Measures the
+//	interval since the previous result with TCB1. The interval includes the
+//	latency of the RESRDY interrupt (or of the polling loop while interrupts
+//	are disabled), so it is an upper bound for the jitter of the hardware
+//	triggered sample instants. An interval of more than 1.5 periods means a
+//	result was overwritten before it was collected. No interval is measured
+//	across a discarded conversion, see ADC_timed_discard().
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_timed_record(void)
+{
+	uint16_t now = TCB1.CNT;
+
+	if (adc_timed_restart == 0x00)
+	{
+		uint16_t interval = now - adc_timed_last;	// 16-bit wrap is fine below 32 ms, see ADC_TIMED_MAX_PERIOD_US
+
+		adc_timed_intervals++;
+		adc_timed_interval_sum += interval;
+		if (interval < adc_timed_interval_min)
+			adc_timed_interval_min = interval;
+		if (interval > adc_timed_interval_max)
+			adc_timed_interval_max = interval;
+		if (interval > (((uint32_t)adc_timed_period_us * ADC_TIMED_COUNTS_PER_US * 3) / 2))
+			adc_timed_missed++;
+	}
+	adc_timed_last = now;
+	adc_timed_restart = 0x00;
+	adc_timed_samples++;
+}
+
+//***************************************************************************
+//
+// Function Name : "ADC_timed_discard"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Called by the scan sequencer for every timed result it throws away
+//	while the reference or the input settles. The discard is counted on its
+//	own, and the gap it leaves is not measured as an interval, so it is not
+//	reported as a missed result.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void ADC_timed_discard(void)
+{
+	adc_timed_discarded++;
+	adc_timed_restart = 0x01;
+}
@@ -0,0 +1,320 @@
+#include "main.h"
+
+calibration EEMEM calibration_eeprom;	// stored calibration table, in the EEPROM settings area
+
+/* All settings must fit the area reserved in front of the test history */
+typedef char settings_fit_eeprom[(EEPROM_CONFIG_USED <= EEPROM_CONFIG_BYTES) ? 1 : -1];
+
+//***************************************************************************
+//
+// Function Name : "calibration_checksum"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Computes the checksum of a calibration table: the inverted byte sum of
+//	everything in front of the checksum field, so an erased (0xFF) or half
+//	written table is not accepted.
+//
+// Inputs :
+//		const calibration *table: table to check
+//
+// Outputs :
+//		uint8_t checksum: expected value of table->checksum
+//
+//**************************************************************************
+uint8_t calibration_checksum(const calibration *table)
+{
+	const uint8_t *bytes = (const uint8_t *)table;
+	uint8_t sum = 0;
+
+	for (uint8_t i = 0; i < offsetof(calibration, checksum); i++)
+		sum += bytes[i];
+
+	return (uint8_t)~sum;
+}
+
+//***************************************************************************
+//
+// Function Name : "calibration_defaults"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Loads the nominal design values into the working calibration table: the
+//	tap divider of the board on every channel without offset, the 145 uOhm shunt without
+//	gain trim and the nominal amplifier output with no load current.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void calibration_defaults(void)
+{
+	for (uint8_t channel = 0; channel < CALIBRATION_CHANNELS; channel++)
+	{
+		calibration_data.divider_permille[channel] = CALIBRATION_DEFAULT_DIVIDER_PERMILLE;
+		calibration_data.offset_uv[channel] = 0;
+	}
+	for (uint8_t range = 0; range < CURRENT_RANGE_COUNT; range++)
+		calibration_data.current_zero_uv[range] = current_range_offset_uv(range);
+
+	calibration_data.shunt_uohm = CALIBRATION_DEFAULT_SHUNT_UOHM;
+	calibration_data.current_gain_permille = 1000;
+	calibration_data.magic = CALIBRATION_MAGIC;
+	calibration_data.checksum = calibration_checksum(&calibration_data);
+}
+
+//***************************************************************************
+//
+// Function Name : "calibration_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Copies the calibration table from EEPROM into the working table used by
+//	the conversions. An unwritten or corrupted table falls back to the
+//	defaults. The stored no-load zero of every current range is used until
+//	the next auto-zero.
+//
+// Inputs : None
+//
+// Outputs :
+//		uint8_t valid: 0x01 -> EEPROM table loaded, 0x00 -> defaults in use
+//
+//**************************************************************************
+uint8_t calibration_load(void)
+{
+	uint8_t valid = 0x01;
+
+	eeprom_read_block(&calibration_data, &calibration_eeprom, sizeof(calibration));
+	if ((calibration_data.magic != CALIBRATION_MAGIC) || (calibration_data.checksum != calibration_checksum(&calibration_data)))
+	{
+		calibration_defaults();
+		valid = 0x00;
+	}
+
+	for (uint8_t range = 0; range < CURRENT_RANGE_COUNT; range++)
+		current_zero_uv[range] = calibration_data.current_zero_uv[range];
+	current_zero_accepted = 0;
+
+	calibration_valid = valid;
+	return valid;
+}
+
+//***************************************************************************
+//
+// Function Name : "calibration_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Writes the working calibration table to EEPROM. Only bytes that changed
+//	are written.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void calibration_save(void)
+{
+	calibration_data.magic = CALIBRATION_MAGIC;
+	calibration_data.checksum = calibration_checksum(&calibration_data);
+	eeprom_update_block(&calibration_data, &calibration_eeprom, sizeof(calibration));
+	calibration_valid = 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "calibration_auto_zero"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Measures the amplifier output of every current range the board can
+//	select (CURRENT_RANGE_USABLE) with the load open
+//	and uses it as the zero of load_current_convert(). Called at boot and
+//	before each test. A reading further than CALIBRATION_ZERO_WINDOW_UV
+//	from the stored zero means current is flowing or the amplifier is not
+//	working, the previous zero of that range is kept. On the bench the
+//	readings are forced into the working table instead, to be stored with
+//	calibration_save().
+//
+// Inputs :
+//		uint8_t force: 0x01 -> accept every reading and update the table
+//
+// Outputs :
+//		uint8_t accepted: number of ranges zeroed
+//
+//**************************************************************************
+uint8_t calibration_auto_zero(uint8_t force)
+{
+	adc_config config;
+	uint8_t range_saved = current_range_active;
+	uint8_t accepted = 0;
+
+	ADC_scan_stop();
+	for (uint8_t range = 0; range < CURRENT_RANGE_USABLE; range++)
+	{
+		/* Same configuration as load_current_Read(), averaged over the PRECISE profile */
+		current_range_active = range;
+		ADC_profile_config(&config, 0x00, ADC_PROFILE_PRECISE);
+		current_range_apply();
+		ADC_configure(&config);
+		adc_active_profile = ADC_PROFILE_PRECISE;
+		_delay_us(CURRENT_RANGE_SETTLE_US);
+
+		ADC_channelSEL(OPAMP_ADC_CHANNEL, GND_ADC_CHANNEL);
+		int32_t zero_uv = ADC_read();
+		int32_t deviation = zero_uv - calibration_data.current_zero_uv[range];
+
+		if (force == 0x01)
+			calibration_data.current_zero_uv[range] = zero_uv;
+		else if ((deviation > CALIBRATION_ZERO_WINDOW_UV) || (deviation < -CALIBRATION_ZERO_WINDOW_UV))
+			continue;
+
+		current_zero_uv[range] = zero_uv;
+		accepted++;
+	}
+	current_range_active = range_saved;
+
+	current_zero_accepted = accepted;
+	return accepted;
+}
+
+//***************************************************************************
+//
+// Function Name : "calibration_remote_command"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Handles the calibration commands of the remote interface, the character
+//	after 'q' selects the command:
+//		'r': send the working table
+//		'm': send the voltage at the ADC pins of every cell channel
+//		'v' <channel 1-9> <5 digits>: divider ratio x1000 of B1-B8 or the pack (9)
+//		'o' <channel 1-9> <sign> <5 digits>: offset at the ADC pins in uV
+//		's' <5 digits>: shunt resistance in uOhm
+//		'g' <5 digits>: load current gain trim x1000
+//		'z': auto-zero all current ranges into the table, load must be open
+//		'w': store the table in EEPROM
+//		'd': defaults into the working table
+//	Values outside the limits of the integer conversions are ignored.
+//	Every command but 'r' and 'm' is acknowledged with 'q'. ('c' is the
+//	cancel of the manual test, so the calibration commands use 'q'.)
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void calibration_remote_command(void)
+{
+	char command = USART3_receive_character();
+	uint8_t channel;
+	uint32_t value;
+
+	switch (command){
+		case 'r': //send calibration table
+			send_calibration();
+			return;
+		case 'm': //send raw channel voltages for the bench
+			send_calibration_measurement();
+			return;
+		case 'v': //divider ratio of one channel
+			channel = USART3_receive_character() - '1';
+			value = USART3_receive_number(5);
+			if ((channel < CALIBRATION_CHANNELS) && (value >= CALIBRATION_DIVIDER_MIN_PERMILLE) && (value <= CALIBRATION_DIVIDER_MAX_PERMILLE))
+				calibration_data.divider_permille[channel] = value;
+			break;
+		case 'o': //offset of one channel
+			channel = USART3_receive_character() - '1';
+			command = USART3_receive_character(); //sign
+			value = USART3_receive_number(5);
+			if ((channel < CALIBRATION_CHANNELS) && (value <= CALIBRATION_OFFSET_MAX_UV))
+				calibration_data.offset_uv[channel] = (command == '-') ? -(int16_t)value : (int16_t)value;
+			break;
+		case 's': //shunt resistance
+			value = USART3_receive_number(5);
+			if ((value >= CALIBRATION_SHUNT_MIN_UOHM) && (value <= CALIBRATION_SHUNT_MAX_UOHM))
+				calibration_data.shunt_uohm = value;
+			break;
+		case 'g': //load current gain trim
+			value = USART3_receive_number(5);
+			if ((value >= CALIBRATION_GAIN_MIN_PERMILLE) && (value <= CALIBRATION_GAIN_MAX_PERMILLE))
+				calibration_data.current_gain_permille = value;
+			break;
+		case 'z': //bench auto-zero
+			calibration_auto_zero(0x01);
+			break;
+		case 'w': //store in EEPROM
+			calibration_save();
+			break;
+		case 'd': //defaults
+			calibration_defaults();
+			for (uint8_t range = 0; range < CURRENT_RANGE_COUNT; range++)
+				current_zero_uv[range] = calibration_data.current_zero_uv[range];
+			break;
+		default:
+			return;
+	}
+	USART3_transmit_character('q'); //calibration command done
+}
+
+//***************************************************************************
+//
+// Function Name : "send_calibration"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the working calibration table to the PC, separated by commas: the
+//	divider ratio x1000 and the offset in uV of B1-B8 and the pack, the
+//	shunt in uOhm, the gain trim x1000, the stored and the auto-zeroed
+//	no-load amplifier output of every current range in uV, the number of
+//	ranges the last auto-zero accepted and 1 if the table came from EEPROM.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_calibration(void)
+{
+	char cal_buff[224];
+	char *field = cal_buff;
+
+	for (uint8_t channel = 0; channel < CALIBRATION_CHANNELS; channel++)
+		field += sprintf(field, "%u,", calibration_data.divider_permille[channel]);
+	for (uint8_t channel = 0; channel < CALIBRATION_CHANNELS; channel++)
+		field += sprintf(field, "%d,", calibration_data.offset_uv[channel]);
+	field += sprintf(field, "%u,%u,", calibration_data.shunt_uohm, calibration_data.current_gain_permille);
+	for (uint8_t range = 0; range < CURRENT_RANGE_COUNT; range++)
+		field += sprintf(field, "%ld,", calibration_data.current_zero_uv[range]);
+	for (uint8_t range = 0; range < CURRENT_RANGE_COUNT; range++)
+		field += sprintf(field, "%ld,", current_zero_uv[range]);
+	sprintf(field, "%u,%u", current_zero_accepted, calibration_valid);
+
+	USART3_transmit_character('q'); //calibration table is being sent
+	USART3_transmit_string(cal_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_calibration_measurement"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Takes a fresh sweep of the default scan and sends the voltage at the ADC
+//	pins of each cell of the pack and the pack in uV, separated by commas.
+//	The pack is calibrated as channel 9 whatever the cell count. With known
+//	voltages on the inputs the bench computes the divider ratio and offset
+//	of every channel from these.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_calibration_measurement(void)
+{
+	char cal_buff[112];
+	char *field = cal_buff;
+
+	ADC_scan_acquire();
+	for (uint8_t slot = 0; slot <= cell_count; slot++)
+		field += sprintf(field, (slot == 0) ? "%ld" : ",%ld", ADC_scan_voltage(slot));	// default sequence: the cells, then the pack
+
+	USART3_transmit_character('q'); //channel voltages are being sent
+	USART3_transmit_string(cal_buff);
+}
@@ -0,0 +1,128 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "cell_balance_reset"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Empties the running sums before the cells of one read are added.
+//
+// Inputs :
+//		cell_balance_accumulator *balance: sums to empty
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_balance_reset(cell_balance_accumulator *balance)
+{
+	balance->cells = 0;
+	balance->sum_mv = 0;
+	balance->min_mv = 0xFFFF;
+	balance->max_mv = 0;
+	balance->low_cell = 0;
+	balance->sag_permille = 0;
+	balance->sag_cell = 0;
+}
+
+//***************************************************************************
+//
+// Function Name : "cell_balance_add"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adds one cell voltage as it is read, keeping the sum, the lowest and the
+//	highest cell. With a reference voltage the sag of the cell, the drop
+//	from the reference in per mille of it, is compared against the largest
+//	so far. The metrics are ready after the last cell without a second pass
+//	over the voltages.
+//
+// Inputs :
+//		cell_balance_accumulator *balance: running sums
+//		uint8_t cell: 0-7 -> B1-B8
+//		uint16_t voltage_mv: cell voltage in mV
+//		uint16_t reference_mv: unloaded voltage of the cell in mV, 0 -> no sag
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_balance_add(cell_balance_accumulator *balance, uint8_t cell, uint16_t voltage_mv, uint16_t reference_mv)
+{
+	balance->cells++;
+	balance->sum_mv += voltage_mv;
+	if (voltage_mv < balance->min_mv)
+	{
+		balance->min_mv = voltage_mv;
+		balance->low_cell = cell;
+	}
+	if (voltage_mv > balance->max_mv)
+		balance->max_mv = voltage_mv;
+
+	if ((reference_mv != 0) && (voltage_mv < reference_mv))
+	{
+		uint16_t sag_permille = ((uint32_t)(reference_mv - voltage_mv) * 1000) / reference_mv;
+		if (sag_permille > balance->sag_permille)
+		{
+			balance->sag_permille = sag_permille;
+			balance->sag_cell = cell;
+		}
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "cell_balance_store"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Writes the balance of the cells added so far into a record: the spread
+//	from the lowest to the highest cell, the largest distance of a cell
+//	from the pack mean (the lowest or the highest cell) and the lowest cell.
+//
+// Inputs :
+//		const cell_balance_accumulator *balance: running sums
+//		cell_balance *result: balance field of the record
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_balance_store(const cell_balance_accumulator *balance, cell_balance *result)
+{
+	if (balance->cells == 0)
+	{
+		result->spread_mv = 0;
+		result->deviation_mv = 0;
+		result->low_cell = 0;
+		return;
+	}
+
+	uint16_t mean_mv = balance->sum_mv / balance->cells;
+
+	result->spread_mv = balance->max_mv - balance->min_mv;
+	if ((balance->max_mv - mean_mv) > (mean_mv - balance->min_mv))
+		result->deviation_mv = balance->max_mv - mean_mv;
+	else
+		result->deviation_mv = mean_mv - balance->min_mv;
+	result->low_cell = balance->low_cell;
+}
+
+//***************************************************************************
+//
+// Function Name : "display_cell_balance"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Displays the balance of the pack: the spread and the largest deviation
+//	from the pack mean of the unloaded (left) and loaded (right) voltages,
+//	the lowest loaded cell and the cell with the largest sag under load.
+//
+// Inputs  : test_result result_data : test result data struct
+//
+// Outputs : none
+//
+//**************************************************************************
+void display_cell_balance(test_result result)
+{
+	clear_lcd();
+	sprintf(dsp_buff[0], "Low B%u  Unld. Loaded", result.loaded_balance.low_cell + 1);
+	sprintf(dsp_buff[1], "Spread %4umV %4umV", result.unloaded_balance.spread_mv, result.loaded_balance.spread_mv);
+	sprintf(dsp_buff[2], "Dev.   %4umV %4umV", result.unloaded_balance.deviation_mv, result.loaded_balance.deviation_mv);
+	sprintf(dsp_buff[3], "Worst Sag B%u %3u.%u%% ", result.sag_cell + 1, result.sag_permille / 10, result.sag_permille % 10);
+	update_lcd();
+}
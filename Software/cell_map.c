@@ -0,0 +1,170 @@
+#include "main.h"
+
+/* Channel map, tap i is the positive terminal of cell i, cell i is measured from tap i-1 to tap i */
+const uint8_t cell_tap_channels[CELL_COUNT_MAX + 1] = {
+	GND_ADC_CHANNEL,	// tap 0: pack negative
+	B1_ADC_CHANNEL, B2_ADC_CHANNEL, B3_ADC_CHANNEL, B4_ADC_CHANNEL,
+#if BOARD_CELL_TAPS_8S
+	B5_ADC_CHANNEL, B6_ADC_CHANNEL, B7_ADC_CHANNEL, B8_ADC_CHANNEL
+#endif
+};
+
+uint8_t EEMEM cell_count_eeprom;	// cells in series, in the EEPROM settings area
+
+//***************************************************************************
+//
+// Function Name : "cell_map_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Configures the scan for the cell count stored in EEPROM, a quad pack if
+//	none was stored. Called after ADC_init().
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_map_load(void)
+{
+	cell_map_configure(cell_count_checked(eeprom_read_byte(&cell_count_eeprom)));
+}
+
+//***************************************************************************
+//
+// Function Name : "cell_map_configure"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Builds the scan channel list and the default, snapshot and monitor
+//	sequences for a pack of count cells from the channel map. Every cell
+//	channel is in the list, the pack channel ends on the tap of the last
+//	cell and the sequences only hold the cells of the pack. The temperature
+//	sensor is only in the default sequence, the loaded sequences stay short. The scan is
+//	stopped while its sequences are rebuilt, main() restarts it, the
+//	measurement cache and the noise statistics are emptied and the history
+//	is sized for the new record length. A new cell count also clears the
+//	learned position map, cell_map_save() stores it with the count.
+//
+// Inputs :
+//		uint8_t count: cells in series, CELL_COUNT_MIN..CELL_COUNT_MAX
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_map_configure(uint8_t count)
+{
+	ADC_scan_stop();
+	if (count != cell_count)
+		position_map_clear();
+	cell_count = count;
+	cell_page = 0;
+
+	for (uint8_t cell = 0; cell < CELL_COUNT_MAX; cell++)
+	{
+		adc_scan_channels[SCAN_B1 + cell].muxpos = cell_tap_channels[cell + 1];
+		adc_scan_channels[SCAN_B1 + cell].muxneg = cell_tap_channels[cell];
+		adc_scan_channels[SCAN_B1 + cell].mode = 0x01;
+	}
+	adc_scan_channels[SCAN_PACK].muxpos = cell_tap_channels[count];
+	adc_scan_channels[SCAN_PACK].muxneg = GND_ADC_CHANNEL;
+	adc_scan_channels[SCAN_PACK].mode = 0x01;
+	adc_scan_channels[SCAN_LOAD_CURRENT].muxpos = OPAMP_ADC_CHANNEL;
+	adc_scan_channels[SCAN_LOAD_CURRENT].muxneg = GND_ADC_CHANNEL;
+	adc_scan_channels[SCAN_LOAD_CURRENT].mode = 0x00;
+	adc_scan_channels[SCAN_TEMPERATURE].muxpos = ADC_MUXPOS_TEMPSENSE_gc;
+	adc_scan_channels[SCAN_TEMPERATURE].muxneg = GND_ADC_CHANNEL;
+	adc_scan_channels[SCAN_TEMPERATURE].mode = 0x00;
+
+	/* Default: cells, pack, current, temperature. Snapshot and monitor: current before every cell, the snapshot also after the last */
+	for (uint8_t cell = 0; cell < count; cell++)
+	{
+		adc_scan_default_sequence[cell] = SCAN_B1 + cell;
+		adc_snapshot_sequence[2*cell] = SCAN_LOAD_CURRENT;
+		adc_snapshot_sequence[(2*cell) + 1] = SCAN_B1 + cell;
+		adc_monitor_sequence[2*cell] = SCAN_LOAD_CURRENT;
+		adc_monitor_sequence[(2*cell) + 1] = SCAN_B1 + cell;
+	}
+	adc_scan_default_sequence[count] = SCAN_PACK;
+	adc_scan_default_sequence[count + 1] = SCAN_LOAD_CURRENT;
+	adc_scan_default_sequence[count + 2] = SCAN_TEMPERATURE;
+	adc_scan_default_length = count + 3;
+	adc_snapshot_sequence[2*count] = SCAN_LOAD_CURRENT;
+	adc_snapshot_length = (2*count) + 1;
+	adc_monitor_length = 2*count;
+
+	adc_cache_valid = 0;	// the pack channel may have moved
+	ADC_stats_reset();
+	test_history_configure();
+}
+
+//***************************************************************************
+//
+// Function Name : "cell_map_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Stores the cell count in EEPROM for the next power up, with the position
+//	map cleared for it.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_map_save(void)
+{
+	eeprom_update_byte(&cell_count_eeprom, cell_count);
+	position_map_save();
+}
+
+//***************************************************************************
+//
+// Function Name : "cell_count_checked"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns a cell count that is safe to index the per cell tables with.
+//	Erased EEPROM reads as a quad pack.
+//
+// Inputs :
+//		uint8_t count: stored cell count
+//
+// Outputs :
+//		uint8_t count: count, CELL_COUNT_DEFAULT if out of range
+//
+//**************************************************************************
+uint8_t cell_count_checked(uint8_t count)
+{
+	if ((count < CELL_COUNT_MIN) || (count > CELL_COUNT_MAX))
+		return CELL_COUNT_DEFAULT;
+	return count;
+}
+
+//***************************************************************************
+//
+// Function Name : "cell_map_remote_command"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Handles the cell count command of the remote interface: the digit after
+//	'z' selects CELL_COUNT_MIN..CELL_COUNT_MAX cells (2-4, 2-8 with
+//	BOARD_CELL_TAPS_8S) and stores the count in EEPROM, any other digit
+//	only queries it. Answers 'z' and the cell count in use, which is also
+//	the number of cell fields in the results sent to the PC.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void cell_map_remote_command(void)
+{
+	char count_buff[4];
+	uint8_t count = USART3_receive_character() - '0';
+
+	if ((count >= CELL_COUNT_MIN) && (count <= CELL_COUNT_MAX))
+	{
+		cell_map_configure(count);
+		cell_map_save();
+	}
+
+	sprintf(count_buff, "%u", cell_count);
+	USART3_transmit_character('z'); //cell count is being sent
+	USART3_transmit_string(count_buff);
+}
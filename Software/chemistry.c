@@ -0,0 +1,127 @@
+#include "main.h"
+
+/* Twelve grading thresholds A+ to D-, falling by a fixed step from the A+ threshold */
+#define THRESHOLDS(top, step) {(top), (top) - (step), (top) - (2*(step)), (top) - (3*(step)), (top) - (4*(step)), (top) - (5*(step)), \
+	(top) - (6*(step)), (top) - (7*(step)), (top) - (8*(step)), (top) - (9*(step)), (top) - (10*(step)), (top) - (11*(step))}
+
+/* Chemistry profiles, indexed by CHEMISTRIES. Voltages are per cell input. The
+	AVR128DB48 does not map flash into the data space for .rodata, so the table
+	is placed in flash with PROGMEM and only read through chemistry_profile_read(). */
+const chemistry_profile PROGMEM chemistry_profiles[CHEMISTRY_COUNT] = {
+	/* name		unloaded	loaded	grading A+ .. D-			current	tolerance */
+	{"Li-Ion",	3000,		2500,	THRESHOLDS(2900, 100),		30,		LOAD_CURRENT_TOLERANCE_MA},
+	{"LFP",		2800,		2000,	THRESHOLDS(2800, 75),		30,		LOAD_CURRENT_TOLERANCE_MA},
+	{"Lead",	1900,		1600,	THRESHOLDS(1900, 25),		50,		2000}
+};
+
+#undef THRESHOLDS
+
+uint8_t EEMEM chemistry_eeprom;	// selected chemistry, in the EEPROM settings area
+
+//***************************************************************************
+//
+// Function Name : "chemistry_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Selects the chemistry stored in EEPROM, Li-ion if none was stored, and
+//	takes its default load current. Called after health_grading_load().
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void chemistry_load(void)
+{
+	uint8_t chemistry = eeprom_read_byte(&chemistry_eeprom);
+
+	if (chemistry >= CHEMISTRY_COUNT)
+		chemistry = CHEMISTRY_LI_ION;
+
+	chemistry_select(chemistry);
+	chemistry_apply_defaults();
+}
+
+//***************************************************************************
+//
+// Function Name : "chemistry_select"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Makes a chemistry profile the active one. The profile is copied out of
+//	flash into chemistry_active_profile, everything chemistry specific is
+//	read through chemistry_active which points at the copy, the
+//	grading thresholds are swapped the same way.
+//
+// Inputs :
+//		uint8_t chemistry: CHEMISTRIES value
+//
+// Outputs : None
+//
+//**************************************************************************
+void chemistry_select(uint8_t chemistry)
+{
+	chemistry_selected = chemistry;
+	chemistry_profile_read(chemistry, &chemistry_active_profile);
+	chemistry_active = &chemistry_active_profile;
+	health_grading_select();
+}
+
+//***************************************************************************
+//
+// Function Name : "chemistry_profile_read"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Copies a chemistry profile out of the flash table. An unknown chemistry
+//	reads the Li-ion profile.
+//
+// Inputs :
+//		uint8_t chemistry: CHEMISTRIES value
+//		chemistry_profile *profile: copy of the profile
+//
+// Outputs : None
+//
+//**************************************************************************
+void chemistry_profile_read(uint8_t chemistry, chemistry_profile *profile)
+{
+	if (chemistry >= CHEMISTRY_COUNT)
+		chemistry = CHEMISTRY_LI_ION;
+	memcpy_P(profile, &chemistry_profiles[chemistry], sizeof(chemistry_profile));
+}
+
+//***************************************************************************
+//
+// Function Name : "chemistry_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Stores the selected chemistry in EEPROM for the next power up.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void chemistry_save(void)
+{
+	eeprom_update_byte(&chemistry_eeprom, chemistry_selected);
+}
+
+//***************************************************************************
+//
+// Function Name : "chemistry_apply_defaults"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sets the load current setting and its bcd digits to the default of the
+//	active chemistry.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void chemistry_apply_defaults(void)
+{
+	current_setting = chemistry_active->default_current_a;
+	current_setting_100_dig = current_setting / 100;
+	current_setting_10_dig = (current_setting / 10) % 10;
+	current_setting_1_dig = current_setting % 10;
+}
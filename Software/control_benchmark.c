@@ -0,0 +1,121 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "benchmark_float_iteration"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// The measurement and decision part of one set_load_current() iteration as
+//	it was before the fixed-point pipeline: float pin voltage, float current
+//	with the fixed gain of 20 and the float error against the target. Kept
+//	only as the reference of the benchmark.
+//
+// Inputs :
+//		uint16_t result: raw accumulated load current result
+//		float target_current_amps: target of the control loop
+//
+// Outputs :
+//		uint8_t step: 0x01 -> the loop would step the motor
+//
+//**************************************************************************
+uint8_t benchmark_float_iteration(uint16_t result, float target_current_amps)
+{
+	float adc_voltage = (float)(2.048 * (result >> adc_profiles[ADC_PROFILE_FAST].shift) / 4096);
+	float current = ((adc_voltage - 0.096) / (20 * 0.000145));
+
+	if (current < 0.2)
+		current = 0;
+
+	volatile float error = current - target_current_amps;
+	return (fabs(error) > 1);
+}
+
+//***************************************************************************
+//
+// Function Name : "benchmark_fixed_iteration"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// The measurement and decision part of one set_load_current() iteration
+//	with the fixed-point pipeline, the same calls ADC_monitor_current() and
+//	the loop make.
+//
+// Inputs :
+//		uint16_t result: raw accumulated load current result
+//		int32_t target_current_ma: target of the control loop in mA
+//
+// Outputs :
+//		uint8_t step: 0x01 -> the loop would step the motor
+//
+//**************************************************************************
+uint8_t benchmark_fixed_iteration(uint16_t result, int32_t target_current_ma)
+{
+	int32_t current = load_current_convert(current_range_voltage(result, ADC_PROFILE_FAST), CURRENT_RANGE_HIGH);
+
+	volatile int32_t error = current - target_current_ma;
+	return ((error > LOAD_CURRENT_TOLERANCE_MA) || (error < -LOAD_CURRENT_TOLERANCE_MA));
+}
+
+//***************************************************************************
+//
+// Function Name : "benchmark_control_loop"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Counts the CPU cycles of one control loop iteration before (float) and
+//	after (fixed-point) the conversion of the measurement pipeline. TCB1 is
+//	clocked from CLK_PER and read around each iteration, the cost of
+//	reading it is measured with an empty iteration and subtracted. The raw
+//	results sweep the whole 12-bit span with the FAST accumulation, the
+//	stepper and ADC waits of the real loop are the same for both versions
+//	and are not included. Results are the mean cycles per iteration in
+//	bench_float_cycles and bench_fixed_cycles. They depend on the compiler
+//	and its options, no reference figures are kept in the source: the
+//	remote 'b' command measures them on the built firmware.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void benchmark_control_loop(void)
+{
+	uint32_t float_sum = 0;
+	uint32_t fixed_sum = 0;
+	uint32_t overhead_sum = 0;
+	volatile uint8_t sink;
+	uint8_t sreg = SREG;
+
+	ADC_scan_stop();	// TCB1 belongs to the timed acquisition while the scan runs
+	cli();
+
+	/* TCB1: free running cycle counter */
+	TCB1.CTRLA = 0x00;
+	TCB1.CTRLB = TCB_CNTMODE_INT_gc;
+	TCB1.CCMP = 0xFFFF;
+	TCB1.CNT = 0;
+	TCB1.CTRLA = (TCB_CLKSEL_DIV1_gc | TCB_ENABLE_bm);
+
+	for (uint8_t i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		uint16_t result = (((uint16_t)i * (4096 / BENCH_ITERATIONS)) << adc_profiles[ADC_PROFILE_FAST].shift);
+		uint16_t start;
+
+		start = TCB1.CNT;
+		sink = i;
+		overhead_sum += (uint16_t)(TCB1.CNT - start);
+
+		start = TCB1.CNT;
+		sink = benchmark_float_iteration(result, 300);
+		float_sum += (uint16_t)(TCB1.CNT - start);
+
+		start = TCB1.CNT;
+		sink = benchmark_fixed_iteration(result, 300000);
+		fixed_sum += (uint16_t)(TCB1.CNT - start);
+	}
+
+	TCB1.CTRLA = 0x00;
+	SREG = sreg;
+	(void)sink;
+
+	bench_float_cycles = (float_sum - overhead_sum) / BENCH_ITERATIONS;
+	bench_fixed_cycles = (fixed_sum - overhead_sum) / BENCH_ITERATIONS;
+}
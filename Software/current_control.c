@@ -0,0 +1,452 @@
+#include "main.h"
+
+control_gains EEMEM control_gains_eeprom;	// load current controller gains, in the EEPROM settings area
+
+//***************************************************************************
+//
+// Function Name : "control_gains_checksum"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Computes the checksum of a set of controller gains, the inverted byte
+//	sum of everything in front of the checksum field.
+//
+// Inputs :
+//		const control_gains *gains: gains to check
+//
+// Outputs :
+//		uint8_t checksum: expected value of gains->checksum
+//
+//**************************************************************************
+uint8_t control_gains_checksum(const control_gains *gains)
+{
+	const uint8_t *bytes = (const uint8_t *)gains;
+	uint8_t sum = 0;
+
+	for (uint8_t i = 0; i < offsetof(control_gains, checksum); i++)
+		sum += bytes[i];
+
+	return (uint8_t)~sum;
+}
+
+//***************************************************************************
+//
+// Function Name : "control_gains_defaults"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Loads the default gains into the working controller gains.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void control_gains_defaults(void)
+{
+	control_gains_active.kp = CONTROL_DEFAULT_KP;
+	control_gains_active.ki = CONTROL_DEFAULT_KI;
+}
+
+//***************************************************************************
+//
+// Function Name : "control_gains_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Reads the controller gains from EEPROM, the defaults if none were stored
+//	or they are out of range.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void control_gains_load(void)
+{
+	eeprom_read_block(&control_gains_active, &control_gains_eeprom, sizeof(control_gains));
+	if ((control_gains_active.checksum != control_gains_checksum(&control_gains_active))
+		|| (control_gains_active.kp > CONTROL_GAIN_MAX) || (control_gains_active.ki > CONTROL_GAIN_MAX))
+		control_gains_defaults();
+}
+
+//***************************************************************************
+//
+// Function Name : "control_gains_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Writes the working controller gains to EEPROM, only bytes that changed
+//	are written.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void control_gains_save(void)
+{
+	control_gains_active.checksum = control_gains_checksum(&control_gains_active);
+	eeprom_update_block(&control_gains_active, &control_gains_eeprom, sizeof(control_gains));
+}
+
+//***************************************************************************
+//
+// Function Name : "control_step_rate"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// One iteration of the PI controller of set_load_current(). The output is
+//	the step rate of the knob, proportional to the error plus its integral
+//	over time, so the knob moves fast far from the target and slows down
+//	as it gets close. The output is limited to the rate the loop can
+//	actually reach, see control_rate_limit(). The integral is advanced by
+//	the period of the step just taken and only while the output is not
+//	saturated at that limit, or when it pulls the output back
+//	(anti-windup).
+//
+// Inputs :
+//		control_state *state: integral of the running control loop
+//		int32_t error_ma: target - measured load current in mA
+//		uint16_t period_us: period of the previous step
+//		int32_t rate_max: fastest rate of the next step in steps/s
+//
+// Outputs :
+//		int32_t rate: steps/s, > 0 -> more current (CLOCK-WISE)
+//
+//**************************************************************************
+int32_t control_step_rate(control_state *state, int32_t error_ma, uint16_t period_us, int32_t rate_max)
+{
+	int32_t proportional = ((int32_t)control_gains_active.kp * error_ma) / 1000;
+	int32_t increment = (error_ma / 10) * (int32_t)(period_us / 100);	// mA*ms
+
+	/* Integrate unless the output is saturated in the direction of the error */
+	int32_t integral = state->integral_ma_ms + increment;
+	int32_t rate = proportional + (((int64_t)control_gains_active.ki * integral) / 1000000L);
+
+	if (((rate < rate_max) && (rate > -rate_max))
+		|| ((rate >= rate_max) && (increment < 0)) || ((rate <= -rate_max) && (increment > 0)))
+	{
+		if (integral > CONTROL_INTEGRAL_MAX)
+			integral = CONTROL_INTEGRAL_MAX;
+		else if (integral < -CONTROL_INTEGRAL_MAX)
+			integral = -CONTROL_INTEGRAL_MAX;
+		state->integral_ma_ms = integral;
+	}
+	else
+		rate = proportional + (((int64_t)control_gains_active.ki * state->integral_ma_ms) / 1000000L);
+
+	if (rate > rate_max)
+		return rate_max;
+	if (rate < -rate_max)
+		return -rate_max;
+	return rate;
+}
+
+//***************************************************************************
+//
+// Function Name : "control_rate_limit"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Fastest step rate the control loop can reach on its next step. Every
+//	step waits for one reading of the monitor sweep, and the knob may not
+//	accelerate faster than the ramp of the motion profile allows after run
+//	steps in the same direction. CONTROL_RATE_MAX_SPS is the limit of the
+//	step period on top of both.
+//
+// Inputs :
+//		uint32_t sweep_us: duration of one monitor sweep, 0 -> free running, no limit
+//		uint16_t run: steps taken in the same direction since standstill
+//
+// Outputs :
+//		int32_t rate_max: steps/s
+//
+//**************************************************************************
+int32_t control_rate_limit(uint32_t sweep_us, uint16_t run)
+{
+	int32_t rate_max = CONTROL_RATE_MAX_SPS;
+	int32_t ramp_sps = MOTION_TIMER_HZ / motion_ramp_period(run);
+
+	if ((sweep_us != 0) && ((int32_t)(1000000L / sweep_us) < rate_max))
+		rate_max = 1000000L / sweep_us;
+	if (ramp_sps < rate_max)
+		rate_max = ramp_sps;
+	return (rate_max > 0) ? rate_max : 1;
+}
+
+//***************************************************************************
+//
+// Function Name : "control_step_period"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts a controller step rate to the period of the next step, between
+//	STEP_PERIOD_MIN_US and STEP_PERIOD_MAX_US.
+//
+// Inputs :
+//		int32_t rate: steps/s, either direction
+//
+// Outputs :
+//		uint16_t period_us: step period in us
+//
+//**************************************************************************
+uint16_t control_step_period(int32_t rate)
+{
+	if (rate < 0)
+		rate = -rate;
+	if (rate <= (1000000L / STEP_PERIOD_MAX_US))
+		return STEP_PERIOD_MAX_US;
+	if (rate >= (1000000L / STEP_PERIOD_MIN_US))
+		return STEP_PERIOD_MIN_US;
+	return 1000000L / rate;
+}
+
+//***************************************************************************
+//
+// Function Name : "control_plant_current"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Steady state load current of the simulated plant: the pack behind a
+//	fixed resistance in series with the carbon pile, whose resistance
+//	falls with the knob position.
+//
+// Inputs :
+//		int16_t position: knob position in steps from open circuit
+//
+// Outputs :
+//		int32_t current: load current in mA
+//
+//**************************************************************************
+int32_t control_plant_current(int16_t position)
+{
+	if (position <= 0)
+		return 0;
+	return ((int64_t)CONTROL_SIM_PACK_MV * 1000000L) / (CONTROL_SIM_FIXED_UOHM + (CONTROL_SIM_PILE_UOHM_STEPS / position));
+}
+
+//***************************************************************************
+//
+// Function Name : "control_simulate"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Runs the fixed rate loop that set_load_current() used before and the PI
+//	controller against the simulated plant, from open circuit to
+//	CONTROL_SIM_TARGET_MA. The pile heats, so the current follows the knob
+//	with the first order lag CONTROL_SIM_LAG_MS. Each iteration reads the
+//	current, then takes one step, like the real loop: the reading comes
+//	from the monitor sweep, so a step takes at least CONTROL_SIM_SWEEP_US
+//	and the reading is the current of the sweep before. The PI controller
+//	is limited by control_rate_limit() and the ramp of the active motion
+//	profile as in set_load_current(). The band is the current tolerance of
+//	the active chemistry. While the reading is in the band the knob holds, the controller steps again as soon as it
+//	leaves it. The simulation runs until the reading has stayed in the band
+//	for CONTROL_SIM_HOLD_US, so the current the lag still delivers after
+//	the first entry is part of the result. Reports the time from which the
+//	reading stays in the band (CONTROL_SIM_TIMEOUT_US if it never does) and
+//	the largest excursion of the current past the target in
+//	control_sim_results[].
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void control_simulate(void)
+{
+	for (uint8_t controller = 0; controller < CONTROL_SIM_CONTROLLERS; controller++)
+	{
+		control_state state = {0};
+		int16_t position = 0;
+		int32_t current = 0;	// current of the plant
+		int32_t reading = 0;	// current of the last monitor sweep, one sweep behind the plant
+		uint32_t time_us = 0;
+		uint32_t in_band_us = 0;
+		uint16_t period_us = STEP_PERIOD_MAX_US;
+		uint32_t overshoot = 0;
+		int8_t direction = 1;
+		uint16_t run = 0;	// steps in the same direction, the position on the ramp of the profile
+		int32_t tolerance = chemistry_active->current_tolerance_ma;
+
+		while ((in_band_us < CONTROL_SIM_HOLD_US) && (time_us < CONTROL_SIM_TIMEOUT_US))
+		{
+			int32_t error = CONTROL_SIM_TARGET_MA - reading;
+			uint32_t step_us = CONTROL_SIM_SWEEP_US;
+
+			if ((error <= tolerance) && (error >= -tolerance))
+			{
+				in_band_us += CONTROL_SIM_SWEEP_US;	// the knob holds
+			}
+			else
+			{
+				int32_t rate;
+				if (controller == CONTROL_SIM_FIXED_RATE)
+				{
+					rate = (error >= 0) ? 1 : -1;
+					period_us = STEP_PERIOD_US;
+				}
+				else
+				{
+					rate = control_step_rate(&state, error, period_us, control_rate_limit(CONTROL_SIM_SWEEP_US, run));
+					period_us = control_step_period(rate);
+					
+					/* The knob reverses from standstill, and accelerates no faster than the ramp */
+					if (((rate >= 0) ? 1 : -1) != direction)
+						run = 0;
+					direction = (rate >= 0) ? 1 : -1;
+					if (period_us < motion_ramp_period(run))
+						period_us = motion_ramp_period(run);
+					if (run < MOTION_RAMP_STEPS_MAX)
+						run++;
+				}
+				position += (rate >= 0) ? 1 : -1;
+				in_band_us = 0;
+
+				/* One reading per monitor sweep */
+				if (period_us > step_us)
+					step_us = period_us;
+			}
+
+			/* The sweep ending now sampled the current before the step, the current lags the knob by the heating of the pile */
+			reading = current;
+			current += ((int64_t)(control_plant_current(position) - current) * step_us) / ((CONTROL_SIM_LAG_MS * 1000L) + step_us);
+			time_us += step_us;
+			if ((current > CONTROL_SIM_TARGET_MA) && ((uint32_t)(current - CONTROL_SIM_TARGET_MA) > overshoot))
+				overshoot = current - CONTROL_SIM_TARGET_MA;
+		}
+
+		uint32_t settle_ms = (in_band_us >= CONTROL_SIM_HOLD_US) ? ((time_us - in_band_us) / 1000) : (CONTROL_SIM_TIMEOUT_US / 1000);
+		control_sim_results[controller].settle_ms = (settle_ms > 0xFFFF) ? 0xFFFF : settle_ms;
+		control_sim_results[controller].overshoot_ma = (overshoot > 0xFFFF) ? 0xFFFF : overshoot;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "control_remote_command"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Handles the load current controller commands of the remote interface,
+//	the character after 'l' selects the command:
+//		'r': send the gains and the log of the last set_load_current()
+//		'w' <kp 4 digits> <ki 4 digits>: replace the gains and store them
+//		'm' <rate 4 digits> <acceleration 5 digits>: replace the motion
+//			 profile, cruise rate in steps/s and acceleration in steps/s^2,
+//			 and store it
+//		'd': default gains and motion profile, stored in EEPROM
+//		'p': send the knob position and the learned position map
+//		'x': forget the learned position map, for a new carbon pile
+//		's': run the simulated plant and send the settle time and
+//			 overshoot of the fixed rate loop and of the PI controller
+//	'w', 'm', 'd' and 'x' are acknowledged with 'l', values out of range are
+//	rejected with 'e'.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void control_remote_command(void)
+{
+	uint16_t kp;
+	uint16_t ki;
+	uint16_t rate;
+	uint16_t accel;
+
+	switch (USART3_receive_character()){
+		case 'r': //send gains and log
+			send_control_results();
+			return;
+		case 'w': //replace gains
+			kp = USART3_receive_number(4);
+			ki = USART3_receive_number(4);
+			if ((kp > CONTROL_GAIN_MAX) || (ki > CONTROL_GAIN_MAX))
+			{
+				USART3_transmit_character('e'); //gains rejected
+				return;
+			}
+			control_gains_active.kp = kp;
+			control_gains_active.ki = ki;
+			control_gains_save();
+			break;
+		case 'm': //replace motion profile
+			rate = USART3_receive_number(4);
+			accel = USART3_receive_number(5);
+			if ((rate < MOTION_PROFILE_RATE_MIN_SPS) || (rate > MOTION_RATE_MAX_SPS)
+				|| (accel < MOTION_PROFILE_ACCEL_MIN_SPS2) || (accel > MOTION_PROFILE_ACCEL_MAX_SPS2))
+			{
+				USART3_transmit_character('e'); //profile rejected
+				return;
+			}
+			motion_profile_active.max_rate_sps = rate;
+			motion_profile_active.accel_sps2 = accel;
+			motion_profile_build();
+			motion_profile_save();
+			break;
+		case 'd': //default gains and motion profile
+			control_gains_defaults();
+			control_gains_save();
+			motion_profile_defaults();
+			motion_profile_save();
+			break;
+		case 'p': //send position map
+			send_position_map();
+			return;
+		case 'x': //forget position map
+			position_map_clear();
+			position_map_save();
+			break;
+		case 's': //simulated plant
+			control_simulate();
+			send_control_simulation();
+			return;
+		default:
+			return;
+	}
+	USART3_transmit_character('l'); //controller gains replaced
+}
+
+//***************************************************************************
+//
+// Function Name : "send_control_results"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the controller gains and the log of the last set_load_current()
+// to the PC: kp, ki, settle time in ms, overshoot in mA, number of steps,
+// the release time of the last open_circuit_load() in ms, then the motion
+// profile: cruise rate in steps/s, acceleration in
+// steps/s^2 and steps of its ramp, separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_control_results(void)
+{
+	char control_buff[56];
+
+	sprintf(control_buff, "%u,%u,%u,%u,%u,%u,%u,%u,%u", control_gains_active.kp, control_gains_active.ki, control_settle_ms, control_overshoot_ma, control_steps,
+		control_release_ms, motion_profile_active.max_rate_sps, motion_profile_active.accel_sps2, motion_ramp_length);
+	USART3_transmit_character('l'); //controller log is being sent
+	USART3_transmit_string(control_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_control_simulation"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the result of control_simulate() to the PC: settle time in ms and
+// overshoot in mA of the fixed rate loop, then of the PI controller,
+// separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_control_simulation(void)
+{
+	char control_buff[32];
+
+	sprintf(control_buff, "%u,%u,%u,%u", control_sim_results[CONTROL_SIM_FIXED_RATE].settle_ms, control_sim_results[CONTROL_SIM_FIXED_RATE].overshoot_ma,
+		control_sim_results[CONTROL_SIM_PI].settle_ms, control_sim_results[CONTROL_SIM_PI].overshoot_ma);
+	USART3_transmit_character('l'); //simulation results are being sent
+	USART3_transmit_string(control_buff);
+}
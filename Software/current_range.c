@@ -0,0 +1,191 @@
+#include "main.h"
+
+/* Load current ranges, indexed by CURRENT_RANGES, least sensitive first. The
+   external instrumentation amplifier has the whole gain of 20 the board was
+   built with. With BOARD_CURRENT_LADDER its output goes into OP2 INP and OPAMP 2
+   adds a follower or a non-inverting stage on the internal resistor ladder
+   (WIP3 x2, WIP5 x4, WIP6 x8), the amplifier offset is multiplied with it. Every
+   range is read on the same reference, so the scan never waits for VREF. */
+const current_range current_ranges[CURRENT_RANGE_COUNT] = {
+	{"670A",	0,									1,	20},	// 172 mA per LSB on 2.048 V
+	{"320A",	(3 << OPAMP_OP2RESMUX_MUXWIP_gp),	2,	40},	// 86 mA per LSB
+	{"143A",	(5 << OPAMP_OP2RESMUX_MUXWIP_gp),	4,	80},	// 43 mA per LSB
+	{"55A",		(6 << OPAMP_OP2RESMUX_MUXWIP_gp),	8,	160}	// 22 mA per LSB
+};
+
+//***************************************************************************
+//
+// Function Name : "current_range_init"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// With BOARD_CURRENT_LADDER, configures OPAMP 2 on its resistor ladder
+//	(input on OP2 INP, ladder from the output to GND) as a follower for the
+//	least sensitive range. Without it the amplifier drives PE2 itself and
+//	OPAMP 2 is left off, so only CURRENT_RANGE_HIGH is used. Computes the
+//	count below which each usable range hands over to the next more
+//	sensitive one: the reading there must sit at CURRENT_RANGE_DOWN_PERCENT
+//	of the new full scale, well below the up threshold, so the ranging
+//	cannot hunt.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void current_range_init(void)
+{
+	current_range_active = CURRENT_RANGE_HIGH;
+	current_range_switches = 0;
+
+#if BOARD_CURRENT_LADDER
+	OPAMP.OP2INMUX = (OPAMP_OP2INMUX_MUXPOS_INP_gc | OPAMP_OP2INMUX_MUXNEG_OUT_gc);
+	OPAMP.OP2RESMUX = (OPAMP_OP2RESMUX_MUXBOT_GND_gc | OPAMP_OP2RESMUX_MUXTOP_OUT_gc);
+	OPAMP.OP2CTRLA = (OPAMP_OP2CTRLA_OUTMODE_NORMAL_gc | OPAMP_OP2CTRLA_ALWAYSON_bm);
+	OPAMP.CTRLA = OPAMP_ENABLE_bm;
+	_delay_us(CURRENT_RANGE_SETTLE_US);
+#endif
+
+	uint32_t vref_mv = ADC_ref_mv(VREF_REFSEL_2V048_gc);	// the reference of the control loop
+	for (uint8_t range = 0; range < CURRENT_RANGE_USABLE - 1; range++)
+	{
+		uint32_t target_next = (4096UL * CURRENT_RANGE_DOWN_PERCENT) / 100;	// counts in the next range
+		uint32_t offset = (current_range_offset_uv(range) * 4096) / (vref_mv * 1000);
+		uint32_t offset_next = (current_range_offset_uv(range + 1) * 4096) / (vref_mv * 1000);
+
+		/* Above the offset, counts scale by the gain between two ranges on the same reference */
+		current_range_down_counts[range] = offset + (((target_next - offset_next) * current_ranges[range].gain)
+											/ current_ranges[range + 1].gain);
+	}
+	for (uint8_t range = CURRENT_RANGE_USABLE - 1; range < CURRENT_RANGE_COUNT; range++)
+		current_range_down_counts[range] = 0;	// nothing more sensitive
+}
+
+//***************************************************************************
+//
+// Function Name : "current_range_offset_uv"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the nominal amplifier output of a range with no load current,
+//	the offset of the external amplifier times the gain of OPAMP 2.
+//
+// Inputs :
+//		uint8_t range: CURRENT_RANGES value
+//
+// Outputs :
+//		int32_t offset: output voltage in uV
+//
+//**************************************************************************
+int32_t current_range_offset_uv(uint8_t range)
+{
+	return CURRENT_OUTPUT_OFFSET_UV * current_ranges[range].ladder;
+}
+
+//***************************************************************************
+//
+// Function Name : "current_range_apply"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Prepares a load current conversion in the active range: switches OPAMP 2
+//	between the follower and the ladder and moves the wiper. The reference
+//	is the one of the acquisition profile, nothing in the ADC configuration
+//	changes. Called before the channel is selected.
+//
+// Inputs : None
+//
+// Outputs :
+//		uint8_t range: CURRENT_RANGES value the conversion is taken in
+//
+//**************************************************************************
+uint8_t current_range_apply(void)
+{
+	uint8_t range = current_range_active;
+
+#if BOARD_CURRENT_LADDER
+	uint8_t inmux = OPAMP_OP2INMUX_MUXPOS_INP_gc | ((current_ranges[range].ladder == 1) ? OPAMP_OP2INMUX_MUXNEG_OUT_gc : OPAMP_OP2INMUX_MUXNEG_WIP_gc);
+	if (OPAMP.OP2INMUX != inmux)
+		OPAMP.OP2INMUX = inmux;
+	if ((OPAMP.OP2RESMUX & OPAMP_OP2RESMUX_MUXWIP_gm) != current_ranges[range].wiper)
+		OPAMP.OP2RESMUX = (OPAMP.OP2RESMUX & ~OPAMP_OP2RESMUX_MUXWIP_gm) | current_ranges[range].wiper;
+#endif
+
+	return range;
+}
+
+//***************************************************************************
+//
+// Function Name : "current_range_update"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Picks the range for the next load current conversion from a result of
+//	the active range. Above CURRENT_RANGE_UP_COUNTS the amplifier is close to
+//	saturation and the next less sensitive range is used, below the down
+//	count of the range the next more sensitive one. Called by the scan
+//	sequencer for every stored load current result.
+//
+// Inputs :
+//		uint16_t counts: averaged single-ended result, 0 to 4095
+//
+// Outputs :
+//		uint8_t changed: 0x01 -> the range changed, 0x00 -> unchanged
+//
+//**************************************************************************
+uint8_t current_range_update(uint16_t counts)
+{
+	uint8_t range = current_range_active;
+
+	if ((counts >= CURRENT_RANGE_UP_COUNTS) && (range > 0))
+		range--;
+	else if (counts < current_range_down_counts[range])
+		range++;
+	else
+		return 0x00;
+
+	current_range_active = range;
+	current_range_switches++;
+	return 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "current_range_voltage"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts a raw accumulated load current result to the amplifier output
+//	voltage, using the reference of the profile it was taken with.
+//
+// Inputs :
+//		uint16_t result: raw ADC0.RES value
+//		uint8_t profile: acquisition profile the result was taken with
+//
+// Outputs :
+//		int32_t result: OPAMP 2 output voltage in uV
+//
+//**************************************************************************
+int32_t current_range_voltage(uint16_t result, uint8_t profile)
+{
+	return ADC_counts_to_uv(result, 0x00, ADC_profile_vref_mv(profile), adc_profiles[profile].shift);
+}
+
+//***************************************************************************
+//
+// Function Name : "current_range_resolution"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the load current represented by one LSB of a range with the
+//	calibrated shunt and gain trim, on the reference of the control loop.
+//
+// Inputs :
+//		uint8_t range: CURRENT_RANGES value
+//
+// Outputs :
+//		uint32_t resolution: uA per LSB
+//
+//**************************************************************************
+uint32_t current_range_resolution(uint8_t range)
+{
+	uint32_t lsb_nv = ((uint32_t)ADC_profile_vref_mv(ADC_PROFILE_FAST) * 1000000) / 4096;
+
+	uint32_t resolution_ua = (lsb_nv * 1000) / ((uint32_t)current_ranges[range].gain * calibration_data.shunt_uohm);	// nV / uOhm = mA, x1000 -> uA
+	
+	return (resolution_ua * calibration_data.current_gain_permille) / 1000;
+}
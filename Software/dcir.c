@@ -0,0 +1,90 @@
+#include "main.h"
+
+/* Load current of each DCIR plateau in percent of the programmed test current, rising */
+const uint8_t dcir_step_percent[DCIR_STEPS] = {25, 50, 75, 100};
+
+//***************************************************************************
+//
+// Function Name : "dcir_fit_reset"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Empties the least-squares accumulators of all cells before a DCIR test.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void dcir_fit_reset(void)
+{
+	for (uint8_t cell = 0; cell < CELL_COUNT_MAX; cell++)
+	{
+		dcir_fits[cell].points = 0;
+		dcir_fits[cell].sum_i = 0;
+		dcir_fits[cell].sum_v = 0;
+		dcir_fits[cell].sum_ii = 0;
+		dcir_fits[cell].sum_iv = 0;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "dcir_fit_add"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adds one (current, voltage) point of a cell to its running sums, so the
+//	fit is ready as soon as the last plateau has been sampled. Sums are kept
+//	in mA and mV, the squares need 64 bits above ~100 A.
+//
+// Inputs :
+//		uint8_t cell: 0-7 -> B1-B8
+//		int32_t current_ma: load current when the cell was sampled in mA
+//		uint16_t voltage_mv: cell voltage in mV
+//
+// Outputs : None
+//
+//**************************************************************************
+void dcir_fit_add(uint8_t cell, int32_t current_ma, uint16_t voltage_mv)
+{
+	dcir_fit *fit = &dcir_fits[cell];
+
+	fit->points++;
+	fit->sum_i += current_ma;
+	fit->sum_v += voltage_mv;
+	fit->sum_ii += (int64_t)current_ma * current_ma;
+	fit->sum_iv += (int64_t)current_ma * voltage_mv;
+}
+
+//***************************************************************************
+//
+// Function Name : "dcir_fit_resistance"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the internal resistance of a cell from the points added so far:
+//	the negated slope of the least-squares line V = OCV - R x I,
+//		R = -(n.Sum(IV) - Sum(I).Sum(V)) / (n.Sum(I^2) - Sum(I)^2)
+//	mV / mA is ohms, scaled by 10^6 to uOhm before the division.
+//
+// Inputs :
+//		uint8_t cell: 0-7 -> B1-B8
+//
+// Outputs :
+//		uint16_t resistance: DCIR in uOhm, 0 -> fewer than two distinct
+//							 currents or a rising voltage, 0xFFFF -> above 65 mOhm
+//
+//**************************************************************************
+uint16_t dcir_fit_resistance(uint8_t cell)
+{
+	dcir_fit *fit = &dcir_fits[cell];
+	int64_t denominator = ((int64_t)fit->points * fit->sum_ii) - ((int64_t)fit->sum_i * fit->sum_i);
+	int64_t numerator = ((int64_t)fit->sum_i * fit->sum_v) - ((int64_t)fit->points * fit->sum_iv);
+
+	if ((fit->points < 2) || (denominator <= 0) || (numerator <= 0))
+		return 0;
+
+	int64_t resistance_uohm = (numerator * 1000000) / denominator;
+
+	if (resistance_uohm > 0xFFFF)
+		return 0xFFFF;
+	return (uint16_t)resistance_uohm;
+}
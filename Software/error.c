@@ -7,7 +7,9 @@
 // DESCRIPTION
 // Determines if a loaded test can be performed on the quad-pack. This 
 //	function must be called before entering the TEST_FSM because it sets the 
-//  initial state to ERROR or TESTING
+//  initial state to ERROR or TESTING. The connection is taken from the
+//	pack presence comparator when its state is valid, the pack voltage is
+//	only probed otherwise.
 //
 // Inputs : none
 //
@@ -17,22 +19,32 @@
 void test_error_check(void)
 {	
 	uint8_t error_flag = 0x00;	// Error flag, 0x01 -> At least one battery cell is below threshold
-	/* Read unloaded battery pack voltages */	
-	float voltage = batteryCell_read(B4_ADC_CHANNEL, GND_ADC_CHANNEL);		 // Total quad-pack voltage
-	quad_pack_buffer[0] = batteryCell_read(B1_ADC_CHANNEL, GND_ADC_CHANNEL); // B1_POS - GND
-	quad_pack_buffer[1] = batteryCell_read(B2_ADC_CHANNEL, B1_ADC_CHANNEL);	 // B2_POS - B1_POS
-	quad_pack_buffer[2] = batteryCell_read(B3_ADC_CHANNEL, B2_ADC_CHANNEL);	 // B3_POS - B2_POS
-	quad_pack_buffer[3] = batteryCell_read(B4_ADC_CHANNEL, B3_ADC_CHANNEL);	 // B4_POS - B3_POS	
+	uint8_t presence_valid = pack_presence_is_valid();	// 0x01 -> comparator replaces the ADC connection probe
+	uint16_t voltage = 0;
+	
+	/* Comparator sees no pack -> connection error without touching the ADC */
+	if ((presence_valid == 0x01) && (pack_present == 0x00))
+	{
+		TEST_CURRENT_STATE = ERROR;
+		ERROR_CODE = CONNECTION_ERROR;
+		return;
+	}
+	
+	/* Read unloaded battery pack voltages from the measurement cache, one sweep of the scan sequencer */	
+	ADC_cache_acquire();
+	if (presence_valid == 0x00)
+		voltage = ADC_cache_cell_voltage(SCAN_PACK);		 // Total pack voltage in mV, connection probe
 	
 	/* Check if any battery cells are unsafe to test */
-	for (uint8_t i = 0; i < 4; i++)
+	for (uint8_t i = 0; i < cell_count; i++)
 	{
-		if (quad_pack_buffer[i] < min_battery_voltage)
+		quad_pack_buffer[i] = ADC_cache_cell_voltage(SCAN_B1 + i);	// Bi_POS - B(i-1)_POS
+		if (quad_pack_buffer[i] < chemistry_active->min_battery_mv)
 			error_flag = 0x01;	// At least one battery cell is below safety threshold
 	}						
 	
-	/* If voltage < 0.1V, no battery connection -> move to ERROR state */
-	if (voltage > 20)
+	/* If voltage < 0.1V, no battery connection -> move to ERROR state, 20 V for a quad pack, 5 V per cell */
+	if (voltage > (cell_count * 5000U))
 	{
 		TEST_CURRENT_STATE = ERROR;		// Move to ERROR state
 		ERROR_CODE = CONNECTION_ERROR;	// Error code identifier
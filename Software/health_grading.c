@@ -0,0 +1,269 @@
+#include "main.h"
+
+health_grading EEMEM health_grading_eeprom;	// replacement thresholds, in the EEPROM settings area
+
+//***************************************************************************
+//
+// Function Name : "health_grading_checksum"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Computes the checksum of a grading table, the inverted byte sum of
+//	everything in front of the checksum field.
+//
+// Inputs :
+//		const health_grading *table: table to check
+//
+// Outputs :
+//		uint8_t checksum: expected value of table->checksum
+//
+//**************************************************************************
+uint8_t health_grading_checksum(const health_grading *table)
+{
+	const uint8_t *bytes = (const uint8_t *)table;
+	uint8_t sum = 0;
+
+	for (uint8_t i = 0; i < offsetof(health_grading, checksum); i++)
+		sum += bytes[i];
+
+	return (uint8_t)~sum;
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grading_is_ordered"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Checks that the thresholds fall strictly from A+ to D-, which the binary
+//	search of health_grade() relies on.
+//
+// Inputs :
+//		const health_grading *table: table to check
+//
+// Outputs :
+//		uint8_t ordered: 0x01 -> usable, 0x00 -> rejected
+//
+//**************************************************************************
+uint8_t health_grading_is_ordered(const health_grading *table)
+{
+	for (uint8_t i = 1; i < HEALTH_THRESHOLDS; i++)
+	{
+		if (table->threshold_mv[i] >= table->threshold_mv[i - 1])
+			return 0x00;
+	}
+	return 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grading_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Reads the replacement thresholds from EEPROM. A table that is not
+//	valid and ordered is dropped. Called before chemistry_load(), which
+//	selects the thresholds.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void health_grading_load(void)
+{
+	eeprom_read_block(&health_grading_override, &health_grading_eeprom, sizeof(health_grading));
+	if ((health_grading_override.checksum != health_grading_checksum(&health_grading_override))
+		|| (health_grading_is_ordered(&health_grading_override) == 0x00))
+		health_grading_override.chemistry = HEALTH_GRADING_NO_OVERRIDE;
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grading_select"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Points health_grade() at the replacement thresholds if they were written
+//	for the active chemistry, at the thresholds of its profile otherwise.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void health_grading_select(void)
+{
+	if (health_grading_override.chemistry == chemistry_selected)
+		health_thresholds = health_grading_override.threshold_mv;
+	else
+		health_thresholds = chemistry_active->threshold_mv;
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grading_defaults"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Drops the replacement thresholds, every chemistry grades with the
+//	thresholds of its profile again.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void health_grading_defaults(void)
+{
+	health_grading_override.chemistry = HEALTH_GRADING_NO_OVERRIDE;
+	health_grading_select();
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grading_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Writes the replacement thresholds to EEPROM, only bytes that changed
+//	are written.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void health_grading_save(void)
+{
+	health_grading_override.checksum = health_grading_checksum(&health_grading_override);
+	eeprom_update_block(&health_grading_override, &health_grading_eeprom, sizeof(health_grading));
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grade"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Grades a loaded cell voltage: the best grade whose threshold the voltage
+//	meets, found by a binary search of the falling thresholds (4 compares
+//	for 12 thresholds). Below the last threshold the grade is F.
+//
+// Inputs :
+//		uint16_t voltage_mv: loaded cell voltage in mV
+//
+// Outputs :
+//		uint8_t grade: index into health_rating_lut[], 0 -> A+, 12 -> F
+//
+//**************************************************************************
+uint8_t health_grade(uint16_t voltage_mv)
+{
+	uint8_t low = 0;
+	uint8_t high = HEALTH_THRESHOLDS;
+
+	/* First threshold the voltage meets, HEALTH_THRESHOLDS if none */
+	while (low < high)
+	{
+		uint8_t middle = (low + high) / 2;
+
+		if (voltage_mv >= health_thresholds[middle])
+			high = middle;
+		else
+			low = middle + 1;
+	}
+	return low;
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grade_result"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Grades the cells of a finished test once and stores the grades
+//	with the record, so displaying and sending the result only looks
+//	them up.
+//
+// Inputs :
+//		volatile test_result *result: record with its LOADED voltages,
+//									  current_test_result included
+//
+// Outputs : None
+//
+//**************************************************************************
+void health_grade_result(volatile test_result *result)
+{
+	for (uint8_t i = 0; i < cell_count_checked(result->cell_count); i++)
+		result->health_grades[i] = health_grade(result->LOADED_battery_voltages[i]);
+}
+
+//***************************************************************************
+//
+// Function Name : "health_grading_remote_command"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Handles the grading commands of the remote interface, the character
+//	after 't' selects the command:
+//		'r': send the thresholds in use
+//		'w' <12 x 4 digits>: replace the thresholds A+ to D- of the active
+//							 chemistry in mV and store them in EEPROM,
+//							 rejected unless strictly falling
+//		'd': back to the thresholds of the chemistry profiles, stored in EEPROM
+//	One replacement table is kept, for the chemistry it was written for.
+//	'w' and 'd' are acknowledged with 't', a rejected table with 'e'.
+//	Results graded before keep their grades.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void health_grading_remote_command(void)
+{
+	health_grading table;
+
+	switch (USART3_receive_character()){
+		case 'r': //send thresholds
+			send_health_grading();
+			return;
+		case 'w': //replace thresholds
+			table.chemistry = chemistry_selected;
+			for (uint8_t i = 0; i < HEALTH_THRESHOLDS; i++)
+				table.threshold_mv[i] = USART3_receive_number(4);
+			if (health_grading_is_ordered(&table) == 0x00)
+			{
+				USART3_transmit_character('e'); //thresholds rejected
+				return;
+			}
+			health_grading_override = table;
+			health_grading_save();
+			health_grading_select();
+			break;
+		case 'd': //thresholds of the chemistry profiles
+			health_grading_defaults();
+			health_grading_save();
+			break;
+		default:
+			return;
+	}
+	USART3_transmit_character('t'); //grading table replaced
+}
+
+//***************************************************************************
+//
+// Function Name : "send_health_grading"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the thresholds A+ to D- in mV that health_grade() uses to the PC,
+// separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_health_grading(void)
+{
+	char grading_buff[64];
+	char *field = grading_buff;
+
+	for (uint8_t i = 0; i < HEALTH_THRESHOLDS; i++)
+		field += sprintf(field, (i == 0) ? "%u" : ",%u", health_thresholds[i]);
+
+	USART3_transmit_character('t'); //grading thresholds are being sent
+	USART3_transmit_string(grading_buff);
+}
@@ -173,10 +173,11 @@ void discard_test_results(PB_INPUT_TYPE pb_type)
 	if (pb_type == OK)
 	{
 		/* Erase current test result data */
-		for (uint8_t i = 0; i < 4; i++)
+		for (uint8_t i = 0; i < CELL_COUNT_MAX; i++)
 		{
 			current_test_result.LOADED_battery_voltages[i] = 0;
 			current_test_result.UNLOADED_battery_voltages[i] = 0;
+			current_test_result.LOADED_load_currents[i] = 0;
 		}
 		current_test_result.max_load_current = 0;
 		current_test_result.ampient_temp = 0;
@@ -188,7 +189,7 @@ void discard_test_results(PB_INPUT_TYPE pb_type)
 		/* Erase old test data from EEPROM */
 		if (LOCAL_INTERFACE_CURRENT_STATE == VIEW_HISTORY_STATE) {
 			if (VIEW_HISTORY_CURRENT_STATE == DISCARD_RESULTS_H) {
-				eeprom_update_block(&current_test_result, &test_results_history_eeprom[quad_pack_entry], sizeof(test_result));
+				test_history_save(quad_pack_entry);
 			}
 		}
 		
@@ -266,7 +267,7 @@ void scroll_previous_entries(PB_INPUT_TYPE pb_type)
 			else if (LOCAL_INTERFACE_CURRENT_STATE == VIEW_HISTORY_STATE)
 			{
 				/* Read test result from EEPROM and display menu for viewing its results */
-				eeprom_read_block(&current_test_result, &test_results_history_eeprom[quad_pack_entry], sizeof(test_result));
+				test_history_load(quad_pack_entry);
 				VIEW_HISTORY_CURRENT_STATE = SCROLL_TEST_RESULT_MENU_H;
 				scroll_test_result_menu(NONE, current_test_result);
 			}
@@ -301,7 +302,7 @@ void scroll_previous_entries(PB_INPUT_TYPE pb_type)
 // DESCRIPTION
 // This function displays a set of previous quad pack entries for the user
 //  to select. The cursor position is on the same line as the quad pack 
-//	entry the user is pointing to. There are 13 quad pack entries.
+//	entry the user is pointing to. There are test_history_entries entries.
 //
 // Inputs : none
 //
@@ -328,9 +329,9 @@ void display_quad_pack_entries(void)
 		quad_pack_display = quad_pack_entry + entries_below_cursor + 1;	// quad pack entry number on each line BELOW cursor
 		
 		if (quad_pack_display < 1)
-			quad_pack_display += 13;	// If value is <= 0, add 13 to ensure that display number 'rolls over' circularly
-		if (quad_pack_display > 13)
-			quad_pack_display -= 13;	// If value is >= 14, subtract 13 to ensure that display number 'rolls over' circularly
+			quad_pack_display += test_history_entries;	// If value is <= 0, add number of entries to ensure that display number 'rolls over' circularly
+		if (quad_pack_display > test_history_entries)
+			quad_pack_display -= test_history_entries;	// If value is past the last entry, subtract number of entries to ensure that display number 'rolls over' circularly
 		
 		if(quad_pack_display >= 10)
 			sprintf(dsp_buff[cursor + entries_below_cursor - 1], "Quad pack %d        ", quad_pack_display);
@@ -345,9 +346,9 @@ void display_quad_pack_entries(void)
 		quad_pack_display = quad_pack_entry - entries_above_cursor + 1;	// quad pack entry number on each line ABOVE cursor
 		
 		if (quad_pack_display < 1)
-			quad_pack_display += 13;	// If value is <= 0, add 13 to ensure that display number 'rolls over' circularly
-		if (quad_pack_display > 13)
-			quad_pack_display -= 13;	// If value is >= 14, subtract 13 to ensure that display number 'rolls over' circularly
+			quad_pack_display += test_history_entries;	// If value is <= 0, add number of entries to ensure that display number 'rolls over' circularly
+		if (quad_pack_display > test_history_entries)
+			quad_pack_display -= test_history_entries;	// If value is past the last entry, subtract number of entries to ensure that display number 'rolls over' circularly
 		
 		if(quad_pack_display >= 10)
 			sprintf(dsp_buff[cursor - entries_above_cursor - 1], "Quad pack %d        ", quad_pack_display);
@@ -8,29 +8,26 @@ volatile char health_rating_lut[13][2] = {
 	"F "							// 0x0C
 };
 
-test_result EEMEM test_results_history_eeprom[13];	// 507/512 bytes of available EEPROM
+uint8_t EEMEM test_history_eeprom[TEST_HISTORY_BYTES];	// packed test records, as many as fit in EEPROM
 
 int main(void)
 {
 	//set variables to default values
 	testing_mode = 0x01; //automated test
-	current_setting = 30; //30 A current
-	current_setting_100_dig = 0;
-	current_setting_10_dig = 3;
-	current_setting_1_dig = 0;
-	voltage_precision = 0x00; //high voltage precision
-	min_battery_voltage = 3.0; //min unloaded voltage of 3 V
+	adc_cell_profile = ADC_PROFILE_NORMAL; //16 samples, 2.048 V voltage reference
+	sag_capture_decimation = 4; //store every 4th sag sample, 20 ms at the shortest period
+	adc_cache_window_ms = 250; //reuse readings up to 250 ms old
+	adc_sample_period_us = 500; //timed loaded sequences, 500 us per slot
 	
 	adc_mode = 0x00; //single ended ADC mode
-	adc_value = 0;
-	adc_vref = 2.048; //2.048 voltage reference
-	battery_voltage_divider_ratios = 5.3;
+	adc_value_uv = 0;
+	adc_vref_mv = 2048; //2.048 voltage reference
 	current_sensing_voltage_divider_ratios = 1;
-	shunt_resistance_ohms = 0.000145;
-	OPAMP_gain = 20;
 	cursor = 1;
 	quad_pack_entry = 0;
-	load_current_amps = 0;
+	load_current_ma = 0;
+	adc_settle_mode = 0x01; //adaptive settling after channel switches
+	adc_settle_band_lsb = 2; //consecutive conversions must agree within 2 LSB
 	
 	LOCAL_INTERFACE_CURRENT_STATE = MAIN_MENU_STATE;
 	TEST_CURRENT_STATE = ERROR;
@@ -38,11 +35,23 @@ int main(void)
 	PB_PRESS = NONE;
 	
 	//initialize modules
+	timebase_init();
 	init_lcd();	
 	ADC_init(0x00);
+	cell_map_load(); //number of cells in series and the scan sequences for them
+	pack_presence_init(); //AC0 pack insertion and removal
+	current_range_init();
+	calibration_load(); //divider, offset and shunt coefficients from EEPROM
+	health_grading_load(); //replacement grading thresholds from EEPROM
+	chemistry_load(); //battery type, its floors, grading and default load current
+	control_gains_load(); //load current controller gains from EEPROM
+	motion_profile_load(); //trapezoidal profile of the knob from EEPROM
+	position_map_load(); //learned knob positions from EEPROM
 	PB_init();
 	LOCAL_INTERFACE_FSM();
 	A4988_init();
+	open_circuit_load(); //the knob may have been left anywhere, open the load before zeroing
+	calibration_auto_zero(0x00); //zero the shunt channel while the load is open
 	USART3_setup();
 	display_main_menu();	
 
@@ -52,10 +61,23 @@ int main(void)
 
 	while(1)
 	{	
-		if (LOCAL_INTERFACE_CURRENT_STATE == MAIN_MENU_STATE) //display main menu in main menu state
+		/* Keep the scan sequencer running in the background after a blocking read or snapshot took ADC0 */
+		if ((adc_scan_running == 0x00) || (adc_scan_sequence != adc_scan_default_sequence) || (adc_scan_profile != adc_cell_profile))
+			ADC_scan_start();
+		
+		/* Noise statistics from the background sweeps */
+		ADC_stats_sweep();
+		
+		/* Sag capture asked for by the PC, a chunk per pass */
+		sag_capture_export();
+		
+		/* Redraw the main menu every second, and as soon as a pack is plugged in or removed */
+		if (pack_presence_update() == 0x01)
+			main_menu_redraw_ticks -= TIMEBASE_HZ;
+		if ((LOCAL_INTERFACE_CURRENT_STATE == MAIN_MENU_STATE) && ((timebase_ticks() - main_menu_redraw_ticks) >= TIMEBASE_HZ)) //display main menu in main menu state
 			{
+				main_menu_redraw_ticks = timebase_ticks();
 				display_main_menu();	
-				_delay_ms(1000);
 			}
 
 		asm volatile("nop");
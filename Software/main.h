@@ -15,7 +15,9 @@
 #include <avr/eeprom.h>		// AVR EEPROM library
 #include <math.h>			// Math library
 #include <string.h>			// String library
+#include <stddef.h>			// offsetof
 #include <avr/sleep.h>		// AVR sleep library
+#include <avr/pgmspace.h>	// AVR program space library
 
 #define B1_ADC_CHANNEL	0x00	// AIN0 -> PD0: Battery cell 1 positive terminal
 #define B2_ADC_CHANNEL	0x01	// AIN1 -> PD1: Battery cell 2 positive terminal
@@ -24,68 +26,629 @@
 #define GND_ADC_CHANNEL	0x40	// AIN -> GND
 #define OPAMP_ADC_CHANNEL 0x0A	// AIN10 -> PE2: OPAMP 2 output
 
-/* Minimum unloaded voltage required for a test */
-volatile float min_battery_voltage;
+/* Board options */
+#define BOARD_CURRENT_LADDER 0	// 1 -> the shunt amplifier is routed into OP2 INP (PE1) and OPAMP 2 drives PE2, 0 -> the amplifier drives PE2 itself and OPAMP 2 stays off
+#define BOARD_CELL_TAPS_8S 0	// 1 -> B5-B8 taps wired to PD4, PD5, PD7 and PE0 and every tap divided 1:12, 0 -> quad pack board, B1-B4 only and PD5 left floating
+
+#if BOARD_CELL_TAPS_8S
+#define B5_ADC_CHANNEL	0x04	// AIN4 -> PD4: Battery cell 5 positive terminal
+#define B6_ADC_CHANNEL	0x05	// AIN5 -> PD5: Battery cell 6 positive terminal
+#define B7_ADC_CHANNEL	0x07	// AIN7 -> PD7: Battery cell 7 positive terminal
+#define B8_ADC_CHANNEL	0x08	// AIN8 -> PE0: Battery cell 8 positive terminal
+#endif
+
+/* Cell taps: the quad pack board takes 4 cells in series, BOARD_CELL_TAPS_8S up to 8 on the free AIN pins (PD3 is the stepper
+	home input and PE1-PE3 belong to OPAMP 2). The tap divider keeps the top tap of a full Li-ion pack below VDD. */
+#define CELL_COUNT_MIN 2		// 2S
+#if BOARD_CELL_TAPS_8S
+#define CELL_COUNT_MAX 8		// 8S, sizes every per cell table
+#define CELL_TAP_DIVIDER_PERMILLE 12000	// 1:12, 8S 33.6 V -> 2.8 V on the B8 pin
+#else
+#define CELL_COUNT_MAX 4		// 4S, sizes every per cell table
+#define CELL_TAP_DIVIDER_PERMILLE 5300	// 1:5.3, 4S 16.8 V -> 3.2 V on the B4 pin
+#endif
+#define CELL_COUNT_DEFAULT 4	// quad pack
+#define CELL_PAGE_CELLS 4		// cells per LCD page
+extern const uint8_t cell_tap_channels[CELL_COUNT_MAX + 1];	// channel map, tap 0 is the pack negative
+extern uint8_t EEMEM cell_count_eeprom;
+volatile uint8_t cell_count;	// cells in series of the pack under test, CELL_COUNT_MIN..CELL_COUNT_MAX
+volatile uint8_t cell_page;		// page of the cell voltage and health rating screens
+
+/* Fixed-point scaling contract: the measurement, control, storage and display
+   paths never use floats.
+	ADC pin voltages		int32_t microvolts (uV), signed for differential results
+	cell and pack voltages	uint16_t millivolts (mV), up to 65.535 V
+	load currents			int32_t milliamps (mA), up to 2147 A
+	references				uint16_t millivolts (mV)
+	divider ratios			uint16_t per mille (ratio x 1000)
+	resistances				uint16_t micro-ohms (uOhm)
+   Only the display formats a decimal point, with the macros below. */
+#define MV_WHOLE(mv) ((mv) / 1000)				// volts part of a mV value
+#define MV_FRAC(mv) ((mv) % 1000)				// mV part of a mV value, print with %03u
+#define MA_WHOLE(ma) ((ma) / 1000)				// amps part of a mA value
+#define MA_TENTHS(ma) (((ma) % 1000) / 100)		// first decimal of a mA value in amps
 
 /* Display buffer for DOG LCD using sprintf(). 4 lines, 21 characters per line */
 char dsp_buff[4][21];
 
-/* Buffer for Voltages to be sent through the UART Module to the Remote Interface */
-char remote_buff[8][5];
+/* Buffer for Voltages to be sent through the UART Module to the Remote Interface, [0:CELL_COUNT_MAX-1] unloaded, [CELL_COUNT_MAX:] loaded */
+char remote_buff[2 * CELL_COUNT_MAX][5];
 
 /* Buffer for Current to be sent through the UART Module to the Remote Interface */
 char current_buff[3];
 
-/* Buffer to store one piece of data for each battery in the quad-pack */
-volatile float quad_pack_buffer [4];
+/* Buffer to store one piece of data for each battery in the pack, cell voltages in mV */
+volatile uint16_t quad_pack_buffer [CELL_COUNT_MAX];
 
 /* Boolean buffer: 0x01 -> battery cell voltage below safety threshold; 0x00 -> battery cell is safe to test */
-volatile uint8_t quadpack_error_flags[4];
+volatile uint8_t quadpack_error_flags[CELL_COUNT_MAX];
 
 /* Global Variable Declarations */
 volatile uint8_t adc_mode;	// ADC conversion mode: 0x00 -> single-ended, 0x01 -> differential
-volatile float adc_value;	// Analog Voltage read from ADC in volts
-volatile float adc_vref;	// Reference voltage used by ADC in volts
-
-volatile float battery_voltage_divider_ratios;	// Voltage divider ratio used for measuring battery cells
+volatile int32_t adc_value_uv;	// Analog Voltage read from ADC in uV
+volatile uint16_t adc_vref_mv;	// Reference voltage used by ADC in mV
 
-volatile float load_current_amps; // Load current value in Amps
+volatile int32_t load_current_ma; // Load current value in mA
 volatile uint8_t current_sensing_voltage_divider_ratios; // Voltage divider ratio used for measuring voltage across shunt
-volatile float shunt_resistance_ohms; // 0.8 milli-ohms
-volatile float OPAMP_gain;	// Gain configuration for current sensing instrumentation amplifier
-volatile float temp;	// temporary variable 
+volatile int32_t temp;	// temporary variable 
+
+/* ADC0 configuration descriptor, applied by ADC_configure() */
+typedef struct {
+	uint8_t mode;		// 0x00 -> single-ended, 0x01 -> differential
+	uint8_t ref;		// VREF.ADC0REF value
+	uint8_t sampnum;	// ADC0.CTRLB value, sample accumulation
+	uint8_t presc;		// ADC0.CTRLC value, clock prescaler
+	uint8_t sampctrl;	// ADC0.SAMPCTRL value, sample length extension in ADC clock cycles
+	uint8_t sampdly;	// ADC0.CTRLD value, sampling delay between accumulated samples
+} adc_config;
+
+/* Named acquisition profiles, order of the adc_profiles[] table in "adc.c" */
+typedef enum {
+	ADC_PROFILE_FAST,		// 4 samples, fast ADC clock: stepper control loop
+	ADC_PROFILE_NORMAL,		// 16 samples: background scan and general reads
+	ADC_PROFILE_PRECISE,	// 128 samples, long sampling and sample delay: calibration and unloaded reads
+	ADC_PROFILE_WIDE,		// 16 samples on the VDD reference, the former low precision mode
+	ADC_PROFILE_COUNT		// Number of profiles
+} ADC_PROFILES;
+
+/* Acquisition profile, the mode comes from the channel being read */
+typedef struct {
+	char name[8];		// name shown on the LCD
+	uint8_t ref;		// VREF.ADC0REF value
+	uint8_t sampnum;	// ADC0.CTRLB value, sample accumulation
+	uint8_t presc;		// ADC0.CTRLC value, clock prescaler
+	uint8_t sampctrl;	// ADC0.SAMPCTRL value
+	uint8_t sampdly;	// ADC0.CTRLD value
+	uint8_t shift;		// right shift that averages the accumulated ADC0.RES to one sample
+} adc_profile;
+
+extern const adc_profile adc_profiles[ADC_PROFILE_COUNT];
+
+volatile uint8_t adc_active_profile;	// profile of the blocking read configuration
+volatile uint8_t adc_cell_profile;		// profile for cell and pack reads, chosen in the settings menu
+volatile uint16_t adc_profile_conversion_us[ADC_PROFILE_COUNT];	// last measured conversion time per profile
+
+#define ADC_CONVERSION_COUNTS_PER_US 2	// TCB2 times the conversions, clocked from CLK_PER / 2 = 2 MHz, wraps after 32.7 ms
+
+#define ADC_VREF_SETTLE_US 50	// reference start-up time after VREF.ADC0REF is changed
+#define ADC_VREF_SETTLE_TICKS (((ADC_VREF_SETTLE_US * TIMEBASE_HZ) + 999999UL) / 1000000UL + 1)	// ADC_VREF_SETTLE_US in whole timebase ticks, +1 for the partial first tick
+
+/* Configuration cache: what is programmed into ADC0 right now */
+adc_config adc_active_config;
+volatile uint8_t adc_config_valid;			// 0x00 -> registers unknown, next ADC_configure() writes all of them
+volatile uint16_t adc_config_requests;		// number of ADC_configure() calls
+volatile uint16_t adc_config_full_writes;	// number of full reconfigurations performed
+volatile uint16_t adc_config_avoided;		// number of changed configurations applied without a full rewrite
+
+/* Auto-ranging load current, order of the current_ranges[] table in "current_range.c". Every range
+   is read on the reference of the acquisition profile, the full scale below is on 2.048 V */
+typedef enum {
+	CURRENT_RANGE_HIGH,		// gain 20, OPAMP 2 follower or off: up to 670 A
+	CURRENT_RANGE_MID,		// gain 40, ladder x2: up to 320 A
+	CURRENT_RANGE_LOW,		// gain 80, ladder x4: up to 143 A
+	CURRENT_RANGE_FINE,		// gain 160, ladder x8: up to 55 A
+	CURRENT_RANGE_COUNT		// Number of ranges
+} CURRENT_RANGES;
+
+/* One current range: OPAMP 2 ladder tap */
+typedef struct {
+	char name[6];		// name shown to the remote interface
+	uint8_t wiper;		// OPAMP.OP2RESMUX MUXWIP value, unused for the follower
+	uint8_t ladder;		// OPAMP 2 gain, 1 -> follower
+	uint8_t gain;		// total gain from the shunt to the ADC pin, CURRENT_AMP_GAIN x ladder
+} current_range;
+
+extern const current_range current_ranges[CURRENT_RANGE_COUNT];
+
+#define CURRENT_AMP_GAIN 20				// external instrumentation amplifier, the whole gain of the board without the ladder
+#if BOARD_CURRENT_LADDER
+#define CURRENT_RANGE_USABLE CURRENT_RANGE_COUNT	// ranges the board can select
+#else
+#define CURRENT_RANGE_USABLE 1			// the amplifier output reaches the ADC directly, CURRENT_RANGE_HIGH only
+#endif
+
+#define CURRENT_OUTPUT_OFFSET_UV 96000L	// nominal amplifier output with no load current, times the ladder gain in the other ranges, the calibrated zero is in current_zero_uv[]
+#define CURRENT_NOISE_FLOOR_MA 200		// lower currents read as 0
+#define LOAD_CURRENT_TOLERANCE_MA 1000	// settle band of the lithium profiles, set_load_current() uses the one of the active chemistry
+#define LOAD_CURRENT_OFF_MA 1000		// the load counts as released below 1 A
+#define CURRENT_RANGE_UP_COUNTS 3900	// 95 % of full scale -> next less sensitive range
+#define CURRENT_RANGE_DOWN_PERCENT 70	// a more sensitive range is used when the reading lands below 70 % of its full scale
+#define CURRENT_RANGE_SETTLE_US 10		// OPAMP output settling after a wiper move
+volatile uint8_t current_range_active;	// range of the next load current conversion
+volatile uint16_t current_range_down_counts[CURRENT_RANGE_COUNT];	// count below which the next more sensitive range is used
+volatile uint16_t current_range_switches;	// number of range changes
+
+/* Pack presence, AC0 compares the tap of cell 3 against a DACREF threshold */
+#define PACK_PRESENCE_AC_MUXPOS AC_MUXPOS_AINP0_gc	// AINP0 -> PD2: Battery cell 3 positive terminal
+#define PACK_PRESENCE_TAP 3					// cells below the comparator input, smaller packs use the ADC probe
+#define PACK_PRESENCE_DACREF 50				// 50/256 x 1.024 V = 0.2 V at the pin, about 1 V on the tap
+#define PACK_PRESENCE_SETTLE_US 50			// comparator and DACREF start-up
+#define PACK_PRESENCE_DEBOUNCE_MS 50		// the state must be stable this long
+volatile uint8_t pack_presence_raw;			// comparator state at the last edge
+volatile uint32_t pack_presence_edge_ticks;	// timebase ticks of the last edge
+volatile uint8_t pack_present;				// debounced state, 0x01 -> pack connected
+volatile uint16_t pack_presence_events;		// insertions and removals accepted
+volatile uint32_t main_menu_redraw_ticks;	// timebase ticks of the last periodic main menu redraw
+
+/* Internal temperature sensor, converted with the factory calibration in the signature row */
+#define TEMPERATURE_SAMPCTRL 16			// sample length extension of the sensor, >= 32 us up to a 500 kHz ADC clock
+volatile int16_t ambient_temperature_dc;	// last ambient temperature in 0.1 C, for temperature compensated grading
+
+/* Load current controller, set_load_current() turns the knob at a step rate set by a PI controller */
+#define STEP_PERIOD_MIN_US 750			// fastest step of the controller, far from the target
+#define STEP_PERIOD_MAX_US 20000		// slowest step of the controller, close to the target
+#define CONTROL_RATE_MAX_SPS (1000000L / STEP_PERIOD_MIN_US)	// output limit in steps/s, the sweep and the ramp usually limit first, see control_rate_limit()
+#define CONTROL_DEFAULT_KP 30			// steps/s per A of error, tuned with control_simulate(): 5.1 s, no overshoot
+#define CONTROL_DEFAULT_KI 32			// steps/s per A*s of integrated error
+#define CONTROL_GAIN_MAX 9999			// 4 digits on the remote interface
+#define CONTROL_INTEGRAL_MAX 1000000000L	// integral limit in mA*ms
+
+/* Controller gains, stored in EEPROM : 5 bytes */
+typedef struct {
+	uint16_t kp;		// proportional gain, steps/s per A
+	uint16_t ki;		// integral gain, steps/s per A*s
+	uint8_t checksum;	// control_gains_checksum() of the bytes above
+} control_gains;
+
+/* State of one running control loop */
+typedef struct {
+	int32_t integral_ma_ms;	// integrated error in mA*ms
+} control_state;
+
+extern control_gains EEMEM control_gains_eeprom;
+control_gains control_gains_active;		// gains used by set_load_current()
+volatile uint16_t control_settle_ms;	// time the last set_load_current() took to settle
+volatile uint16_t control_overshoot_ma;	// largest excursion of the last set_load_current() past its target
+volatile uint16_t control_steps;		// steps taken by the last set_load_current()
+volatile uint16_t control_release_ms;	// time the last open_circuit_load() took to bring the current below LOAD_CURRENT_OFF_MA
+
+/* Simulated plant of control_simulate(): quad pack, fixed resistance and a carbon pile whose resistance falls with the knob position */
+#define CONTROL_SIM_PACK_MV 13000L
+#define CONTROL_SIM_FIXED_UOHM 10000L		// cables, shunt and cells
+#define CONTROL_SIM_PILE_UOHM_STEPS 20000000L	// pile resistance x position, 500 A at 1250 steps
+#define CONTROL_SIM_LAG_MS 30L				// heating of the pile, the current follows the knob with this lag
+#define CONTROL_SIM_TARGET_MA 500000L
+#define CONTROL_SIM_TIMEOUT_US 60000000UL
+#define CONTROL_SIM_SLOT_US 500L			// one conversion of the monitor sequence
+#define CONTROL_SIM_SWEEP_US (2 * CELL_COUNT_DEFAULT * CONTROL_SIM_SLOT_US)	// monitor sweep of a quad pack, one reading per step: 4 ms, at most 250 steps/s
+#define CONTROL_SIM_HOLD_US (5 * CONTROL_SIM_LAG_MS * 1000L)	// settled once the reading stayed in the band for five lags of the pile
+
+typedef enum {
+	CONTROL_SIM_FIXED_RATE,		// one step per reading at STEP_PERIOD_US, the former set_load_current()
+	CONTROL_SIM_PI,				// PI controller
+	CONTROL_SIM_CONTROLLERS		// Number of simulated controllers
+} CONTROL_SIM_CONTROLLER;
+
+typedef struct {
+	uint16_t settle_ms;		// simulated time until the current stays in the tolerance band
+	uint16_t overshoot_ma;	// largest excursion past the target
+} control_sim_result;
+
+control_sim_result control_sim_results[CONTROL_SIM_CONTROLLERS];
+
+/* Motion engine, TCA1 generates the STEP pulses on PC4 and its compare interrupt counts them */
+#define MOTION_TIMER_HZ (F_CPU / 4)		// TCA1 clock, CLKSEL DIV4 -> 1 us per count
+#define MOTION_RATE_MIN_SPS ((MOTION_TIMER_HZ / 65536UL) + 1)	// the period must fit the 16 bit PER register
+#define MOTION_RATE_MAX_SPS 4000		// upper limit of a move, the NEMA-17 stalls well below it
+#define MOTION_RATE_DEFAULT_SPS (1000000UL / STEP_PERIOD_US)	// fixed rate of the search of open_circuit_load(), starts and stops without a ramp
+#define MOTION_COUNTER_CLOCKWISE 0x00	// DIR LOW, less load current
+#define MOTION_CLOCKWISE 0x01			// DIR HIGH, more load current
+
+typedef void (*motion_callback)(void);	// called from the step ISR when a move completes
+
+volatile uint8_t motion_active;				// 0x01 -> TCA1 is generating the steps of a move
+volatile uint8_t motion_direction;			// direction of the current or last move
+volatile uint16_t motion_steps_remaining;	// steps left in the current move
+volatile uint16_t motion_steps_done;		// steps completed by the current or last move
+motion_callback motion_done_callback;		// completion callback of the current move, 0 -> none
+
+/* Trapezoidal profile of a large move: accelerate from standstill, cruise, decelerate to standstill */
+#define MOTION_RAMP_STEPS_MAX 160			// longest ramp of the step interval table
+#define MOTION_PROFILE_RATE_MIN_SPS 100		// limits of the cruise rate on the remote interface
+#define MOTION_PROFILE_ACCEL_MIN_SPS2 500	// the first interval of the ramp must fit the 16 bit PER register
+#define MOTION_PROFILE_ACCEL_MAX_SPS2 60000
+#define MOTION_DEFAULT_MAX_RATE_SPS 1800	// 4x MOTION_RATE_DEFAULT_SPS
+#define MOTION_DEFAULT_ACCEL_SPS2 12000		// reaches the default cruise rate in 136 steps, 150 ms
+
+/* Motion profile, stored in EEPROM : 4 bytes, range checked instead of a checksum to fit the settings area */
+typedef struct {
+	uint16_t max_rate_sps;	// cruise rate in steps/s
+	uint16_t accel_sps2;	// acceleration and deceleration in steps/s^2
+} motion_profile;
+
+extern motion_profile EEMEM motion_profile_eeprom;
+motion_profile motion_profile_active;			// profile of motion_move_profiled()
+uint16_t motion_ramp_table[MOTION_RAMP_STEPS_MAX];	// interval of each step from standstill in TCA1 counts
+volatile uint8_t motion_ramp_length;			// entries in use, the last one is the cruise interval
+volatile uint8_t motion_profiled;				// 0x01 -> the current move follows the ramp table
+
+/* Absolute position of the knob in steps, 0 where the current fell below LOAD_CURRENT_OFF_MA the last time the load was opened */
+#define OPEN_CIRCUIT_EXTRA_STEPS 50			// steps turned past the reference to make sure the pile is open
+volatile int16_t motion_position;			// steps from the reference, > 0 -> towards more current
+volatile uint8_t motion_position_valid;		// 0x01 -> a reference was found since power up
+
+/* Learned map of knob position against the conductance of the load (load current / unloaded pack voltage), one bin
+	every POSITION_MAP_BIN_MS. The conductance is a property of the pile, so the map holds for any pack voltage, cell count and chemistry */
+#define POSITION_MAP_BINS 8
+#define POSITION_MAP_BIN_MS 5000L			// bins at 5, 10 ... 40 S, 40 S is 500 A from a 12.5 V pack
+#define POSITION_MAP_VERSION 0x02			// layout of the map in EEPROM, 0x02 -> conductance bins, another version is not loaded
+#define POSITION_MAP_PACK_MIN_MV 1000		// below this the pack voltage is not known, the map is not used
+#define POSITION_MAP_UNLEARNED (-1)			// erased EEPROM reads as -1
+#define POSITION_MAP_POSITION_MAX 30000		// a bin further than this is not accepted from EEPROM
+#define POSITION_MAP_LEARN_WEIGHT 4			// a bin moves by 1/4 of its error per test, so it follows the wear of the pile
+#define POSITION_MAP_UNKNOWN 0x7FFF			// no prediction, nothing learned yet
+#define FEED_FORWARD_PERCENT 90				// set_load_current() jumps to the position of 90% of the target, the PI loop trims the rest
+
+/* Position map, stored in EEPROM behind the test history : 1 + 16 = 17 bytes, range checked per bin */
+typedef struct {
+	uint8_t version;						// POSITION_MAP_VERSION
+	int16_t position[POSITION_MAP_BINS];	// position of (bin + 1) x POSITION_MAP_BIN_MS, POSITION_MAP_UNLEARNED -> not learned
+} position_map;
+
+/* One point of the map */
+typedef struct {
+	int16_t position;			// steps from the reference
+	int32_t conductance_ms;		// conductance of the load at this position in mS (mA / V)
+} position_map_point;
+
+extern position_map EEMEM position_map_eeprom;
+position_map position_map_active;			// map used by set_load_current()
+volatile int16_t position_map_predicted;	// predicted position of the last set_load_current() target, POSITION_MAP_UNKNOWN -> none
+volatile int16_t position_map_error;		// settled - predicted position of the last set_load_current(), 0 without a prediction
+
+/* Control loop benchmark: mean CPU cycles per set_load_current() iteration, float reference vs fixed-point */
+#define BENCH_ITERATIONS 32
+volatile uint16_t bench_float_cycles;
+volatile uint16_t bench_fixed_cycles;
+
+/* Common timebase, RTC clocked from the internal 32.768 kHz oscillator */
+#define TIMEBASE_HZ 32768UL
+#define TIMEBASE_TICKS_TO_US(t) (((uint32_t)(t) * 15625UL) >> 9)	// ticks -> us, valid for spans below 8 s
+#define TIMEBASE_TICKS_TO_MS(t) (((uint32_t)(t) * 125UL) >> 12)		// ticks -> ms
+volatile uint16_t timebase_overflows;	// upper 16 bits of the timebase
+
+/* Background scan sequencer channels, index of the adc_scan_channels[] table built by cell_map_configure() */
+typedef enum {
+	SCAN_B1,			// B1_POS - GND
+	SCAN_B2,			// B2_POS - B1_POS
+	SCAN_B3,			// B3_POS - B2_POS
+	SCAN_B4,			// B4_POS - B3_POS
+	SCAN_B5,			// B5_POS - B4_POS
+	SCAN_B6,			// B6_POS - B5_POS
+	SCAN_B7,			// B7_POS - B6_POS
+	SCAN_B8,			// B8_POS - B7_POS
+	SCAN_PACK,			// positive terminal of the last cell - GND, total pack voltage
+	SCAN_LOAD_CURRENT,	// OPAMP 2 output, single-ended
+	SCAN_TEMPERATURE,	// internal temperature sensor, single-ended
+	SCAN_CHANNEL_COUNT	// Number of channels in the list
+} ADC_SCAN_CHANNELS;
+
+/* One entry of the scan sequencer channel list */
+typedef struct {
+	uint8_t muxpos;		// ADC0.MUXPOS value
+	uint8_t muxneg;		// ADC0.MUXNEG value, ignored in single-ended mode
+	uint8_t mode;		// 0x00 -> single-ended, 0x01 -> differential
+} adc_scan_channel;
+
+/* Channel list and sequences for cell_count cells, rebuilt by cell_map_configure() */
+adc_scan_channel adc_scan_channels[SCAN_CHANNEL_COUNT];
+
+#define ADC_SCAN_MAX_SLOTS ((2 * CELL_COUNT_MAX) + 1)	// longest sequence the sample table can hold
+
+/* Background sequence: the cells, the pack, the load current and the temperature, slot i holds cell i */
+uint8_t adc_scan_default_sequence[CELL_COUNT_MAX + 3];
+volatile uint8_t adc_scan_default_length;	// cell_count + 3 slots
+
+/* Loaded snapshot: load current interleaved with the cells, slot 2*i+1 holds cell i */
+#define ADC_SNAPSHOT_MAX_LENGTH ((2 * CELL_COUNT_MAX) + 1)
+uint8_t adc_snapshot_sequence[ADC_SNAPSHOT_MAX_LENGTH];
+volatile uint8_t adc_snapshot_length;		// 2 x cell_count + 1 slots
+
+#define ADC_SCAN_SETTLE_CONVERSIONS 1	// conversions discarded after each MUX switch in the fixed settling mode
+
+/* Adaptive settling after a channel switch */
+#define ADC_SETTLE_MATCHES 2			// consecutive conversions that must agree before a channel is accepted
+#define ADC_SETTLE_TIMEOUT_US 10000		// hard limit, same as the original fixed settling delay
+volatile uint8_t adc_settle_mode;		// 0x00 -> fixed delay/discard, 0x01 -> adaptive
+volatile uint8_t adc_settle_band_lsb;	// agreement band for consecutive settling conversions in LSB
+volatile uint16_t adc_settle_time_us[SCAN_CHANNEL_COUNT];	// last measured settle time per channel
+volatile uint16_t adc_settle_timeouts;	// number of channel switches that hit the timeout
+
+/* Double-buffered sample table [buffer][slot], raw accumulated ADC0.RES values and timestamps written by the RESRDY ISR */
+volatile uint16_t adc_scan_table[2][ADC_SCAN_MAX_SLOTS];
+volatile uint32_t adc_scan_time[2][ADC_SCAN_MAX_SLOTS];
+volatile uint8_t adc_scan_range[2][ADC_SCAN_MAX_SLOTS];	// current range of the load current slots
+volatile uint8_t adc_scan_select_range;	// current range applied when the active slot was selected
+volatile uint8_t adc_scan_front;		// buffer index holding the most recent complete sweep
+const uint8_t *volatile adc_scan_sequence;	// channel of each slot in the active sequence
+volatile uint8_t adc_scan_length;		// number of slots in the active sequence
+volatile uint8_t adc_scan_index;		// slot currently being converted
+volatile uint8_t adc_scan_profile;		// acquisition profile of the active sequence
+volatile uint16_t adc_scan_convert_start;	// TCB2 count when the conversion to be stored was started
+volatile uint8_t adc_scan_discard;		// conversions left to discard on the current channel
+volatile uint8_t adc_scan_settling;		// 0x01 -> current channel still settling in the adaptive mode
+volatile uint8_t adc_scan_settle_matches;	// consecutive agreeing settling conversions
+volatile uint16_t adc_scan_settle_previous;	// previous settling conversion
+volatile uint8_t adc_scan_settle_first;	// 0x01 -> no settling conversion taken on the current channel yet
+volatile uint32_t adc_scan_settle_start;	// timebase ticks when the channel was selected
+volatile uint8_t adc_scan_vref_settling;	// 0x01 -> the scan changed the reference, conversions are thrown away until it settles
+volatile uint32_t adc_scan_vref_start;	// timebase ticks when the scan changed the reference
+volatile uint8_t adc_scan_running;		// 0x01 -> scan sequencer owns ADC0, 0x00 -> ADC0 free for blocking reads
+volatile uint16_t adc_scan_sweep_count;	// incremented each time a complete sweep is published
+
+/* Timed acquisition: TCB0 triggers ADC0 through EVSYS channel 0, TCB1 timestamps the results */
+#define ADC_TIMED_COUNTS_PER_US 2		// TCB0/TCB1 clocked from CLK_PER / 2 = 2 MHz
+#define ADC_TIMED_MIN_PERIOD_US 200		// longer than a FAST conversion
+#define ADC_TIMED_MAX_PERIOD_US 10000	// 3 periods (two missed results) stay below the 32.7 ms wrap of TCB1
+volatile uint8_t adc_scan_timed;		// 0x01 -> conversions of the active sequence are started by TCB0
+volatile uint16_t adc_sample_period_us;	// sample period of the loaded sequences, 0 -> free running
+volatile uint16_t adc_timed_period_us;	// nominal period of the running timed acquisition
+volatile uint16_t adc_timed_last;		// TCB1 count of the previous result
+volatile uint16_t adc_timed_samples;	// results collected since ADC_timed_start()
+volatile uint16_t adc_timed_intervals;	// result intervals measured since ADC_timed_start()
+volatile uint8_t adc_timed_restart;	// 0x01 -> the next result starts a new interval, no interval is measured
+volatile uint16_t adc_timed_discarded;	// timed conversions thrown away while the reference or input settled
+volatile uint32_t adc_timed_interval_sum;	// sum of the result intervals in TCB1 counts
+volatile uint16_t adc_timed_interval_min;	// shortest result interval in TCB1 counts
+volatile uint16_t adc_timed_interval_max;	// longest result interval in TCB1 counts
+volatile uint16_t adc_timed_missed;		// intervals longer than 1.5 periods, results overwritten before collection
+
+/* Streaming statistics of one channel, Welford's method in integer arithmetic : 26 bytes */
+typedef struct {
+	uint16_t count;		// samples in the statistics
+	int64_t mean;		// running mean, Q16 (sample units x 65536), read with stream_stats_mean()
+	int64_t m2;			// sum of squared deviations from the mean
+	int32_t min;		// lowest sample
+	int32_t max;		// highest sample
+} stream_stats;
+
+#define STREAM_STATS_MAX_COUNT 0xFFFF	// full count, older samples are weighed down from here
+
+/* Noise statistics per scan channel, fed from the unloaded readings: uV at the ADC pins, 0.1 C for the temperature */
+stream_stats adc_channel_stats[SCAN_CHANNEL_COUNT];
+volatile uint16_t adc_stats_sweep;	// last background sweep added to the statistics
+volatile uint8_t adc_stats_profile;	// acquisition profile the statistics were taken with
+
+/* Measurement cache, filled from sweeps of the default sequence, indexed by ADC_SCAN_CHANNELS */
+volatile uint16_t adc_cache_raw[SCAN_CHANNEL_COUNT];		// raw accumulated ADC0.RES value
+volatile uint32_t adc_cache_time[SCAN_CHANNEL_COUNT];	// timebase count of the conversion
+volatile uint8_t adc_cache_profile[SCAN_CHANNEL_COUNT];	// acquisition profile of the conversion
+volatile uint8_t adc_cache_current_range;	// current range of the cached load current
+volatile uint16_t adc_cache_valid;		// bit per channel, 1 -> cache entry holds a reading
+volatile uint16_t adc_cache_window_ms;	// freshness window, older readings are re-acquired
+volatile uint16_t adc_cache_hits;		// requests served from the cache
+volatile uint16_t adc_cache_misses;		// requests that needed a new sweep
+
+/* Undervoltage monitor: load current interleaved with the cells, window comparator armed on the cell slots */
+#define ADC_MONITOR_MAX_LENGTH (2 * CELL_COUNT_MAX)
+uint8_t adc_monitor_sequence[ADC_MONITOR_MAX_LENGTH];
+volatile uint8_t adc_monitor_length;		// 2 x cell_count slots
+volatile uint8_t adc_monitor_active;		// 0x01 -> window comparator armed on stored cell conversions
+volatile uint8_t adc_monitor_tripped;		// 0x01 -> a cell dropped below min_loaded_voltage and the load was opened
+volatile uint8_t adc_monitor_trip_cell;		// cell that tripped (1-8), 0 -> no trip
+volatile uint16_t adc_monitor_trip_current;	// load current in amps when the trip happened
+volatile int16_t adc_monitor_winlt[CELL_COUNT_MAX];	// window comparator floor of each cell channel, raw counts
+
+/* Calibration table, stored in the EEPROM settings area and copied to calibration_data at boot by calibration_load() */
+#define CALIBRATION_CHANNELS (SCAN_PACK + 1)	// SCAN_B1..SCAN_B8 and SCAN_PACK
+#define CALIBRATION_MAGIC 0xCA1B				// marks a table written by calibration_save()
+#define CALIBRATION_DEFAULT_DIVIDER_PERMILLE CELL_TAP_DIVIDER_PERMILLE	// divider ratio of the board
+#define CALIBRATION_DEFAULT_SHUNT_UOHM 145		// 0.145 milli-ohms
+#define CALIBRATION_DIVIDER_MIN_PERMILLE 1000	// a pin voltage up to the reference at the lowest ratio still fits the mV conversions
+#define CALIBRATION_DIVIDER_MAX_PERMILLE 12000
+#define CALIBRATION_OFFSET_MAX_UV 30000
+#define CALIBRATION_SHUNT_MIN_UOHM 100
+#define CALIBRATION_SHUNT_MAX_UOHM 1000
+#define CALIBRATION_GAIN_MIN_PERMILLE 500
+#define CALIBRATION_GAIN_MAX_PERMILLE 1500
+#define CALIBRATION_ZERO_WINDOW_UV 2000L		// auto-zero readings further than 4 LSB (2 mV on 2.048 V, 0.7 A) from the stored zero are rejected
+
+typedef struct {
+	uint16_t magic;										// CALIBRATION_MAGIC : 2 bytes
+	uint16_t divider_permille[CALIBRATION_CHANNELS];	// divider ratio x1000 per channel : 18 bytes
+	int16_t offset_uv[CALIBRATION_CHANNELS];			// offset at the ADC pins in uV, removed before the divider : 18 bytes
+	uint16_t shunt_uohm;								// shunt resistance in uOhm : 2 bytes
+	uint16_t current_gain_permille;						// load current gain trim x1000 : 2 bytes
+	int32_t current_zero_uv[CURRENT_RANGE_COUNT];		// amplifier output with no load current per range in uV : 16 bytes
+	uint8_t checksum;									// calibration_checksum() of the bytes above : 1 byte
+} calibration;											// Total size = 2 + 18 + 18 + 2 + 2 + 16 + 1 = 59 bytes
+
+extern calibration EEMEM calibration_eeprom;
+calibration calibration_data;	// working table used by the conversions
+volatile int32_t current_zero_uv[CURRENT_RANGE_COUNT];	// no-load amplifier output per range in uV, from the last auto-zero
+volatile uint8_t current_zero_accepted;	// ranges accepted by the last auto-zero
+volatile uint8_t calibration_valid;		// 0x01 -> table loaded from or saved to EEPROM, 0x00 -> defaults
+
+/* Sag capture channels, order of the values in a sag_sample */
+typedef enum {
+	SAG_CURRENT,	// load current in 0.1 A
+	SAG_B1,			// cell voltages in mV
+	SAG_B2,
+	SAG_B3,
+	SAG_B4,
+	SAG_B5,
+	SAG_B6,
+	SAG_B7,
+	SAG_B8,
+	SAG_CHANNELS	// Number of captured channels
+} SAG_CAPTURE_CHANNELS;
+
+/* One sag capture sample, 22 bytes */
+typedef struct {
+	uint32_t time_ms;				// time since sag_capture_start() in ms
+	uint16_t value[SAG_CHANNELS];	// indexed by SAG_CAPTURE_CHANNELS
+} sag_sample;
+
+#define SAG_CAPTURE_ENTRIES 256		// ring buffer length, 5.6 KB of the 16 KB SRAM
+#define SAG_CAPTURE_PERIOD_MIN_MS 5	// shortest sample period before decimation, a longer loaded sweep sets the period
+#define SAG_EXPORT_CHUNK 8			// samples sent per pass of the main loop
+
+extern const char sag_channel_names[SAG_CHANNELS][8];
+
+sag_sample sag_capture_buffer[SAG_CAPTURE_ENTRIES];
+volatile uint16_t sag_capture_head;			// next slot to write
+volatile uint16_t sag_capture_count;		// number of valid samples
+volatile uint8_t sag_capture_active;		// 0x01 -> recording
+volatile uint8_t sag_capture_decimation;	// store every n-th sample, 1 -> store all
+volatile uint8_t sag_capture_skip;			// samples since the last stored one
+volatile uint32_t sag_capture_start_ticks;	// timebase count at sag_capture_start()
+volatile uint32_t sag_capture_due;			// timebase count when the next sample is due
+volatile uint16_t sag_capture_period_ms;	// sample period of the capture, at least one loaded sweep
+volatile uint16_t sag_capture_period_ticks;	// sag_capture_period_ms in timebase ticks
+volatile uint8_t sag_export_pending;		// 0x01 -> the PC asked for the capture, the export has not started yet
+volatile uint16_t sag_export_index;			// next buffer slot to send
+volatile uint16_t sag_export_remaining;		// samples left to send
+volatile uint16_t sag_capture_last[SAG_CHANNELS];	// latest value of each channel
+volatile uint16_t sag_capture_min[SAG_CHANNELS];	// minimum of each channel since the start
+volatile uint16_t sag_capture_max[SAG_CHANNELS];	// maximum of each channel since the start
+volatile uint8_t sag_view_channel;			// channel shown on the LCD summary
+
+/* DCIR test: the load is stepped through DCIR_STEPS plateaus and every cell is fitted on the fly */
+#define DCIR_STEPS 4			// plateaus after the unloaded point
+#define DCIR_PLATEAU_MS 100		// hold at each plateau before the snapshot
+extern const uint8_t dcir_step_percent[DCIR_STEPS];
+
+/* Running least-squares sums of one cell, V = OCV - R x I */
+typedef struct {
+	uint8_t points;		// number of (I, V) points
+	int32_t sum_i;		// mA
+	int32_t sum_v;		// mV
+	int64_t sum_ii;		// mA^2
+	int64_t sum_iv;		// mA x mV
+} dcir_fit;
+
+dcir_fit dcir_fits[CELL_COUNT_MAX];	// one per cell
+volatile int32_t loaded_cell_current_ma[CELL_COUNT_MAX];	// load current in mA when each LOADED voltage was sampled
 
 volatile uint8_t cursor;	// LCD cursor line position (1,2,3,4)
-volatile uint8_t quad_pack_entry;	// quad pack entry that cursor is pointing to, row index for 13x4 history matrices
+volatile uint8_t quad_pack_entry;	// history entry that cursor is pointing to, 0..test_history_entries-1
 
-/* buffer array storing the health ratings of all 4 cells as strings, [0:1]->B1, [2:3]->B2, [4:5]->B3, [6:7]->B4 */
-volatile char health_rating_characters[8];
+/* buffer array storing the health ratings of the cells as strings, [0:1]->B1, [2:3]->B2, ... [14:15]->B8 */
+volatile char health_rating_characters[2 * CELL_COUNT_MAX];
 
 /* Look-up table used to map the loaded voltages to a health rating string */
 extern volatile char health_rating_lut[13][2];
 
+/* Health grading: the loaded voltage is graded against falling thresholds, one per grade A+ to D-, F below the last */
+#define HEALTH_GRADES 13	// rows of health_rating_lut
+#define HEALTH_THRESHOLDS (HEALTH_GRADES - 1)
+#define HEALTH_GRADING_NO_OVERRIDE 0xFF	// no replacement thresholds stored
+
+/* Replacement grading thresholds for one chemistry, stored in the EEPROM settings area */
+typedef struct {
+	uint8_t chemistry;							// CHEMISTRIES value the thresholds apply to : 1 byte
+	uint16_t threshold_mv[HEALTH_THRESHOLDS];	// minimum loaded voltage of each grade in mV : 24 bytes
+	uint8_t checksum;							// health_grading_checksum() of the bytes above : 1 byte
+} health_grading;								// Total size = 1 + 24 + 1 = 26 bytes
+
+extern health_grading EEMEM health_grading_eeprom;
+health_grading health_grading_override;			// replacement thresholds read from EEPROM
+const uint16_t *volatile health_thresholds;	// thresholds used by health_grade(), from the chemistry profile or the replacement
+
+/* Battery chemistries, order of the chemistry_profiles[] table in "chemistry.c" */
+typedef enum {
+	CHEMISTRY_LI_ION,		// Li-ion cells
+	CHEMISTRY_LIFEPO4,		// LiFePO4 cells
+	CHEMISTRY_LEAD_ACID,	// 2 V lead-acid cells
+	CHEMISTRY_COUNT			// Number of profiles
+} CHEMISTRIES;
+
+/* Everything that depends on the chemistry, the table is kept in flash (PROGMEM) */
+typedef struct {
+	char name[7];								// name shown in the settings menu
+	uint16_t min_battery_mv;					// minimum unloaded cell voltage required for a test
+	uint16_t min_loaded_mv;						// floor for any cell while loaded, enforced by the ADC0 window comparator
+	uint16_t threshold_mv[HEALTH_THRESHOLDS];	// grading thresholds A+ to D- in mV
+	uint16_t default_current_a;					// load current setting when the chemistry is selected
+	uint16_t current_tolerance_ma;				// set_load_current() settles within +/- this of the target
+} chemistry_profile;
+
+extern const chemistry_profile PROGMEM chemistry_profiles[CHEMISTRY_COUNT];
+extern uint8_t EEMEM chemistry_eeprom;
+chemistry_profile chemistry_active_profile;	// SRAM copy of the selected profile
+const chemistry_profile *volatile chemistry_active;	// profile of the selected chemistry, points at chemistry_active_profile
+volatile uint8_t chemistry_selected;	// CHEMISTRIES value of chemistry_active
+
 // Settings global variables
-volatile uint8_t testing_mode;
+volatile uint8_t testing_mode;	// 0x00 -> manual, 0x01 -> automated, 0x02 -> DCIR
 volatile uint16_t current_setting;
 volatile uint8_t current_setting_100_dig;
 volatile uint8_t current_setting_10_dig;
 volatile uint8_t current_setting_1_dig;
-volatile uint8_t voltage_precision;
 
 /* variable to control cancellation of test*/
 volatile uint8_t cancel_test;
 
+/* Balance of one set of cell voltages : 5 bytes */
+typedef struct {
+	uint16_t spread_mv;		// highest - lowest cell voltage in mV
+	uint16_t deviation_mv;	// largest distance of a cell from the pack mean in mV
+	uint8_t low_cell;		// lowest cell, 0 -> B1
+} cell_balance;
+
+/* Running sums of the cell balance, filled one cell at a time while the cells are read */
+typedef struct {
+	uint8_t cells;			// cells added
+	uint32_t sum_mv;		// sum of the cell voltages
+	uint16_t min_mv;		// lowest cell voltage
+	uint16_t max_mv;		// highest cell voltage
+	uint8_t low_cell;		// cell of min_mv
+	uint16_t sag_permille;	// largest drop from the reference voltage x1000
+	uint8_t sag_cell;		// cell of sag_permille
+} cell_balance_accumulator;
+
 typedef struct {
-	float UNLOADED_battery_voltages[4];		// UNLOADED Battery cell voltages : 4 floats = 16 bytes
-	float LOADED_battery_voltages[4];		// LOADED Battery cell voltages : 4 floats = 16 bytes
+	uint16_t UNLOADED_battery_voltages[CELL_COUNT_MAX];	// UNLOADED Battery cell voltages in mV : 2 bytes per cell
+	uint16_t LOADED_battery_voltages[CELL_COUNT_MAX];	// LOADED Battery cell voltages in mV : 2 bytes per cell
+	uint16_t LOADED_load_currents[CELL_COUNT_MAX];		// Load current in amps when each LOADED voltage was sampled : 2 bytes per cell
 	uint16_t max_load_current;				// Max load current used to test battery : 2 bytes
-	uint8_t test_mode;						// 0x00 -> Manual test, 0x01 -> Automated test : 1 byte
-	uint8_t ampient_temp;					// Ambient temperature during test in degrees celcius : 1 bytes
+	uint8_t test_mode;						// 0x00 -> Manual test, 0x01 -> Automated test, 0x02 -> DCIR test : 1 byte
+	int8_t ampient_temp;					// Ambient temperature during test in degrees celcius : 1 bytes
 	uint8_t year, month, day;				// 20xx, 0-12, 0-31 : 3 bytes
-} test_result;								// Total size = 16 + 16 + 2 + 1 + 1 + 3 = 39 bytes
+	uint16_t dcir_uohm[CELL_COUNT_MAX];		// DC internal resistance of each cell in uOhm, 0 -> not measured : 2 bytes per cell
+	uint8_t health_grades[CELL_COUNT_MAX];	// health_rating_lut index of each cell, graded when the test finished : 1 byte per cell
+	uint8_t chemistry;						// CHEMISTRIES value of the profile the test ran with : 1 byte
+	uint8_t cell_count;						// cells in series of the tested pack, the arrays hold cell_count entries : 1 byte
+	cell_balance unloaded_balance;			// balance of the UNLOADED voltages : 5 bytes
+	cell_balance loaded_balance;			// balance of the LOADED voltages : 5 bytes
+	uint16_t sag_permille;					// largest (UNLOADED - LOADED) / UNLOADED of a cell x1000 : 2 bytes
+	uint8_t sag_cell;						// cell with the largest sag, 0 -> B1 : 1 byte
+	uint16_t settle_ms;						// time set_load_current() took to reach the test current : 2 bytes
+	uint16_t overshoot_ma;					// largest excursion past the test current in mA : 2 bytes
+	uint16_t release_ms;					// time open_circuit_load() took to bring the current below LOAD_CURRENT_OFF_MA : 2 bytes
+} test_result;								// Working copy of a test, the history stores it packed by test_history_save()
 
-/* Data log of 13 previous quad-pack tests, stored in MCU's internal EEPROM storage */
-extern test_result EEMEM test_results_history_eeprom[13];	// 507/512 bytes of available EEPROM
+/* Data log of previous tests, as many packed records as fit in the MCU's internal EEPROM storage */
+#define EEPROM_SIZE_BYTES 512
+#define EEPROM_CONFIG_BYTES 96	// settings area reserved in front of the test history
+#define EEPROM_CONFIG_USED (sizeof(calibration) + sizeof(health_grading) + (2 * sizeof(uint8_t)) + sizeof(control_gains) + sizeof(motion_profile))	// 59 + 26 + 1 (chemistry) + 1 (cell count) + 5 + 4 = 96 bytes
+#define TEST_HISTORY_BYTES 399	// 512 - 96 - 17 (position map), checked in "position_map.c"
+#define TEST_RECORD_VERSION 0x01	// layout of a history record, records of another version read as empty
+#define TEST_RECORD_FIXED_BYTES 29	// version 1 + cell count 1 + chemistry 1 + mode 1 + current 2 + temperature 1 + date 3 + balances 10 + sag 3 + settle, overshoot and release 6
+#define TEST_RECORD_CELL_BYTES 9	// UNLOADED 2 + LOADED 2 + current 2 + DCIR 2 + grade 1, for cell_count cells only
+#define TEST_RECORD_BYTES(cells) (TEST_RECORD_FIXED_BYTES + ((cells) * TEST_RECORD_CELL_BYTES))	// 47 bytes at 2S, 65 at 4S, 101 at 8S
+extern uint8_t EEMEM test_history_eeprom[TEST_HISTORY_BYTES];
+volatile uint8_t test_history_entries;	// records of the configured cell count that fit the history, set by test_history_configure()
 volatile test_result current_test_result;	// data from most recent quad-pack test
 
 /* Program states for the local interface fsm*/
@@ -108,7 +671,9 @@ typedef enum {
 	DISCARD_RESULTS_T,			// Confirm that user would like to discard test results without saving
 	SAVE_CURRENT_RESULTS,		// Confirm that user would like to save current test results
 	SCROLL_SAVE_ENTRIES,		// Scroll through quad pack entries to save current test results
-	OVERWRITE_RESULTS			// Confirm that user would like to overwrite previous test results
+	OVERWRITE_RESULTS,			// Confirm that user would like to overwrite previous test results
+	SAG_SUMMARY_T,				// Display min/max of the sag capture, one channel per page
+	CELL_BALANCE_T				// Display spread, deviation and sag of the cells
 }  TEST_FSM_STATES;
 
 /* States for the fsm that views previous results */
@@ -118,6 +683,7 @@ typedef enum {
 	VOLTAGE_READINGS_H,			// Display LOADED (left) voltages and UNLOADED(right) voltages
 	HEALTH_RATINGS_H,			// Display health ratings of battery cells
 	TEST_CONDITIONS_H,			// Display conditions that the quad-pack was tested under
+	CELL_BALANCE_H,				// Display spread, deviation and sag of the cells
 	DISCARD_RESULTS_H,			// Confirm that user would like to discard test results without saving
 }  VIEW_HISTORY_FSM_STATES;
 
@@ -125,7 +691,8 @@ typedef enum {
 typedef enum {
 	SCROLL_SETTINGS,					// Scroll through the settings menu
 	LOAD_CURRENT_SETTINGS_SCREEN,		// Adjust the load current value used for automated tests
-	VOLTAGE_PRECISION_SETTINGS_SCREEN	// Adjust the number of decimal points for voltage measurements
+	ACQUISITION_PROFILE_SETTINGS_SCREEN,	// Select the ADC acquisition profile for voltage measurements
+	BATTERY_SETTINGS_SCREEN				// Select the battery chemistry and the number of cells
 }  SETTINGS_FSM_STATES;
 
 /* Push Button Input Types */
@@ -160,22 +727,194 @@ void clear_lcd (void);	// clears lcd
 
 /* ADC Functions -> File Location: "adc.c" */
 void ADC_init(uint8_t mode);	// Initializes ADC, differential or single-ended
+void ADC_conversion_timer_start(void);	// Starts TCB2 free running to time the conversions
+uint16_t ADC_conversion_time_us(uint16_t start);	// Time since a TCB2 count in us
+void ADC_configure(const adc_config *config);	// Writes only the ADC0 registers that differ from the cached configuration
+uint8_t ADC_configure_registers(const adc_config *config);	// Same without waiting for a new reference, reports whether it changed
+void ADC_profile_config(adc_config *config, uint8_t mode, uint8_t profile);	// Builds the ADC0 configuration of a profile
+void ADC_profile_select(uint8_t mode, uint8_t profile);	// Configures ADC0 for a profile, used by ADC_read()
+uint16_t ADC_profile_vref_mv(uint8_t profile);	// Reference voltage of a profile in mV
+uint16_t ADC_ref_mv(uint8_t ref);	// Voltage of a VREF_REFSEL selection in mV
+int32_t ADC_counts_to_uv(uint16_t result, uint8_t mode, uint16_t vref_mv, uint8_t shift);	// Raw accumulated result -> uV at the ADC pins
+uint16_t ADC_uv_to_cell_mv(int32_t uv, uint8_t channel);	// ADC pin uV -> battery mV, calibrated offset and divider ratio undone
 void ADC_startConversion(void);	// Starts a conversion by the ADC
 void ADC_stopConversion(void);	// Stops a conversion by the ADC
 uint8_t ADC_isConversionDone(void);	// Checks if ADC conversion is finished
 void ADC_channelSEL(uint8_t AIN_POS, uint8_t AIN_NEG);	// Selects ADC channel 
-float ADC_read(void);	// Returns result from ADC
-float batteryCell_read(uint8_t BAT_POS, uint8_t BAT_NEG); // reads voltage across 2 battery terminals
+uint16_t ADC_read_raw(void);	// Returns the raw result register from one conversion
+int32_t ADC_read(void);	// Returns result from ADC in uV
+uint8_t ADC_settle_compare(uint16_t result, uint16_t previous, uint8_t mode);	// Checks two settling conversions against the agreement band
+void ADC_wait_settled(uint8_t channel);	// Waits for the selected input to settle, fixed delay or adaptive
+uint16_t batteryCell_read(uint8_t BAT_POS, uint8_t BAT_NEG); // reads voltage across 2 battery terminals in mV
 void read_UNLOADED_battery_voltages(void);	// reads 4 battery cells and stores in UNLOADED voltages array
 void read_LOADED_battery_voltages(void);	// reads 4 battery cells and stores in LOADED voltages array
-float load_current_Read(void);
+int32_t load_current_Read(uint8_t profile);	// reads load current in mA with an acquisition profile
+int32_t load_current_convert(int32_t adc_uv, uint8_t range);	// OPAMP output uV -> load current in mA
+void ADC_stats_reset(void);	// Empties the noise statistics of every channel
+void ADC_stats_add(uint8_t channel, int32_t value);	// Adds one unloaded reading to the statistics of its channel
+void ADC_stats_sweep(void);	// Adds the latest background sweep to the statistics
+
+/* Current Range Functions -> File Location: "current_range.c" */
+void current_range_init(void);	// Configures the OPAMP 2 ladder, if the board has it, and the range thresholds
+int32_t current_range_offset_uv(uint8_t range);	// Nominal no-load output of a range
+uint8_t current_range_apply(void);	// Ladder tap of the active range for a current conversion
+uint8_t current_range_update(uint16_t counts);	// Picks the next range from a result, with hysteresis
+int32_t current_range_voltage(uint16_t result, uint8_t profile);	// Raw result -> OPAMP output uV
+uint32_t current_range_resolution(uint8_t range);	// uA per LSB of a range
+
+/* Calibration Functions -> File Location: "calibration.c" */
+uint8_t calibration_checksum(const calibration *table);	// Checksum of a calibration table
+void calibration_defaults(void);	// Nominal design values into the working table
+uint8_t calibration_load(void);	// EEPROM table into the working table, defaults if invalid
+void calibration_save(void);	// Working table into EEPROM
+uint8_t calibration_auto_zero(uint8_t force);	// Measures the no-load amplifier output of every current range
+void calibration_remote_command(void);	// Calibration commands of the remote interface
+void send_calibration(void);	// Sends the working table to the PC
+void send_calibration_measurement(void);	// Sends the ADC pin voltages of the cell channels to the PC
+
+/* DCIR Functions -> File Location: "dcir.c" */
+void dcir_fit_reset(void);	// Empties the least-squares sums of all cells
+void dcir_fit_add(uint8_t cell, int32_t current_ma, uint16_t voltage_mv);	// Adds one point of a cell to its sums
+uint16_t dcir_fit_resistance(uint8_t cell);	// Internal resistance of a cell in uOhm from the points so far
+
+/* Health Grading Functions -> File Location: "health_grading.c" */
+uint8_t health_grading_checksum(const health_grading *table);	// Checksum of a grading table
+uint8_t health_grading_is_ordered(const health_grading *table);	// Checks that the thresholds fall strictly
+void health_grading_load(void);	// Replacement thresholds from EEPROM, dropped if invalid
+void health_grading_select(void);	// Points health_grade() at the thresholds of the active chemistry
+void health_grading_defaults(void);	// Drops the replacement thresholds
+void health_grading_save(void);	// Replacement thresholds into EEPROM
+uint8_t health_grade(uint16_t voltage_mv);	// Grade of a loaded cell voltage, binary search
+void health_grade_result(volatile test_result *result);	// Grades the cells of a finished test into the record
+void health_grading_remote_command(void);	// Grading commands of the remote interface
+void send_health_grading(void);	// Sends the active thresholds to the PC
+
+/* Chemistry Profile Functions -> File Location: "chemistry.c" */
+void chemistry_load(void);	// Selects the chemistry stored in EEPROM and takes its defaults
+void chemistry_select(uint8_t chemistry);	// Makes a profile the active one, copied out of flash
+void chemistry_profile_read(uint8_t chemistry, chemistry_profile *profile);	// Copies a profile out of flash
+void chemistry_save(void);	// Stores the selected chemistry in EEPROM
+void chemistry_apply_defaults(void);	// Load current setting of the active chemistry
+
+/* Cell Map Functions -> File Location: "cell_map.c" */
+void cell_map_load(void);	// Cell count stored in EEPROM, quad pack if none
+void cell_map_configure(uint8_t count);	// Channel list and sequences for a number of cells
+void cell_map_save(void);	// Stores the cell count in EEPROM
+uint8_t cell_count_checked(uint8_t count);	// Cell count of a record, quad pack if out of range
+void cell_map_remote_command(void);	// Sets and reports the cell count for the remote interface
+
+/* Test History Functions -> File Location: "test_history.c" */
+void test_history_configure(void);	// Number of records of the configured cell count that fit the history
+void test_history_save(uint8_t entry);	// Packs current_test_result into a history entry
+void test_history_load(uint8_t entry);	// Reads a history entry into current_test_result, empty if it does not match
+
+/* Cell Balance Functions -> File Location: "cell_balance.c" */
+void cell_balance_reset(cell_balance_accumulator *balance);	// Empties the running sums
+void cell_balance_add(cell_balance_accumulator *balance, uint8_t cell, uint16_t voltage_mv, uint16_t reference_mv);	// Adds one cell as it is read
+void cell_balance_store(const cell_balance_accumulator *balance, cell_balance *result);	// Spread, deviation and lowest cell into a record
+void display_cell_balance(test_result result);	// Balance page of the test results
+
+/* ADC Scan Sequencer Functions -> File Location: "adc_scan.c" */
+void ADC_scan_start(void);	// (Re)starts the background scan on the default sequence
+void ADC_scan_start_sequence(const uint8_t *sequence, uint8_t length, uint8_t profile, uint16_t period_us);	// (Re)starts the scan on a sequence of channels
+void ADC_scan_stop(void);	// Stops the background scan and releases ADC0
+void ADC_scan_select(uint8_t channel);	// Points ADC0 at one entry of the scan channel list
+void ADC_scan_configure(const adc_config *config);	// Applies a configuration from the scan ISR without waiting for the reference
+void ADC_scan_arm_settling(adc_config *config);	// Settling of a newly selected channel, free running mode only
+uint8_t ADC_scan_lookup(uint8_t AIN_POS, uint8_t AIN_NEG);	// Finds the scan channel for a MUX pair
+void ADC_scan_service(void);	// Stores a finished conversion and advances the sequence, called from the RESRDY ISR
+void ADC_scan_acquire(void);	// Restarts the default scan and waits until one complete, fresh sweep is published
+void ADC_scan_acquire_sequence(const uint8_t *sequence, uint8_t length, uint8_t profile);	// Same for any sequence and profile
+int32_t ADC_scan_voltage(uint8_t slot);	// Latest uV at the ADC pins for a sequence slot
+int32_t ADC_scan_convert(uint16_t result, uint8_t channel, uint8_t profile);	// Raw result -> uV at the ADC pins
+uint16_t ADC_scan_cell_voltage(uint8_t slot);	// Latest battery mV for a sequence slot, divider ratio undone
+int32_t ADC_scan_load_current(uint8_t slot);	// Latest load current for a sequence slot in mA
+uint32_t ADC_scan_time(uint8_t slot);	// Timebase count when a sequence slot was converted
+void ADC_scan_copy(uint16_t *results, uint32_t *times, uint8_t *ranges);	// Copies all slots of the latest sweep in one piece
+void ADC_scan_wait_sweep(void);	// Waits until the next sweep is published or the scan stops
+void ADC_scan_begin_conversion(void);	// Starts the next conversion of the active slot
+void ADC_scan_poll_ms(uint16_t ms);	// Delay that keeps the scan running while interrupts are disabled
+void ADC_scan_poll_us(uint16_t us);	// Same for short delays
+int32_t ADC_scan_latest_current(void);	// Load current in mA of the last current slot of the active sequence
+
+/* ADC Timed Acquisition Functions -> File Location: "adc_timed.c" */
+void ADC_timed_start(uint16_t period_us);	// TCB0 -> EVSYS -> ADC0 start of conversion every period
+void ADC_timed_stop(void);	// Back to software started conversions
+void ADC_timed_record(void);	// Measures the interval of a timed result for the jitter report
+void ADC_timed_discard(void);	// Counts a timed conversion that was thrown away, the next interval starts after it
+
+/* Pack Presence Functions -> File Location: "pack_presence.c" */
+void pack_presence_init(void);	// AC0 on the cell 3 tap, interrupt on both edges
+void pack_presence_edge(void);	// Records a comparator edge
+uint8_t pack_presence_update(void);	// Debounces the comparator state
+uint8_t pack_presence_is_valid(void);	// Checks whether pack_present replaces the ADC probe
+
+/* Temperature Functions -> File Location: "temperature.c" */
+void temperature_apply(adc_config *config);	// Mode and sampling time of a temperature sensor conversion
+int16_t temperature_convert(uint16_t result, uint8_t profile);	// Raw sensor result -> 0.1 C
+int16_t temperature_ambient(void);	// Cached ambient temperature in 0.1 C
+int8_t temperature_record(int16_t temperature_dc);	// Whole degrees for the test record
+
+/* Streaming Statistics Functions -> File Location: "stream_stats.c" */
+void stream_stats_reset(stream_stats *stats);	// Empties an accumulator
+void stream_stats_add(stream_stats *stats, int32_t value);	// Welford update with one sample
+int32_t stream_stats_mean(const stream_stats *stats);	// Mean rounded to the units of the samples
+uint32_t stream_stats_deviation(const stream_stats *stats);	// Sample standard deviation
+uint32_t stream_stats_sqrt(uint64_t value);	// Integer square root
+
+/* ADC Measurement Cache Functions -> File Location: "adc_cache.c" */
+void ADC_cache_sweep(void);	// Copies a published default sweep into the cache
+uint8_t ADC_cache_is_fresh(uint8_t channel);	// Checks a cache entry against the freshness window
+void ADC_cache_acquire(void);	// Reuses fresh readings or acquires a new sweep
+int32_t ADC_cache_voltage(uint8_t channel);	// Cached uV at the ADC pins
+uint16_t ADC_cache_cell_voltage(uint8_t channel);	// Cached battery mV, divider ratio undone
+int32_t ADC_cache_load_current(void);	// Cached load current in mA
+
+/* ADC Undervoltage Monitor Functions -> File Location: "adc_monitor.c" */
+void ADC_monitor_start(void);	// Starts the monitor sequence with the window comparator armed on the cells
+void ADC_monitor_stop(void);	// Disarms the window comparator
+void ADC_monitor_window(uint8_t channel);	// Arms or disarms the window comparator for the next conversion
+void ADC_monitor_trip(void);	// Records the tripped cell and stops the scan and the knob
+int32_t ADC_monitor_current(void);	// Waits for the next monitor sweep and returns the load current in mA
+
+/* Sag Capture Functions -> File Location: "sag_capture.c" */
+void sag_capture_start(void);	// Empties the ring buffer and starts recording
+void sag_capture_stop(void);	// Stops recording
+void sag_capture_sweep(void);	// Records a sample from a published sweep, called by the scan sequencer
+void send_sag_capture(void);	// Queues the ring buffer for the PC, called from the USART3 ISR
+void sag_capture_export(void);	// Sends the next chunk of a queued capture, called from the main loop
+void display_sag_summary(void);	// Min/max of one captured channel on the LCD
+void scroll_sag_summary(PB_INPUT_TYPE pb_type);	// Pushbutton handling of the sag summary page
+
+/* Load Current Controller Functions -> File Location: "current_control.c" */
+uint8_t control_gains_checksum(const control_gains *gains);	// Checksum of a set of gains
+void control_gains_defaults(void);	// Default gains into the working gains
+void control_gains_load(void);	// EEPROM gains into the working gains, defaults if invalid
+void control_gains_save(void);	// Working gains into EEPROM
+int32_t control_step_rate(control_state *state, int32_t error_ma, uint16_t period_us, int32_t rate_max);	// PI iteration, step rate in steps/s
+int32_t control_rate_limit(uint32_t sweep_us, uint16_t run);	// Fastest rate the loop can reach: monitor sweep and ramp of the profile
+uint16_t control_step_period(int32_t rate);	// Step rate -> step period in us
+int32_t control_plant_current(int16_t position);	// Steady current of the simulated plant
+void control_simulate(void);	// Fixed rate loop vs PI controller on the simulated plant
+void control_remote_command(void);	// Controller commands of the remote interface
+void send_control_results(void);	// Sends the gains and the log of the last set_load_current()
+void send_control_simulation(void);	// Sends the result of control_simulate()
+
+/* Control Loop Benchmark Functions -> File Location: "control_benchmark.c" */
+uint8_t benchmark_float_iteration(uint16_t result, float target_current_amps);	// Float reference of one control loop iteration
+uint8_t benchmark_fixed_iteration(uint16_t result, int32_t target_current_ma);	// Fixed-point control loop iteration
+void benchmark_control_loop(void);	// Cycles per iteration, float vs fixed-point
+
+/* Timebase Functions -> File Location: "timebase.c" */
+void timebase_init(void);	// Starts the RTC as a free running timebase
+void timebase_service(void);	// Counts a pending RTC overflow
+uint32_t timebase_ticks(void);	// Returns the 32-bit timebase count
 
 /* Stepper motor Functions -> File Location: "stepper_motor.c" */
 void A4988_init(void); //initializes the pins needed to communicate with the A4988
-void A4988_step(void); //Triggers a rising edge pulse to step the A4988
 void A4988_dir_HIGH(void); //Set the A4988 DIR pin to HIGH
 void A4988_dir_LOW(void); //Set the A4988 DIR pin to LOW
-void set_load_current(float target_current_amps); //adjusts the stepper motor to obtain the desired current
+void set_load_current(int32_t target_current_ma); //adjusts the stepper motor to obtain the desired current
 void open_circuit_load(void); //Creates an open circuit for a load of 0 A
 
 /* Local Interface Functions -> File Location: "local_interface.c" */
@@ -208,7 +947,10 @@ void display_settings_menu(void);
 void settings_menu_OK(void);
 void display_load_current_setting(void);
 void adjust_load_current_settings(PB_INPUT_TYPE pb_type);
-void adjust_voltage_precision_settings(PB_INPUT_TYPE pb_type);
+void adjust_acquisition_profile_settings(PB_INPUT_TYPE pb_type);
+void display_acquisition_profiles(void);
+void adjust_battery_settings(PB_INPUT_TYPE pb_type);
+void display_battery_settings(void);
 
 /* Test FSM Functions -> File Location: "test_fsm.c" */
 void test_fsm(void);
@@ -218,12 +960,15 @@ void overwrite_previous_results(PB_INPUT_TYPE pb_type);
 void perform_test(void);
 void automated_test(void);
 void manual_test(void);
+void dcir_test(void);
+void display_undervoltage_trip(void);
 void display_result_data(test_result result_data);
 void display_test_conditions(test_result result);
 void display_voltage_readings(test_result result);
 void decode_health_rating(test_result result);
 void display_health_ratings(test_result result);
 void display_result_menu(void);
+void scroll_cell_page(PB_INPUT_TYPE pb_type, test_result result);
 
 /* Error handling functions -> File Location: "error.c "*/
 void test_error_check(void);
@@ -234,6 +979,19 @@ void display_safety_error(void);
 /* Remote Interface Functions -> File Location: "remote_interface.c" */
 void USART3_setup(void);
 void USART3_transmit_character(char transmit_char);
+void USART3_transmit_string(const char *transmit_string);
+char USART3_receive_character(void);
+uint32_t USART3_receive_number(uint8_t digits);
+uint8_t USART3_receive_digits(uint8_t digits, uint32_t *number);
+void send_adc_config_stats(void);
+void send_adc_settle_stats(void);
+void send_monitor_trip(void);
+void send_adc_cache_stats(void);
+void send_adc_stream_stats(void);
+void send_adc_timed_stats(void);
+void send_current_range_stats(void);
+void send_benchmark_results(void);
+void send_dcir_results(void);
 void send_results_pc();
 void send_unloaded_voltages();
 char test_unloaded_remote();
@@ -244,7 +1002,34 @@ void read_EEPROM(uint8_t quad_pack_num);
 /* PWM Functions -> File Location: "pwm.c" */
 void PWM_init(void);
 void set_PWM(uint8_t duty);
-void A4988_STEP_PWM_enable(void);
+void A4988_STEP_PWM_enable(uint16_t period_us);
 void A4988_STEP_PWM_disable(void);
 
+/* Motion Functions -> File Location: "motion.c" */
+uint8_t motion_move(uint16_t steps, uint16_t rate_sps, uint8_t direction, motion_callback done); //starts a move of steps at rate_sps in hardware
+uint8_t motion_move_profiled(uint16_t steps, uint8_t direction, motion_callback done); //starts a move of steps with the trapezoidal profile
+uint16_t motion_ramp_period(uint16_t step); //interval of a step of the ramp from standstill
+void motion_profile_load(void); //reads the motion profile from EEPROM
+void motion_profile_defaults(void); //loads the default motion profile
+void motion_profile_save(void); //writes the motion profile to EEPROM
+void motion_profile_build(void); //precomputes the step interval table of the profile
+void motion_position_reference(void); //the knob is at the reference position
+
+/* Position Map Functions -> File Location: "position_map.c" */
+void position_map_load(void); //reads the learned position map from EEPROM
+void position_map_save(void); //writes the learned position map to EEPROM
+void position_map_clear(void); //forgets every learned bin
+uint16_t position_map_pack_mv(void); //unloaded pack voltage the map is used with, 0 if not known
+int32_t position_map_conductance(int32_t current_ma, uint16_t pack_mv); //conductance of a load current from a pack
+uint8_t position_map_segment(int32_t conductance_ms, position_map_point *low, position_map_point *high); //learned points around a conductance
+int16_t position_map_predict(int32_t current_ma, uint16_t pack_mv); //predicted position of a load current from a pack
+void position_map_learn(int16_t position, int32_t current_ma, uint16_t pack_mv); //adapts the map to a settled position
+void send_position_map(void); //sends the position and the learned map to the PC
+void motion_start(uint16_t steps, uint16_t period, uint8_t direction, motion_callback done); //sets the direction and starts TCA1 on the first step
+void motion_stop(void); //aborts the current move
+void motion_service(void); //counts one completed step, arms the end of the move at its count
+void motion_end(void); //ends a move at TOP of its last step
+void motion_poll(void); //services the step count when global interrupts are disabled
+void motion_wait(void); //waits for the current move to complete
+
 #endif /* MAIN_H_ */
\ No newline at end of file
@@ -107,9 +107,9 @@ void move_cursor_up(void)
 		if (cursor != 1)
 			cursor--;
 	
-		// Only 13 quad pack entries, entry rolls around to 13 if user scrolls up beyond 1
+		// Only test_history_entries quad pack entries, entry rolls around to the last if user scrolls up beyond 1
 		if (quad_pack_entry == 0)	// row index for 2D array, 0 is index for 1st row
-			quad_pack_entry = 12;	// row index for 2D array, 12 is index for 13th row
+			quad_pack_entry = test_history_entries - 1;	// row index for 2D array, index of the last row
 		else
 			quad_pack_entry--;		
 	}
@@ -153,8 +153,8 @@ void move_cursor_down(void)
 		if (cursor != 4)
 			cursor++;
 	
-		// Only 13 quad pack entries, entry rolls around to 1 if user scrolls down beyond 13
-		if (quad_pack_entry == 12)	// row index for 2D array, 12 is index for 13th row
+		// Only test_history_entries quad pack entries, entry rolls around to 1 if user scrolls down beyond the last
+		if (quad_pack_entry == test_history_entries - 1)	// row index for 2D array, index of the last row
 			quad_pack_entry = 0;	// row index for 2D array, 0 is index for 1st row
 		else
 			quad_pack_entry++;		
@@ -172,7 +172,8 @@ void move_cursor_down(void)
 // Function Name : "display_main_menu"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// This function displays the main menu screen
+// This function displays the main menu screen, with the pack connection
+//	status of the presence comparator on the last line
 //
 // Inputs : none
 //
@@ -188,6 +189,14 @@ void display_main_menu(void)
 	sprintf(dsp_buff[1], "View History        ");
 	sprintf(dsp_buff[2], "Settings            ");
 	
+	/* Connection status from the comparator, no ADC read */
+	if (cell_count < PACK_PRESENCE_TAP)
+		sprintf(dsp_buff[3], "Pack: --            ");
+	else if (pack_present == 0x01)
+		sprintf(dsp_buff[3], "Pack: connected     ");
+	else
+		sprintf(dsp_buff[3], "Pack: not connected ");
+	
 	dsp_buff[cursor - 1][18] = '<'; //add pointing arrow at end of current line
 	dsp_buff[cursor - 1][19] = '-';
 		
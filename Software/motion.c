@@ -0,0 +1,465 @@
+#include "main.h"
+
+motion_profile EEMEM motion_profile_eeprom;	// trapezoidal profile of large moves, in the EEPROM settings area
+
+//***************************************************************************
+//
+// Function Name : "motion_start"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sets the direction, wakes the driver up and starts TCA1 on the first
+//	step of a move.
+//
+// Inputs :
+//		uint16_t steps: number of steps to take
+//		uint16_t period: interval of the first step in TCA1 counts
+//		uint8_t direction: MOTION_CLOCKWISE or MOTION_COUNTER_CLOCKWISE
+//		motion_callback done: called when the last step completed, 0 -> none
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_start(uint16_t steps, uint16_t period, uint8_t direction, motion_callback done)
+{
+	if (direction == MOTION_CLOCKWISE)
+		A4988_dir_HIGH();
+	else
+		A4988_dir_LOW();
+	PORTC.OUT |= PIN6_bm;	// Wake up Stepper motor
+
+	motion_direction = direction;
+	motion_steps_done = 0;
+	motion_done_callback = done;
+	if (steps == 0)
+	{
+		if (done != 0)
+			done();
+		return;
+	}
+
+	motion_steps_remaining = steps;
+	motion_active = 0x01;
+	A4988_STEP_PWM_enable(period);
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_move"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts a move of the knob at a fixed rate: TCA1 generates the STEP
+//	pulses at rate_sps and the compare interrupt counts them, the move stops by itself at
+//	the end of the period of the last of steps pulses and calls done from the ISR. The CPU is free meanwhile,
+//	motion_wait() blocks until the move is complete. The DIR pin is set
+//	and the driver woken up before the first step, the caller puts it back
+//	to sleep. A move of 0 steps completes immediately.
+//
+// Inputs :
+//		uint16_t steps: number of steps to take
+//		uint16_t rate_sps: step rate in steps/s, MOTION_RATE_MIN_SPS..MOTION_RATE_MAX_SPS
+//		uint8_t direction: MOTION_CLOCKWISE or MOTION_COUNTER_CLOCKWISE
+//		motion_callback done: called when the last step completed, 0 -> none
+//
+// Outputs :
+//		uint8_t started: 0x01 -> move started, 0x00 -> a move is still running
+//
+//**************************************************************************
+uint8_t motion_move(uint16_t steps, uint16_t rate_sps, uint8_t direction, motion_callback done)
+{
+	if (motion_active == 0x01)
+		return 0x00;
+
+	if (rate_sps < MOTION_RATE_MIN_SPS)
+		rate_sps = MOTION_RATE_MIN_SPS;
+	else if (rate_sps > MOTION_RATE_MAX_SPS)
+		rate_sps = MOTION_RATE_MAX_SPS;
+
+	motion_profiled = 0x00;
+	motion_start(steps, MOTION_TIMER_HZ / rate_sps, direction, done);
+	return 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_move_profiled"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts a move of the knob with the trapezoidal profile: the steps
+//	accelerate from standstill along the ramp table, cruise at the maximum
+//	rate of the profile and decelerate along the same table to standstill.
+//	A move too short to reach the cruise rate turns around half way. The
+//	compare ISR only looks up the interval of the next step. Otherwise the
+//	same as motion_move().
+//
+// Inputs :
+//		uint16_t steps: number of steps to take
+//		uint8_t direction: MOTION_CLOCKWISE or MOTION_COUNTER_CLOCKWISE
+//		motion_callback done: called when the last step completed, 0 -> none
+//
+// Outputs :
+//		uint8_t started: 0x01 -> move started, 0x00 -> a move is still running
+//
+//**************************************************************************
+uint8_t motion_move_profiled(uint16_t steps, uint8_t direction, motion_callback done)
+{
+	if (motion_active == 0x01)
+		return 0x00;
+
+	motion_profiled = 0x01;
+	motion_start(steps, motion_ramp_table[0], direction, done);
+	return 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_stop"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Aborts the current move without calling its completion callback. A
+//	fixed rate move stops after the step in progress, a profiled move
+//	decelerates along the ramp table first so no step is lost.
+//	motion_steps_done holds the steps taken.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_stop(void)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+
+	/* A falling edge not serviced yet */
+	if (TCA1.SINGLE.INTFLAGS & TCA_SINGLE_CMP0_bm)
+		motion_service();
+
+	/* With no step left the move ends at TOP by itself */
+	if ((motion_active == 0x01) && (motion_steps_remaining != 0))
+	{
+		/* Ramp down from the interval of the next step */
+		if (motion_profiled == 0x01)
+		{
+			uint16_t ramp_step = motion_steps_remaining - 1;
+			if (motion_steps_done < ramp_step)
+				ramp_step = motion_steps_done;
+			motion_steps_remaining = ramp_step + 1;
+		}
+		/* Let a step that is high finish, the end of its period ends the move */
+		else if (TCA1.SINGLE.CNT < TCA1.SINGLE.CMP0)
+			motion_steps_remaining = 1;
+		else
+		{
+			A4988_STEP_PWM_disable();
+			motion_active = 0x00;
+		}
+	}
+	motion_done_callback = 0;
+	SREG = sreg;
+	motion_wait();
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_service"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Counts the step whose falling edge just passed and moves the absolute
+//	position of the knob by one step. After the last step of the move the
+//	pin is held low for the rest of its period (CMP0 = BOTTOM from the next
+//	update) and the overflow interrupt is armed, motion_end() ends the move
+//	at TOP. So a move started right after one that ended, a single step of
+//	set_load_current() included, never steps faster than its rate. In a
+//	profiled move the interval of the next step is looked up in the ramp
+//	table, by its distance from the nearer end of the move, and buffered
+//	for the next period.
+//	Called from the TCA1 compare ISR, or by motion_poll() when global
+//	interrupts are disabled.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_service(void)
+{
+	TCA1.SINGLE.INTFLAGS = TCA_SINGLE_CMP0_bm;
+	if ((motion_active == 0x00) || (motion_steps_remaining == 0))
+		return;
+
+	motion_steps_done++;
+	motion_position += (motion_direction == MOTION_CLOCKWISE) ? 1 : -1;
+	if (--motion_steps_remaining == 0)
+	{
+		TCA1.SINGLE.CMP0BUF = 0;	// no rising edge at TOP
+		TCA1.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+		TCA1.SINGLE.INTCTRL = (TCA_SINGLE_CMP0_bm | TCA_SINGLE_OVF_bm);
+	}
+	else if (motion_profiled == 0x01)
+	{
+		uint16_t ramp_step = motion_steps_remaining - 1;
+		if (motion_steps_done < ramp_step)
+			ramp_step = motion_steps_done;
+		uint16_t period = motion_ramp_period(ramp_step);
+
+		TCA1.SINGLE.PERBUF = period - 1;
+		TCA1.SINGLE.CMP0BUF = period / 2;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_end"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Ends a move at TOP of the period of its last step: stops TCA1, disarms
+//	the overflow interrupt and calls the completion callback. Called from
+//	the TCA1 overflow ISR, or by motion_poll() when global interrupts are
+//	disabled.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_end(void)
+{
+	TCA1.SINGLE.INTCTRL = TCA_SINGLE_CMP0_bm;
+	A4988_STEP_PWM_disable();
+	if (motion_active == 0x00)
+		return;
+
+	motion_active = 0x00;
+	if (motion_done_callback != 0)
+		motion_done_callback();
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_poll"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// The FSMs run inside pushbutton and USART interrupts with global
+//	interrupts disabled, the compare and overflow flags are polled here
+//	instead, the overflow first since it ends a move. It must
+//	be polled within half a step period, the waits of the scan sequencer
+//	call it on every pass.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_poll(void)
+{
+	if ((SREG & CPU_I_bm) || (motion_active == 0x00))
+		return;
+	if ((motion_steps_remaining == 0) && (TCA1.SINGLE.INTFLAGS & TCA_SINGLE_OVF_bm))
+		motion_end();
+	else if (TCA1.SINGLE.INTFLAGS & TCA_SINGLE_CMP0_bm)
+		motion_service();
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_wait"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Waits until the current move is complete, the scan sequencer keeps
+//	running meanwhile.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_wait(void)
+{
+	while (motion_active == 0x01)
+	{
+		motion_poll();
+		if (!(SREG & CPU_I_bm) && (adc_scan_running == 0x01) && ADC_isConversionDone())
+			ADC_scan_service();
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_position_reference"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Makes the present position of the knob the reference of the absolute
+//	position, called by open_circuit_load() when the current falls below
+//	LOAD_CURRENT_OFF_MA. Steps still coming in a move that is running count
+//	from here.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_position_reference(void)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	motion_position = 0;
+	motion_position_valid = 0x01;
+	SREG = sreg;
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_ramp_period"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the interval of a step of the ramp from standstill, the cruise
+//	interval past the end of the table.
+//
+// Inputs :
+//		uint16_t step: steps taken since standstill
+//
+// Outputs :
+//		uint16_t period: step interval in TCA1 counts
+//
+//**************************************************************************
+uint16_t motion_ramp_period(uint16_t step)
+{
+	if (step >= motion_ramp_length)
+		step = motion_ramp_length - 1;
+	return motion_ramp_table[step];
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_profile_build"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Precomputes the step interval table of the active profile. Under
+//	constant acceleration a the n-th step from standstill ends at
+//	t = sqrt(2n/a), each interval is the difference of two of these times.
+//	The table ends with the first interval at or below the cruise rate, or
+//	after MOTION_RAMP_STEPS_MAX steps if the acceleration is too low to
+//	reach it, the last interval is then the fastest of the move.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_profile_build(void)
+{
+	uint16_t cruise = MOTION_TIMER_HZ / motion_profile_active.max_rate_sps;
+	uint32_t previous = 0;
+
+	motion_ramp_length = MOTION_RAMP_STEPS_MAX;
+	for (uint8_t step = 0; step < MOTION_RAMP_STEPS_MAX; step++)
+	{
+		uint32_t time = stream_stats_sqrt(((uint64_t)2 * (step + 1) * MOTION_TIMER_HZ * MOTION_TIMER_HZ) / motion_profile_active.accel_sps2);
+		uint32_t interval = time - previous;
+		previous = time;
+
+		if (interval <= cruise)
+		{
+			motion_ramp_table[step] = cruise;
+			motion_ramp_length = step + 1;
+			break;
+		}
+		motion_ramp_table[step] = interval;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_profile_defaults"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Loads the default profile and builds its table.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_profile_defaults(void)
+{
+	motion_profile_active.max_rate_sps = MOTION_DEFAULT_MAX_RATE_SPS;
+	motion_profile_active.accel_sps2 = MOTION_DEFAULT_ACCEL_SPS2;
+	motion_profile_build();
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_profile_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Reads the motion profile from EEPROM and builds its table, the default
+//	profile if none was stored (erased cells read out of range).
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_profile_load(void)
+{
+	eeprom_read_block(&motion_profile_active, &motion_profile_eeprom, sizeof(motion_profile));
+	if ((motion_profile_active.max_rate_sps < MOTION_PROFILE_RATE_MIN_SPS) || (motion_profile_active.max_rate_sps > MOTION_RATE_MAX_SPS)
+		|| (motion_profile_active.accel_sps2 < MOTION_PROFILE_ACCEL_MIN_SPS2) || (motion_profile_active.accel_sps2 > MOTION_PROFILE_ACCEL_MAX_SPS2))
+		motion_profile_defaults();
+	else
+		motion_profile_build();
+}
+
+//***************************************************************************
+//
+// Function Name : "motion_profile_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Writes the motion profile to EEPROM, only bytes that changed are
+//	written.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void motion_profile_save(void)
+{
+	eeprom_update_block(&motion_profile_active, &motion_profile_eeprom, sizeof(motion_profile));
+}
+
+//***************************************************************************
+//
+// Function Name : "ISR(TCA1_CMP0_vect)"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Falling edge of a STEP pulse generated by TCA1.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+ISR(TCA1_CMP0_vect)
+{
+	motion_service();
+}
+
+//***************************************************************************
+//
+// Function Name : "ISR(TCA1_OVF_vect)"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// End of the period of the last step of a move.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+ISR(TCA1_OVF_vect)
+{
+	motion_end();
+}
@@ -0,0 +1,129 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "ISR(AC0_AC_vect)"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Analog comparator 0 interrupt, raised on both edges when a pack is
+//	plugged in or removed. Records the edge, the debounced state follows
+//	in pack_presence_update().
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+ISR(AC0_AC_vect)
+{
+	pack_presence_edge();
+}
+
+//***************************************************************************
+//
+// Function Name : "pack_presence_init"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Configures AC0 to compare the tap of cell PACK_PRESENCE_TAP against the
+//	DACREF threshold with large hysteresis, and enables the interrupt on
+//	both edges. The state at power up is taken as debounced.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void pack_presence_init(void)
+{
+	PORTD.PIN2CTRL = PORT_ISC_INPUT_DISABLE_gc;	// analog input, shared with the ADC
+	VREF.ACREF = VREF_REFSEL_1V024_gc;
+	AC0.DACREF = PACK_PRESENCE_DACREF;
+	AC0.MUXCTRL = (PACK_PRESENCE_AC_MUXPOS | AC_MUXNEG_DACREF_gc);
+	AC0.CTRLA = (AC_HYSMODE_LARGE_gc | AC_ENABLE_bm);
+	_delay_us(PACK_PRESENCE_SETTLE_US);
+
+	pack_presence_raw = (AC0.STATUS & AC_CMPSTATE_bm) ? 0x01 : 0x00;
+	pack_present = pack_presence_raw;
+	pack_presence_edge_ticks = timebase_ticks();
+	pack_presence_events = 0;
+
+	AC0.STATUS = AC_CMPIF_bm;	// clear the flag of the enable
+	AC0.INTCTRL = (AC_INTMODE_NORMAL_BOTHEDGE_gc | AC_CMP_bm);
+}
+
+//***************************************************************************
+//
+// Function Name : "pack_presence_edge"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Stores the comparator state and the time of an edge. Called from the
+//	AC0 ISR, or polled when interrupts are disabled.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void pack_presence_edge(void)
+{
+	AC0.STATUS = AC_CMPIF_bm;
+	pack_presence_raw = (AC0.STATUS & AC_CMPSTATE_bm) ? 0x01 : 0x00;
+	pack_presence_edge_ticks = timebase_ticks();
+}
+
+//***************************************************************************
+//
+// Function Name : "pack_presence_update"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Debounces the comparator: a new state is accepted once no edge was
+//	seen for PACK_PRESENCE_DEBOUNCE_MS. Called from the main loop, so the
+//	main menu shows an insertion or removal as soon as it is accepted.
+//
+// Inputs : None
+//
+// Outputs :
+//		uint8_t changed: 0x01 -> pack_present changed
+//
+//**************************************************************************
+uint8_t pack_presence_update(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	if (AC0.STATUS & AC_CMPIF_bm)
+		pack_presence_edge();	// edge while interrupts were disabled
+	uint8_t raw = pack_presence_raw;
+	uint32_t age = timebase_ticks() - pack_presence_edge_ticks;
+	SREG = sreg;
+
+	if ((raw == pack_present) || (age < (((uint32_t)PACK_PRESENCE_DEBOUNCE_MS * TIMEBASE_HZ) / 1000)))
+		return 0x00;
+
+	pack_present = raw;
+	pack_presence_events++;
+	return 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "pack_presence_is_valid"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Checks whether pack_present can replace the ADC connection probe: the
+//	comparator input must be one of the taps of the selected pack and the
+//	state must have settled. Smaller packs and a state still bouncing are
+//	left to the probe.
+//
+// Inputs : None
+//
+// Outputs :
+//		uint8_t valid: 0x01 -> use pack_present, 0x00 -> probe with the ADC
+//
+//**************************************************************************
+uint8_t pack_presence_is_valid(void)
+{
+	pack_presence_update();
+	if (cell_count < PACK_PRESENCE_TAP)
+		return 0x00;
+	return (pack_presence_raw == pack_present);
+}
@@ -0,0 +1,281 @@
+#include "main.h"
+
+position_map EEMEM position_map_eeprom;	// learned knob positions, in the EEPROM left behind the test history
+
+/* The map must fit the EEPROM behind the settings and the test history, which are sized by hand in main.h */
+typedef char position_map_size[(sizeof(position_map) == (1 + (POSITION_MAP_BINS * sizeof(int16_t)))) ? 1 : -1];
+typedef char position_map_fits_eeprom[((EEPROM_CONFIG_BYTES + TEST_HISTORY_BYTES + sizeof(position_map)) <= EEPROM_SIZE_BYTES) ? 1 : -1];
+
+//***************************************************************************
+//
+// Function Name : "position_map_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Reads the learned position map from EEPROM. A map of another
+//	POSITION_MAP_VERSION, erased EEPROM or a map learned against load
+//	current included, is dropped, a bin outside 1..POSITION_MAP_POSITION_MAX
+//	is not learned.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void position_map_load(void)
+{
+	eeprom_read_block(&position_map_active, &position_map_eeprom, sizeof(position_map));
+	if (position_map_active.version != POSITION_MAP_VERSION)
+		position_map_clear();
+	for (uint8_t bin = 0; bin < POSITION_MAP_BINS; bin++)
+	{
+		if ((position_map_active.position[bin] < 1) || (position_map_active.position[bin] > POSITION_MAP_POSITION_MAX))
+			position_map_active.position[bin] = POSITION_MAP_UNLEARNED;
+	}
+	position_map_predicted = POSITION_MAP_UNKNOWN;
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Writes the position map to EEPROM, only bytes that changed are written.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void position_map_save(void)
+{
+	eeprom_update_block(&position_map_active, &position_map_eeprom, sizeof(position_map));
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_clear"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Forgets every learned bin, for a new carbon pile or another cell count.
+//	The map is learned again from the next tests.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void position_map_clear(void)
+{
+	position_map_active.version = POSITION_MAP_VERSION;
+	for (uint8_t bin = 0; bin < POSITION_MAP_BINS; bin++)
+		position_map_active.position[bin] = POSITION_MAP_UNLEARNED;
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_pack_mv"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the pack voltage the map is used with: the unloaded pack voltage
+//	of the measurement cache, the loaded sequences do not refresh it, so it
+//	stays the open circuit voltage while the load draws current.
+//
+// Inputs : None
+//
+// Outputs :
+//		uint16_t pack_mv: unloaded pack voltage in mV, 0 if not known
+//
+//**************************************************************************
+uint16_t position_map_pack_mv(void)
+{
+	uint16_t pack_mv;
+
+	if (((adc_cache_valid >> SCAN_PACK) & 0x01) == 0)
+		return 0;
+	pack_mv = ADC_cache_cell_voltage(SCAN_PACK);
+	return (pack_mv < POSITION_MAP_PACK_MIN_MV) ? 0 : pack_mv;
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_conductance"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Conductance of the load that draws a current from a pack, the key of
+//	the map.
+//
+// Inputs :
+//		int32_t current_ma: load current in mA
+//		uint16_t pack_mv: unloaded pack voltage in mV, not 0
+//
+// Outputs :
+//		int32_t conductance: mS (mA / V)
+//
+//**************************************************************************
+int32_t position_map_conductance(int32_t current_ma, uint16_t pack_mv)
+{
+	return ((int64_t)current_ma * 1000) / pack_mv;
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_segment"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Finds the two points of the map a conductance falls between: the
+//	reference (no conductance at position 0) and the learned bins, in order.
+//	Past the last learned bin the last two points are returned, the
+//	prediction then extrapolates along them.
+//
+// Inputs :
+//		int32_t conductance_ms: conductance of the load in mS
+//		position_map_point *low: point below the conductance
+//		position_map_point *high: point above the conductance
+//
+// Outputs :
+//		uint8_t found: 0x01 -> low and high are set, 0x00 -> nothing learned
+//
+//**************************************************************************
+uint8_t position_map_segment(int32_t conductance_ms, position_map_point *low, position_map_point *high)
+{
+	position_map_point below = {0, 0};		// the reference
+	position_map_point previous = {0, 0};
+	uint8_t learned = 0;
+
+	for (uint8_t bin = 0; bin < POSITION_MAP_BINS; bin++)
+	{
+		if (position_map_active.position[bin] == POSITION_MAP_UNLEARNED)
+			continue;
+
+		position_map_point point = {position_map_active.position[bin], (bin + 1) * POSITION_MAP_BIN_MS};
+		if (point.conductance_ms > conductance_ms)
+		{
+			*low = below;
+			*high = point;
+			return 0x01;
+		}
+		previous = below;
+		below = point;
+		learned++;
+	}
+
+	if (learned == 0)
+		return 0x00;
+	*low = previous;
+	*high = below;
+	return 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_predict"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Predicts the knob position of a load current from a pack by linear
+//	interpolation between the points of the map around its conductance.
+//
+// Inputs :
+//		int32_t current_ma: load current in mA
+//		uint16_t pack_mv: unloaded pack voltage in mV, not 0
+//
+// Outputs :
+//		int16_t position: steps from the reference, POSITION_MAP_UNKNOWN if
+//						  nothing was learned
+//
+//**************************************************************************
+int16_t position_map_predict(int32_t current_ma, uint16_t pack_mv)
+{
+	position_map_point low;
+	position_map_point high;
+	int32_t conductance_ms = position_map_conductance(current_ma, pack_mv);
+
+	if (position_map_segment(conductance_ms, &low, &high) == 0x00)
+		return POSITION_MAP_UNKNOWN;
+
+	int32_t position = low.position + (((int64_t)(conductance_ms - low.conductance_ms) * (high.position - low.position)) / (high.conductance_ms - low.conductance_ms));
+	if (position < 0)
+		return 0;
+	if (position > POSITION_MAP_POSITION_MAX)
+		return POSITION_MAP_POSITION_MAX;
+	return position;
+}
+
+//***************************************************************************
+//
+// Function Name : "position_map_learn"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adapts the map to the position where set_load_current() settled. The
+//	position is moved to the conductance of the nearest bin along the slope of
+//	the map there (along the line from the reference if nothing is learned
+//	yet). An empty bin takes it as is, a learned bin moves by
+//	1/POSITION_MAP_LEARN_WEIGHT of the difference, so the map follows the
+//	wear of the pile without jumping on one noisy test.
+//
+// Inputs :
+//		int16_t position: settled position in steps from the reference
+//		int32_t current_ma: settled load current in mA
+//		uint16_t pack_mv: unloaded pack voltage in mV, not 0
+//
+// Outputs : None
+//
+//**************************************************************************
+void position_map_learn(int16_t position, int32_t current_ma, uint16_t pack_mv)
+{
+	position_map_point low;
+	position_map_point high;
+	int32_t conductance_ms = position_map_conductance(current_ma, pack_mv);
+
+	if ((position < 1) || (conductance_ms < (POSITION_MAP_BIN_MS / 2)))
+		return;
+
+	int32_t bin = ((conductance_ms + (POSITION_MAP_BIN_MS / 2)) / POSITION_MAP_BIN_MS) - 1;
+	if (bin >= POSITION_MAP_BINS)
+		bin = POSITION_MAP_BINS - 1;
+	int32_t bin_ms = (bin + 1) * POSITION_MAP_BIN_MS;
+
+	int32_t estimate;
+	if (position_map_segment(conductance_ms, &low, &high) == 0x01)
+		estimate = position + (((int64_t)(bin_ms - conductance_ms) * (high.position - low.position)) / (high.conductance_ms - low.conductance_ms));
+	else
+		estimate = ((int64_t)position * bin_ms) / conductance_ms;
+
+	if (estimate < 1)
+		estimate = 1;
+	else if (estimate > POSITION_MAP_POSITION_MAX)
+		estimate = POSITION_MAP_POSITION_MAX;
+
+	if (position_map_active.position[bin] == POSITION_MAP_UNLEARNED)
+		position_map_active.position[bin] = estimate;
+	else
+		position_map_active.position[bin] += (estimate - position_map_active.position[bin]) / POSITION_MAP_LEARN_WEIGHT;
+}
+
+//***************************************************************************
+//
+// Function Name : "send_position_map"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the knob position to the PC: the position in steps from the
+// reference (1 if it is valid, then the position), the prediction and its
+// error for the last set_load_current() and the learned position of every
+// bin, -1 for a bin not learned yet, separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_position_map(void)
+{
+	char map_buff[80];
+	char *field = map_buff;
+
+	field += sprintf(field, "%u,%d,%d,%d", motion_position_valid, motion_position, position_map_predicted, position_map_error);
+	for (uint8_t bin = 0; bin < POSITION_MAP_BINS; bin++)
+		field += sprintf(field, ",%d", position_map_active.position[bin]);
+
+	USART3_transmit_character('l'); //position map is being sent
+	USART3_transmit_string(map_buff);
+}
@@ -5,7 +5,11 @@
 // Function Name : "PWM_init"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// This function initializes the timer counter module for PWM output on PC4
+// This function initializes the timer counter module for the STEP pulses of
+//	the A4988 on PC4. TCA1 counts at 1 MHz in single slope mode, compare
+//	channel 0 drives the pin, which is high from BOTTOM to CMP0 and low up
+//	to TOP. The compare interrupt marks the falling edge of every step (see
+//	"motion.c"). The timer is left stopped.
 //
 // Inputs : none
 //
@@ -14,19 +18,19 @@
 //**************************************************************************
 void PWM_init(void)
 {
-	
-	// Enable TCA0 and set PWM frequency = 25kHz
-	TCA1.SINGLE.CTRLA = (TCA_SINGLE_CLKSEL_DIV1_gc | 0x01);	// Use system clk
+	// Stopped, 4MHz/4 => 1us per count
+	TCA1.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV4_gc;
+
+	// Single-slope PWM, compare channel 0 enabled when a move starts
+	TCA1.SINGLE.CTRLB = TCA_SINGLE_WGMODE_SINGLESLOPE_gc;
+	TCA1.SINGLE.PER = STEP_PERIOD_US - 1;
+	TCA1.SINGLE.CMP0 = STEP_PERIOD_US / 2;
+	TCA1.SINGLE.CNT = 0;
+
+	// Count steps on the falling edge
+	TCA1.SINGLE.INTFLAGS = (TCA_SINGLE_CMP0_bm | TCA_SINGLE_OVF_bm);
+	TCA1.SINGLE.INTCTRL = TCA_SINGLE_CMP0_bm;
 
-	// TOP = 8000 clk period @ 4MHz clk => 500 Hz pwm frequency
-	TCA1.SINGLE.PER = (uint16_t) 8000;
-	
-	// Enable single-slope PWM waveform generation on compare channel 0
-	TCA1.SINGLE.CTRLB = (TCA_SINGLE_WGMODE_SINGLESLOPE_gc | TCA_SINGLE_CMP0EN_bm);
-	
-	// Default duty cycle = 0%
-	TCA1.SINGLE.CMP0BUF = 0x00;
-	
 	// Configure PC4 pin for PWM output
 	PORTMUX.TCAROUTEA = (0x01 << 3);
 	PORTC.DIR |= PIN4_bm;	
@@ -48,7 +52,7 @@ void PWM_init(void)
 void set_PWM(uint8_t duty)
 {
 	/* Duty Cycle [%] = [100 - 100*[TOP - CMP]/TOP] */
-	TCA1.SINGLE.CMP0BUF = duty * 1.6;	// CMP value = duty*(TOP/100)
+	TCA1.SINGLE.CMP0BUF = ((uint32_t)(TCA1.SINGLE.PER + 1) * duty) / 100;	// CMP value = duty*(TOP/100)
 }
 
 //***************************************************************************
@@ -56,22 +60,26 @@ void set_PWM(uint8_t duty)
 // Function Name : "A4988_STEP_PWM_enable"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// This function enables the A4988 Step PWM
+// This function starts the A4988 Step PWM from BOTTOM, the first rising
+//	edge is immediate.
 //
-// Inputs : none
+// Inputs :
+//		uint16_t period_us: step period in us, 50% duty cycle
 //
 // Outputs : none
 //
 //**************************************************************************
-void A4988_STEP_PWM_enable(void)
+void A4988_STEP_PWM_enable(uint16_t period_us)
 {
-	/* Set enable bit*/
-	TCA1.SINGLE.CTRLA |= 0x01;
+	TCA1.SINGLE.PER = period_us - 1;
+	TCA1.SINGLE.CMP0 = period_us / 2;
+	TCA1.SINGLE.CNT = 0;
+	TCA1.SINGLE.CTRLFCLR = (TCA_SINGLE_PERBV_bm | TCA_SINGLE_CMP0BV_bm);	// drop buffered values of the previous move
+	TCA1.SINGLE.INTFLAGS = (TCA_SINGLE_CMP0_bm | TCA_SINGLE_OVF_bm);
 
-	/* Set duty cycle to 50%*/
-	/* Duty Cycle [%] = [100 - 100*[TOP - CMP]/TOP] */
-	uint8_t duty = 50;
-	TCA1.SINGLE.CMP0BUF = duty * 1.6;	// CMP value = duty*(TOP/100)
+	/* Hand PC4 to the timer and set enable bit */
+	TCA1.SINGLE.CTRLB |= TCA_SINGLE_CMP0EN_bm;
+	TCA1.SINGLE.CTRLA |= TCA_SINGLE_ENABLE_bm;
 }
 
 //***************************************************************************
@@ -79,7 +87,8 @@ void A4988_STEP_PWM_enable(void)
 // Function Name : "A4988_STEP_PWM_disable"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// This function disables the A4988 Step PWM
+// This function stops the A4988 Step PWM and gives PC4 back to the port,
+//	which holds it low.
 //
 // Inputs : none
 //
@@ -89,10 +98,9 @@ void A4988_STEP_PWM_enable(void)
 void A4988_STEP_PWM_disable(void)
 {
 	/* Clear enable bit*/
-	TCA1.SINGLE.CTRLA &= 0xFE;
+	TCA1.SINGLE.CTRLA &= ~TCA_SINGLE_ENABLE_bm;
 
-	/* Set duty cycle to 50%*/
-	/* Duty Cycle [%] = [100 - 100*[TOP - CMP]/TOP] */
-	uint8_t duty = 0;
-	TCA1.SINGLE.CMP0BUF = duty * 1.6;	// CMP value = duty*(TOP/100)
+	PORTC.OUT &= ~PIN4_bm;
+	TCA1.SINGLE.CTRLB &= ~TCA_SINGLE_CMP0EN_bm;
+	TCA1.SINGLE.INTFLAGS = (TCA_SINGLE_CMP0_bm | TCA_SINGLE_OVF_bm);
 }
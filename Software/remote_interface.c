@@ -20,6 +20,8 @@ ISR(USART3_RXC_vect)
 	cli(); //disable interrupts
 	char received_char = USART3.RXDATAL; //get received character
 	uint8_t quad_pack;
+	uint8_t chemistry;
+	uint32_t value;
 	char transmit_char;
 	switch (received_char){
 		case 'u': //unloaded test
@@ -57,6 +59,90 @@ ISR(USART3_RXC_vect)
 		case 'r': //get test results
 			send_results_pc(); //send results to PC
 			break;
+		case 'k': //get ADC configuration cache counters
+			send_adc_config_stats();
+			break;
+		case 'd': //get ADC settling diagnostics
+			send_adc_settle_stats();
+			break;
+		case 'h': //get measurement cache hits and misses
+			send_adc_cache_stats();
+			break;
+		case 's': //noise statistics per channel, 'c' clears them, any other character sends them
+			if (USART3_receive_character() == 'c')
+			{
+				ADC_stats_reset();
+				USART3_transmit_character('s'); //statistics cleared
+			}
+			else
+				send_adc_stream_stats();
+			break;
+		case 'f': //set measurement cache freshness window in ms, 3 digits
+			if (USART3_receive_digits(3, &value) == 0x01)
+			{
+				adc_cache_window_ms = value;
+				USART3_transmit_character('f'); //freshness window set
+			}
+			else
+				USART3_transmit_character('e'); //not a number, window unchanged
+			break;
+		case 'p': //set sample period of the loaded sequences in us, 5 digits, 00000 -> free running
+			if ((USART3_receive_digits(5, &value) == 0x01) && (value <= ADC_TIMED_MAX_PERIOD_US))
+			{
+				adc_sample_period_us = value;
+				USART3_transmit_character('p'); //sample period set
+			}
+			else
+				USART3_transmit_character('e'); //not a number or too long, period unchanged
+			break;
+		case 'j': //get sample period jitter of the last timed acquisition
+			send_adc_timed_stats();
+			break;
+		case 'g': //get active load current range
+			send_current_range_stats();
+			break;
+		case 'b': //benchmark the control loop iteration, float vs fixed-point
+			benchmark_control_loop();
+			send_benchmark_results();
+			break;
+		case 'w': //get undervoltage trip of the last loaded test
+			send_monitor_trip();
+			break;
+		case 'x': //get sag capture of the last test
+			send_sag_capture();
+			break;
+		case 'n': //get internal resistance of each cell from the last DCIR test
+			send_dcir_results();
+			break;
+		case 't': //health grading thresholds, see health_grading_remote_command()
+			health_grading_remote_command();
+			break;
+		case 'o': //select battery chemistry 0-2, see CHEMISTRIES
+			chemistry = USART3_receive_character() - '0';
+			if (chemistry < CHEMISTRY_COUNT)
+			{
+				chemistry_select(chemistry);
+				chemistry_save();
+				chemistry_apply_defaults();
+			}
+			USART3_transmit_character('o'); //chemistry selected
+			break;
+		case 'z': //set or get the number of cells, see cell_map_remote_command()
+			cell_map_remote_command();
+			break;
+		case 'l': //load current controller gains, log and simulation, see control_remote_command()
+			control_remote_command();
+			break;
+		case 'q': //calibration command, see calibration_remote_command()
+			calibration_remote_command();
+			break;
+		case 'y': //set sag capture decimation factor 1-9
+			while(!(USART3_STATUS & USART_RXCIF_bm)) ; //wait for decimation digit
+			received_char = USART3.RXDATAL; //get decimation digit
+			if ((received_char >= '1') && (received_char <= '9'))
+				sag_capture_decimation = received_char - '0';
+			USART3_transmit_character('y'); //decimation factor set
+			break;
 		case '0': //get data from quad pack 1-9
 			while(!(USART3_STATUS & USART_RXCIF_bm)) ; //wait for next character
 			received_char = USART3.RXDATAL; //get ones digit of quad pack
@@ -64,7 +150,7 @@ ISR(USART3_RXC_vect)
 			read_EEPROM(quad_pack - 1); //read from specified EEPROM quad pack
 			send_results_pc(); //send results to PC
 			break;
-		case '1': //get data from quad pack 10-13
+		case '1': //get data from quad pack 10 and above
 			while(!(USART3_STATUS & USART_RXCIF_bm)) ; //wait for next character
 			received_char = USART3.RXDATAL; //get ones digit of quad pack
 			quad_pack = received_char - '0'; //save quad pack digit to variable
@@ -130,12 +216,377 @@ void USART3_transmit_character(char transmit_char)
 	
 }
 
+//***************************************************************************
+//
+// Function Name : "USART3_transmit_string"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Transmits a null terminated string to the PC using USART3, followed by
+// a newline character so the PC can read variable length fields
+//
+// Inputs : const char *transmit_string: the string to be sent
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void USART3_transmit_string(const char *transmit_string)
+{
+	while (*transmit_string != '\0')
+	{
+		USART3_transmit_character(*transmit_string);
+		transmit_string++;
+	}
+	USART3_transmit_character('\n');
+}
+
+//***************************************************************************
+//
+// Function Name : "USART3_receive_character"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Waits for the next character from the PC. Used by commands that carry
+// parameters, called from the receive interrupt with interrupts disabled
+//
+// Inputs : none
+//
+// Outputs : char: the received ASCII character
+//
+//
+//**************************************************************************
+char USART3_receive_character(void)
+{
+	while(!(USART3_STATUS & USART_RXCIF_bm)) ; //wait for next character
+	return USART3.RXDATAL;
+}
+
+//***************************************************************************
+//
+// Function Name : "USART3_receive_number"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Receives a fixed number of decimal digits from the PC, most significant
+// digit first
+//
+// Inputs : uint8_t digits: number of digits to receive
+//
+// Outputs : uint32_t: the received number
+//
+//
+//**************************************************************************
+uint32_t USART3_receive_number(uint8_t digits)
+{
+	uint32_t number = 0;
+	
+	for (uint8_t i = 0; i < digits; i++)
+		number = (number * 10) + (USART3_receive_character() - '0');
+	
+	return number;
+}
+
+//***************************************************************************
+//
+// Function Name : "USART3_receive_digits"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Receives a fixed number of decimal digits from the PC like
+// USART3_receive_number() and checks every one of them. All digits are
+// received even after a bad one so the next command starts in step.
+//
+// Inputs : uint8_t digits: number of digits to receive
+//			uint32_t *number: the received number, only valid on success
+//
+// Outputs : uint8_t: 0x01 -> every character was a digit, 0x00 otherwise
+//
+//
+//**************************************************************************
+uint8_t USART3_receive_digits(uint8_t digits, uint32_t *number)
+{
+	uint8_t valid = 0x01;
+	
+	*number = 0;
+	for (uint8_t i = 0; i < digits; i++)
+	{
+		char received = USART3_receive_character();
+		
+		if ((received < '0') || (received > '9'))
+			valid = 0x00;
+		*number = (*number * 10) + (received - '0');
+	}
+	
+	return valid;
+}
+
+//***************************************************************************
+//
+// Function Name : "send_adc_config_stats"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the ADC configuration cache counters to the PC: number of
+// configuration requests, number of full register rewrites and number
+// of changed configurations applied without a full rewrite, separated by
+// commas. The scan ISR updates the counters, they are copied with
+// interrupts off so no byte of a count is torn.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_adc_config_stats(void)
+{
+	char stats_buff[24];
+	
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t requests = adc_config_requests;
+	uint16_t full_writes = adc_config_full_writes;
+	uint16_t avoided = adc_config_avoided;
+	SREG = sreg;
+	
+	sprintf(stats_buff, "%u,%u,%u", requests, full_writes, avoided);
+	USART3_transmit_character('k'); //configuration cache counters are being sent
+	USART3_transmit_string(stats_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_adc_settle_stats"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the settling diagnostics to the PC: the last settle time of each
+// channel of the default sequence (the cells, the pack, the load current
+// and the temperature sensor) in microseconds followed by the number of channel switches
+// that hit the settling timeout, separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_adc_settle_stats(void)
+{
+	char stats_buff[8];
+	
+	USART3_transmit_character('d'); //settling diagnostics are being sent
+	for (uint8_t slot = 0; slot < adc_scan_default_length; slot++)
+	{
+		sprintf(stats_buff, "%u,", adc_settle_time_us[adc_scan_default_sequence[slot]]);
+		for (uint8_t j = 0; stats_buff[j] != '\0'; j++)
+			USART3_transmit_character(stats_buff[j]);
+	}
+	sprintf(stats_buff, "%u", adc_settle_timeouts);
+	USART3_transmit_string(stats_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_adc_cache_stats"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the measurement cache counters to the PC: number of requests
+// served from the cache, number that needed a new sweep and the freshness
+// window in ms, separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_adc_cache_stats(void)
+{
+	char stats_buff[24];
+	
+	sprintf(stats_buff, "%u,%u,%u", adc_cache_hits, adc_cache_misses, adc_cache_window_ms);
+	USART3_transmit_character('h'); //measurement cache counters are being sent
+	USART3_transmit_string(stats_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_adc_stream_stats"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the live noise statistics of each channel of the default sequence
+// (the cells, the pack, the load current and the temperature sensor) to the
+// PC: number of readings, mean, standard deviation, lowest and highest
+// reading, separated by commas, channels separated by semicolons. Voltages
+// are in uV at the ADC pins, the temperature in 0.1 C.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_adc_stream_stats(void)
+{
+	char stats_buff[56];
+	
+	USART3_transmit_character('s'); //noise statistics are being sent
+	for (uint8_t slot = 0; slot < adc_scan_default_length; slot++)
+	{
+		const stream_stats *stats = &adc_channel_stats[adc_scan_default_sequence[slot]];
+		
+		sprintf(stats_buff, (slot == 0) ? "%u,%ld,%lu,%ld,%ld" : ";%u,%ld,%lu,%ld,%ld", stats->count, stream_stats_mean(stats), stream_stats_deviation(stats),
+			(stats->count == 0) ? 0L : stats->min, (stats->count == 0) ? 0L : stats->max);
+		if (slot == (adc_scan_default_length - 1))
+			USART3_transmit_string(stats_buff);
+		else
+			for (uint8_t j = 0; stats_buff[j] != '\0'; j++)
+				USART3_transmit_character(stats_buff[j]);
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "send_adc_timed_stats"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the sample period report of the last timed acquisition to the PC:
+// nominal period, number of results, mean, shortest and longest interval
+// between results in microseconds, the number of missed results and the
+// number of results discarded while the reference settled, separated by
+// commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_adc_timed_stats(void)
+{
+	char stats_buff[56];
+	uint32_t mean_tenths = 0;	// 0.1 us
+	uint32_t min_tenths = (adc_timed_interval_min * 10UL) / ADC_TIMED_COUNTS_PER_US;
+	uint32_t max_tenths = (adc_timed_interval_max * 10UL) / ADC_TIMED_COUNTS_PER_US;
+	
+	if (adc_timed_intervals > 0)
+		mean_tenths = (adc_timed_interval_sum * 10) / (adc_timed_intervals * (uint32_t)ADC_TIMED_COUNTS_PER_US);
+	
+	sprintf(stats_buff, "%u,%u,%lu.%lu,%lu.%lu,%lu.%lu,%u,%u", adc_timed_period_us, adc_timed_samples, mean_tenths / 10, mean_tenths % 10,
+			min_tenths / 10, min_tenths % 10, max_tenths / 10, max_tenths % 10, adc_timed_missed, adc_timed_discarded);
+	USART3_transmit_character('j'); //sample period report is being sent
+	USART3_transmit_string(stats_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_current_range_stats"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the active load current range to the PC: range number, name,
+// total gain, ADC reference of the control loop in volts, resolution in
+// mA per LSB and the
+// number of range changes, separated by commas
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_current_range_stats(void)
+{
+	char stats_buff[48];
+	uint8_t range = current_range_active;
+	
+	uint16_t vref_mv = ADC_profile_vref_mv(ADC_PROFILE_FAST);
+	uint32_t resolution_ua = current_range_resolution(range);
+	
+	sprintf(stats_buff, "%u,%s,%u,%u.%03u,%lu.%lu,%u", range, current_ranges[range].name, current_ranges[range].gain,
+			MV_WHOLE(vref_mv), MV_FRAC(vref_mv), resolution_ua / 1000, (resolution_ua % 1000) / 100, current_range_switches);
+	USART3_transmit_character('g'); //current range is being sent
+	USART3_transmit_string(stats_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_benchmark_results"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the mean CPU cycles of one control loop iteration with the float
+// reference and with the fixed-point pipeline, separated by a comma
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_benchmark_results(void)
+{
+	char bench_buff[16];
+	
+	sprintf(bench_buff, "%u,%u", bench_float_cycles, bench_fixed_cycles);
+	USART3_transmit_character('b'); //benchmark results are being sent
+	USART3_transmit_string(bench_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_monitor_trip"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the undervoltage trip of the last loaded test to the PC: the cell
+// that tripped (0 if none) and the load current in amps at the trip,
+// separated by a comma
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_monitor_trip(void)
+{
+	char trip_buff[12];
+	
+	sprintf(trip_buff, "%u,%u", adc_monitor_trip_cell, adc_monitor_trip_current);
+	USART3_transmit_character('w'); //undervoltage trip is being sent
+	USART3_transmit_string(trip_buff);
+}
+
+//***************************************************************************
+//
+// Function Name : "send_dcir_results"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the DC internal resistance of each cell in uOhm to the PC,
+// separated by commas. All 0 if the test was not a DCIR test
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//
+//**************************************************************************
+void send_dcir_results(void)
+{
+	char dcir_buff[48];
+	char *field = dcir_buff;
+	
+	for (uint8_t i = 0; i < cell_count_checked(current_test_result.cell_count); i++)
+		field += sprintf(field, (i == 0) ? "%u" : ",%u", current_test_result.dcir_uohm[i]);
+	USART3_transmit_character('n'); //internal resistances are being sent
+	USART3_transmit_string(dcir_buff);
+}
+
 //***************************************************************************
 //
 // Function Name : "send_results_pc"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// Sends the results from the full test back to the PC.
+// Sends the results from the full test back to the PC, one field per cell
+// of the tested pack. The cell balance follows as 'b' and the unloaded
+// spread and deviation, the loaded spread and deviation in mV, the worst
+// sag x1000, its cell and the lowest loaded cell, separated by commas.
+// Then 'r' and the time the load took to settle in ms, its overshoot in
+// mA and the time the release took in ms.
 //
 // Inputs : none
 //
@@ -145,14 +596,18 @@ void USART3_transmit_character(char transmit_char)
 //**************************************************************************
 void send_results_pc()
 {	
-	for(uint8_t i = 0; i < 4; i++) //add unloaded voltages to buffer array
+	uint8_t cells = cell_count_checked(current_test_result.cell_count);
+	char balance_buff[40];
+	char load_buff[24];
+	
+	for(uint8_t i = 0; i < cells; i++) //add unloaded voltages to buffer array
 	{
-		sprintf(remote_buff[i], "%.3f", current_test_result.UNLOADED_battery_voltages[i]);
+		sprintf(remote_buff[i], "%u.%03u", MV_WHOLE(current_test_result.UNLOADED_battery_voltages[i]), MV_FRAC(current_test_result.UNLOADED_battery_voltages[i]));
 	}
 	
-	for(uint8_t i = 0; i < 4; i++) //add loaded voltages to buffer array
+	for(uint8_t i = 0; i < cells; i++) //add loaded voltages to buffer array
 	{
-		sprintf(remote_buff[i + 4], "%.3f", current_test_result.LOADED_battery_voltages[i]);	
+		sprintf(remote_buff[i + CELL_COUNT_MAX], "%u.%03u", MV_WHOLE(current_test_result.LOADED_battery_voltages[i]), MV_FRAC(current_test_result.LOADED_battery_voltages[i]));	
 	}
 	
 	/* Write health ratings into character buffer */
@@ -174,7 +629,7 @@ void send_results_pc()
 	
 	//transmit unloaded voltages
 	USART3_transmit_character('u'); //unloaded voltages are being sent
-	for(uint8_t i = 0; i < 4; i++)
+	for(uint8_t i = 0; i < cells; i++)
 	{
 		for(uint8_t j = 0; j < 5; j++)
 		{
@@ -186,7 +641,7 @@ void send_results_pc()
 	
 	//transmit loaded 
 	USART3_transmit_character('l'); //loaded voltages are being sent
-	for(uint8_t i = 4; i < 8; i++)
+	for(uint8_t i = CELL_COUNT_MAX; i < (CELL_COUNT_MAX + cells); i++)
 	{
 		for(uint8_t j = 0; j < 5; j++)
 		{
@@ -199,7 +654,7 @@ void send_results_pc()
 	
 	//transmit health ratings
 	USART3_transmit_character('h'); //health ratings are being sent
-	for(uint8_t i = 0; i < 8; i++)
+	for(uint8_t i = 0; i < (2 * cells); i++)
 	{
 		USART3_transmit_character(health_rating_characters[i]);
 		_delay_ms(10);
@@ -213,6 +668,17 @@ void send_results_pc()
 		_delay_ms(10);
 	}
 	
+	//transmit cell balance
+	sprintf(balance_buff, "%u,%u,%u,%u,%u,%u,%u", current_test_result.unloaded_balance.spread_mv, current_test_result.unloaded_balance.deviation_mv,
+		current_test_result.loaded_balance.spread_mv, current_test_result.loaded_balance.deviation_mv,
+		current_test_result.sag_permille, current_test_result.sag_cell + 1, current_test_result.loaded_balance.low_cell + 1);
+	USART3_transmit_character('b'); //cell balance is being sent
+	USART3_transmit_string(balance_buff);
+	
+	//transmit load timing
+	sprintf(load_buff, "%u,%u,%u", current_test_result.settle_ms, current_test_result.overshoot_ma, current_test_result.release_ms);
+	USART3_transmit_character('r'); //settle time, overshoot and release time are being sent
+	USART3_transmit_string(load_buff);
 }
 
 //***************************************************************************
@@ -231,12 +697,12 @@ void send_results_pc()
 //**************************************************************************
 void send_unloaded_voltages()
 {
-	for(uint8_t i = 0; i < 4; i++) //add unloaded voltages to buffer array
+	for(uint8_t i = 0; i < cell_count; i++) //add unloaded voltages to buffer array
 	{
-		sprintf(remote_buff[i], "%.3f", current_test_result.UNLOADED_battery_voltages[i]);
+		sprintf(remote_buff[i], "%u.%03u", MV_WHOLE(current_test_result.UNLOADED_battery_voltages[i]), MV_FRAC(current_test_result.UNLOADED_battery_voltages[i]));
 	}
 
-	for(uint8_t i = 0; i < 4; i++) //send unloaded voltages
+	for(uint8_t i = 0; i < cell_count; i++) //send unloaded voltages
 	{
 		for(uint8_t j = 0; j < 5; j++)
 		{
@@ -263,12 +729,15 @@ void send_unloaded_voltages()
 //**************************************************************************
 char automatic_test_loaded_remote()
 {
-	set_load_current(current_test_result.max_load_current); //set load current to specified current
-	if(cancel_test = 0x00) //if test is not canceled
+	calibration_auto_zero(0x00); //zero the shunt channel while the load is open
+	set_load_current((int32_t)current_test_result.max_load_current * 1000); //set load current to specified current
+	if(cancel_test == 0x00) //if test is not canceled
 	{
 		read_LOADED_battery_voltages();	 //read loaded battery voltages
+		health_grade_result(&current_test_result); //grade the cells once for send_results_pc()
 		buzzer_ON(); 
 		open_circuit_load(); //set load current back to 0
+		current_test_result.release_ms = control_release_ms; //time the release took
 		_delay_ms(1000);
 		buzzer_OFF();
 	}
@@ -292,64 +761,66 @@ char automatic_test_loaded_remote()
 //
 //**************************************************************************
 char manual_test_loaded_remote(){
-	load_current_amps = load_current_Read(); //read load current
+	calibration_auto_zero(0x00); //zero the shunt channel while the load is open
+	load_current_ma = load_current_Read(ADC_PROFILE_NORMAL); //read load current
 	clear_lcd();
 	sprintf(dsp_buff[0], "Rotate Knob Until   ");
 	sprintf(dsp_buff[1], "Beeping Sound is    ");
 	sprintf(dsp_buff[2], "Heard...            ");
-	sprintf(dsp_buff[3], "Load Current: %.1fA ", load_current_amps);
+	sprintf(dsp_buff[3], "Load Current: %ld.%ldA ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 	update_lcd();
 	
-	while (load_current_amps < current_test_result.max_load_current) //while load current is below specified current
+	while (load_current_ma < ((int32_t)current_test_result.max_load_current * 1000)) //while load current is below specified current
 	{
 		if(USART3.RXDATAL == 'c') //if cancel test is selected
 		{
 			cancel_test = 0x01; //set flag to cancel test
 			break; //exit increase current while loop
 		}
-		load_current_amps = load_current_Read(); //update current reading
+		load_current_ma = load_current_Read(ADC_PROFILE_NORMAL); //update current reading
 		
 		_delay_ms(50);	// delay to prevent LCD to updating too fast
 		clear_lcd();
 		sprintf(dsp_buff[0], "Rotate Knob Until   ");
 		sprintf(dsp_buff[1], "Beeping Sound is    ");
 		sprintf(dsp_buff[2], "Heard...            ");
-		if (load_current_amps >= 100)
-			sprintf(dsp_buff[3], "Load Current: %.1fA", load_current_amps);
-		else if (load_current_amps >= 10)
-			sprintf(dsp_buff[3], "Load Current: %.1fA ", load_current_amps);
+		if (load_current_ma >= 100000)
+			sprintf(dsp_buff[3], "Load Current: %ld.%ldA", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
+		else if (load_current_ma >= 10000)
+			sprintf(dsp_buff[3], "Load Current: %ld.%ldA ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		else
-			sprintf(dsp_buff[3], "Load Current: %.1fA  ", load_current_amps);
+			sprintf(dsp_buff[3], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		update_lcd();
 		
 	}
 	
 	USART3_transmit_character('i'); //transmit 'i' so user knows to turn down current
 
-	if(cancel_test = 0x00) //if test was not canceled
+	if(cancel_test == 0x00) //if test was not canceled
 	{
-		current_test_result.max_load_current = load_current_amps; //save max load current
+		current_test_result.max_load_current = MA_WHOLE(load_current_ma); //save max load current
 		_delay_ms(100);
 		read_LOADED_battery_voltages(); //read loaded voltages
+		health_grade_result(&current_test_result); //grade the cells once for send_results_pc()
 	}
 	cancel_test = 0x00; //reset cancel test flag
 	
-	while (load_current_amps > 1) //while load current is greater than 1 A
+	while (load_current_ma > LOAD_CURRENT_OFF_MA) //while load current is greater than 1 A
 	{
-		load_current_amps = load_current_Read(); //update current reading
+		load_current_ma = load_current_Read(ADC_PROFILE_NORMAL); //update current reading
 
-		temp = load_current_amps;
+		temp = load_current_ma;
 		_delay_ms(200);
 		clear_lcd();
 		sprintf(dsp_buff[0], "Test complete...    ");
 		sprintf(dsp_buff[1], "Rotate Knob until   ");
 		sprintf(dsp_buff[2], "beeping stops...    ");
-		if (load_current_amps >= 100)
-			sprintf(dsp_buff[3], "Load Current: %.1fA", load_current_amps);
-		else if (load_current_amps >= 10)
-			sprintf(dsp_buff[3], "Load Current: %.1fA ", load_current_amps);
+		if (load_current_ma >= 100000)
+			sprintf(dsp_buff[3], "Load Current: %ld.%ldA", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
+		else if (load_current_ma >= 10000)
+			sprintf(dsp_buff[3], "Load Current: %ld.%ldA ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		else
-			sprintf(dsp_buff[3], "Load Current: %.1fA  ", load_current_amps);
+			sprintf(dsp_buff[3], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		update_lcd();
 		
 		buzzer_ON();
@@ -379,19 +850,28 @@ char manual_test_loaded_remote(){
 //**************************************************************************
 char test_unloaded_remote(void)
 {
-	/* Read total battery pack voltage with single-ended measurement */
-	ADC_init(0x01);
-	ADC_channelSEL(B4_ADC_CHANNEL, GND_ADC_CHANNEL);
-	float voltage = ADC_read() * battery_voltage_divider_ratios;
+	uint8_t presence_valid = pack_presence_is_valid();	// 0x01 -> comparator replaces the ADC connection probe
+	
+	/* Comparator sees no pack -> return 'e' without reading */
+	if ((presence_valid == 0x01) && (pack_present == 0x00))
+		return 'e';
+	
+	/* Read total battery pack voltage and all cells in one sweep of the scan sequencer */
+	read_UNLOADED_battery_voltages();
+	current_test_result.chemistry = chemistry_selected;
+	for (uint8_t i = 0; i < CELL_COUNT_MAX; i++)
+	{
+		current_test_result.dcir_uohm[i] = 0; //remote tests do not measure internal resistance
+		current_test_result.health_grades[i] = 0xFF; //not graded until the loaded voltages are read
+	}
+	uint16_t voltage = ADC_cache_cell_voltage(SCAN_PACK);	// mV
 	
 	/* If voltage < 0.1V, no battery connection and return 'e' */
-	if (voltage < 0.1)
+	if ((presence_valid == 0x00) && (voltage < 100))
 		return 'e';
-	else //else read unloaded battery voltages
-		read_UNLOADED_battery_voltages();
-	for (uint8_t i = 0; i < 4; i++) 
+	for (uint8_t i = 0; i < cell_count; i++) 
 	{
-		if (current_test_result.UNLOADED_battery_voltages[i] < min_battery_voltage) //if unloaded voltage below min value (3.0), return 'v'
+		if (current_test_result.UNLOADED_battery_voltages[i] < chemistry_active->min_battery_mv) //if unloaded voltage below the floor of the chemistry, return 'v'
 			return 'v';
 	}
 	return 'd'; //else return 'd' - test successful
@@ -412,6 +892,6 @@ char test_unloaded_remote(void)
 //**************************************************************************
 void read_EEPROM(uint8_t quad_pack_num)
 {
-	eeprom_read_block(&current_test_result, &test_results_history_eeprom[quad_pack_num], sizeof(test_result)); //read from specific EEPROM entry
+	test_history_load(quad_pack_num); //read from specific EEPROM entry, ignored if it does not exist
 }
 
@@ -0,0 +1,293 @@
+#include "main.h"
+
+/* Channel names for the LCD summary, indexed like sag_capture_min[]/sag_capture_max[] */
+const char sag_channel_names[SAG_CHANNELS][8] = {"Current", "B1", "B2", "B3", "B4", "B5", "B6", "B7", "B8"};
+
+//***************************************************************************
+//
+// Function Name : "sag_capture_start"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Empties the sag capture ring buffer and starts recording. Samples are
+//	taken from the published sweeps of the scan sequencer, so the period
+//	can not be shorter than the longest loaded sweep: the snapshot with
+//	2 x cell_count + 1 slots of adc_sample_period_us, 4.5 ms at 4S and
+//	8.5 ms at 8S. The period is the longer of that and
+//	SAG_CAPTURE_PERIOD_MIN_MS, every sag_capture_decimation-th sample is
+//	stored. Min/max are tracked on every sample, so the summary does not
+//	depend on the decimation. An export still being sent is dropped.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void sag_capture_start(void)
+{
+	sag_capture_active = 0x00;	// keep the scan ISR away while the buffer is reset
+	sag_export_pending = 0x00;
+	sag_export_remaining = 0;
+
+	/* One sample per loaded sweep at most, rounded up to whole ms */
+	uint32_t sweep_us = (uint32_t)adc_snapshot_length * adc_sample_period_us;
+	sag_capture_period_ms = (sweep_us + 999) / 1000;
+	if (sag_capture_period_ms < SAG_CAPTURE_PERIOD_MIN_MS)
+		sag_capture_period_ms = SAG_CAPTURE_PERIOD_MIN_MS;
+	sag_capture_period_ticks = ((uint32_t)sag_capture_period_ms * TIMEBASE_HZ) / 1000;
+
+	sag_capture_head = 0;
+	sag_capture_count = 0;
+	sag_capture_skip = 0;
+	sag_capture_start_ticks = timebase_ticks();
+	sag_capture_due = sag_capture_start_ticks;
+
+	for (uint8_t i = 0; i < SAG_CHANNELS; i++)
+	{
+		sag_capture_last[i] = 0;
+		sag_capture_min[i] = 0xFFFF;
+		sag_capture_max[i] = 0;
+	}
+
+	if (sag_capture_decimation == 0)
+		sag_capture_decimation = 1;
+
+	sag_capture_active = 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "sag_capture_stop"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Stops recording, the buffer is kept until the next sag_capture_start().
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void sag_capture_stop(void)
+{
+	sag_capture_active = 0x00;
+}
+
+//***************************************************************************
+//
+// Function Name : "sag_capture_sweep"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Called by the scan sequencer each time a sweep is published. Picks the
+//	load current and cell results out of the sweep, whatever the sequence,
+//	and records a sample when the next sample period is due. Channels the
+//	sequence does not contain keep their last value.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void sag_capture_sweep(void)
+{
+	if (sag_capture_active == 0x00)
+		return;
+
+	/* Fixed rate: wait for the next sample period */
+	uint32_t now = timebase_ticks();
+	if ((int32_t)(now - sag_capture_due) < 0)
+		return;
+	sag_capture_due += sag_capture_period_ticks;
+	if ((int32_t)(now - sag_capture_due) >= 0)
+		sag_capture_due = now + sag_capture_period_ticks;	// fell behind, resynchronize
+
+	/* Latest result of every captured channel in the sweep */
+	for (uint8_t slot = 0; slot < adc_scan_length; slot++)
+	{
+		uint8_t channel = adc_scan_sequence[slot];
+
+		if (channel == SCAN_LOAD_CURRENT)
+			sag_capture_last[SAG_CURRENT] = ADC_scan_load_current(slot) / 100;	// 0.1 A
+		else if (channel <= SCAN_B8)
+			sag_capture_last[SAG_B1 + channel] = ADC_scan_cell_voltage(slot);	// mV
+	}
+
+	for (uint8_t i = 0; i < SAG_CHANNELS; i++)
+	{
+		if (sag_capture_last[i] < sag_capture_min[i])
+			sag_capture_min[i] = sag_capture_last[i];
+		if (sag_capture_last[i] > sag_capture_max[i])
+			sag_capture_max[i] = sag_capture_last[i];
+	}
+
+	/* Decimation: store every sag_capture_decimation-th sample */
+	sag_capture_skip++;
+	if (sag_capture_skip < sag_capture_decimation)
+		return;
+	sag_capture_skip = 0;
+
+	sag_capture_buffer[sag_capture_head].time_ms = TIMEBASE_TICKS_TO_MS(now - sag_capture_start_ticks);
+	for (uint8_t i = 0; i < SAG_CHANNELS; i++)
+		sag_capture_buffer[sag_capture_head].value[i] = sag_capture_last[i];
+
+	/* Ring buffer, the oldest sample is overwritten when full */
+	sag_capture_head++;
+	if (sag_capture_head >= SAG_CAPTURE_ENTRIES)
+		sag_capture_head = 0;
+	if (sag_capture_count < SAG_CAPTURE_ENTRIES)
+		sag_capture_count++;
+}
+
+//***************************************************************************
+//
+// Function Name : "send_sag_capture"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Queues the sag capture for the PC. Called from the USART3 ISR, so it
+//	only stops the recording, sag_capture_export() sends the capture from
+//	the main loop.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void send_sag_capture(void)
+{
+	sag_capture_stop();
+	sag_export_pending = 0x01;
+}
+
+//***************************************************************************
+//
+// Function Name : "sag_capture_export"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sends the next SAG_EXPORT_CHUNK samples of a queued sag capture, so the
+//	main loop is never held for the whole buffer. The samples go oldest
+//	first, a new request starts over. The first line holds the number of
+//	samples, the sample period in ms and the decimation factor. Each
+//	following line holds one sample: time in ms, load current in 0.1 A
+//	and the voltage of each cell in mV, separated by commas.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void sag_capture_export(void)
+{
+	char sample_buff[64];
+
+	if (sag_export_pending == 0x01)
+	{
+		sag_export_pending = 0x00;
+
+		/* Oldest sample sits at the head once the buffer has wrapped */
+		if (sag_capture_count < SAG_CAPTURE_ENTRIES)
+			sag_export_index = 0;
+		else
+			sag_export_index = sag_capture_head;
+		sag_export_remaining = sag_capture_count;
+
+		sprintf(sample_buff, "%u,%u,%u", sag_export_remaining, sag_capture_period_ms, sag_capture_decimation);
+		USART3_transmit_character('x');	//sag capture is being sent
+		USART3_transmit_string(sample_buff);
+	}
+
+	for (uint8_t i = 0; (i < SAG_EXPORT_CHUNK) && (sag_export_remaining != 0); i++)
+	{
+		uint16_t index = sag_export_index;
+		char *field = sample_buff + sprintf(sample_buff, "%lu,%u", sag_capture_buffer[index].time_ms, sag_capture_buffer[index].value[SAG_CURRENT]);
+		for (uint8_t cell = 0; cell < cell_count; cell++)
+			field += sprintf(field, ",%u", sag_capture_buffer[index].value[SAG_B1 + cell]);
+		USART3_transmit_string(sample_buff);
+
+		index++;
+		if (index >= SAG_CAPTURE_ENTRIES)
+			index = 0;
+		sag_export_index = index;
+		sag_export_remaining--;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "display_sag_summary"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Displays the min/max of one captured channel, selected by
+//	sag_view_channel, with the number of stored samples.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void display_sag_summary(void)
+{
+	uint8_t ch = sag_view_channel;
+
+	clear_lcd();
+	sprintf(dsp_buff[0], "Sag Capture: %-7s", sag_channel_names[ch]);
+	if (sag_capture_count == 0)
+	{
+		sprintf(dsp_buff[1], "No samples          ");
+		sprintf(dsp_buff[2], "                    ");
+	}
+	else if (ch == SAG_CURRENT)
+	{
+		sprintf(dsp_buff[1], "Min: %3u.%u A        ", sag_capture_min[ch] / 10, sag_capture_min[ch] % 10);
+		sprintf(dsp_buff[2], "Max: %3u.%u A        ", sag_capture_max[ch] / 10, sag_capture_max[ch] % 10);
+	}
+	else
+	{
+		sprintf(dsp_buff[1], "Min: %u.%03u V        ", MV_WHOLE(sag_capture_min[ch]), MV_FRAC(sag_capture_min[ch]));
+		sprintf(dsp_buff[2], "Max: %u.%03u V        ", MV_WHOLE(sag_capture_max[ch]), MV_FRAC(sag_capture_max[ch]));
+	}
+	sprintf(dsp_buff[3], "Samples: %3u  x%u    ", sag_capture_count, sag_capture_decimation);
+	update_lcd();
+}
+
+//***************************************************************************
+//
+// Function Name : "scroll_sag_summary"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Handles pushbutton presses on the sag summary page. UP/DOWN select the
+//	load current or one of the cells of the pack, BACK returns to the
+//	voltage readings.
+//
+// Inputs : PB_INPUT_TYPE pb_type : Pushbutton input identifier
+//
+// Outputs : None
+//
+//**************************************************************************
+void scroll_sag_summary(PB_INPUT_TYPE pb_type)
+{
+	switch (pb_type)
+	{
+		/* UP pushbutton press -> previous channel, wraps around */
+		case UP:
+			if (sag_view_channel == 0)
+				sag_view_channel = SAG_B1 + cell_count - 1;
+			else
+				sag_view_channel--;
+			display_sag_summary();
+			break;
+		/* DOWN pushbutton press -> next channel, wraps around */
+		case DOWN:
+			sag_view_channel++;
+			if (sag_view_channel >= (SAG_B1 + cell_count))
+				sag_view_channel = 0;
+			display_sag_summary();
+			break;
+		/* BACK pushbutton press -> Return to voltage readings */
+		case BACK:
+			TEST_CURRENT_STATE = VOLTAGE_READINGS_T;
+			display_voltage_readings(current_test_result);
+			break;
+		/* Default action is to display the summary */
+		default:
+			display_sag_summary();
+			break;
+	}
+}
@@ -26,9 +26,13 @@ void settings_fsm(void)
 		case LOAD_CURRENT_SETTINGS_SCREEN:
 			adjust_load_current_settings(PB_PRESS);
 			break;
-		/* Set precision of voltage measurements in decimal places */
-		case VOLTAGE_PRECISION_SETTINGS_SCREEN:
-			adjust_voltage_precision_settings(PB_PRESS);
+		/* Select the acquisition profile of voltage measurements */
+		case ACQUISITION_PROFILE_SETTINGS_SCREEN:
+			adjust_acquisition_profile_settings(PB_PRESS);
+			break;
+		/* Select the battery chemistry and the number of cells */
+		case BATTERY_SETTINGS_SCREEN:
+			adjust_battery_settings(PB_PRESS);
 			break;
 		/* Default action is to display the settings menu */
 		default:
@@ -99,9 +103,10 @@ void settings_menu_OK(void)
 {
 	switch(cursor)
 	{
-		/* LCD line 1: Toggle Test mode between manual and automated */
+		/* LCD line 1: Cycle Test mode through manual, automated and DCIR */
 		case 1:
-			testing_mode ^= 0x01;	// XOR operation to toggle lsb
+			testing_mode++;
+			if (testing_mode > 0x02) {testing_mode = 0x00;}	// back to manual after DCIR
 			display_settings_menu();
 			break;
 		/* LCD line 2: New screen to set load current */
@@ -109,14 +114,15 @@ void settings_menu_OK(void)
 			SETTING_CURRENT_STATE = LOAD_CURRENT_SETTINGS_SCREEN;
 			adjust_load_current_settings(NONE);
 			break;
-		/* LCD line 3: Set voltage precision in decimal places */
+		/* LCD line 3: Select acquisition profile */
 		case 3:
-			SETTING_CURRENT_STATE = VOLTAGE_PRECISION_SETTINGS_SCREEN;
-			adjust_voltage_precision_settings(NONE);
+			SETTING_CURRENT_STATE = ACQUISITION_PROFILE_SETTINGS_SCREEN;
+			adjust_acquisition_profile_settings(NONE);
 			break;
-		/* LCD line 4: Set battery type */
-			case 4:
-			asm volatile ("nop");	// Feature unavailable in this version...do nothing
+		/* LCD line 4: New screen to select battery type and cell count */
+		case 4:
+			SETTING_CURRENT_STATE = BATTERY_SETTINGS_SCREEN;
+			adjust_battery_settings(NONE);
 			break;
 		/* Default action is to do nothing */
 		default:
@@ -127,55 +133,147 @@ void settings_menu_OK(void)
 
 //***************************************************************************
 //
-// Function Name : "adjust_voltage_precision_settings"
+// Function Name : "adjust_acquisition_profile_settings"
 // Target MCU : AVR128DB48
 // DESCRIPTION
 //	Function to handle a pushbutton press while the settings state is 
-//	displaying the voltage precision setting in decimal places. Allows 
-//	the user to modify the number of decimal places to use when making 
-//	voltage measurements.
+//	displaying the acquisition profiles. Allows the user to select the
+//	profile used for cell and pack voltage measurements. The stepper
+//	control loop and the loaded snapshot always use their own profiles.
 //
 // Inputs : PB_INPUT_TYPE pb_type : Pushbutton input identifier
 //
 // Outputs : none
 //
 //**************************************************************************
-void adjust_voltage_precision_settings(PB_INPUT_TYPE pb_type)
+void adjust_acquisition_profile_settings(PB_INPUT_TYPE pb_type)
 {
-	/* OK pushbutton press -> increment precision, cannot exceed 3 decimal places */
-	if (PB_PRESS == OK)
+	/* OK pushbutton press -> select next profile, wraps around to the first */
+	if (pb_type == OK)
 	{		
-		if (voltage_precision == 0x00)
-		{
-			voltage_precision = 0x01;
-			VREF.ADC0REF = VREF_REFSEL_VDD_gc;
-			adc_vref = 3.3;
-		}
-		else if (voltage_precision == 0x01)
-		{					
-			voltage_precision = 0x00;
-			VREF.ADC0REF = VREF_REFSEL_2V048_gc;
-			adc_vref = 2.048;
-		}
-
-		/* Update LCD */
-		clear_lcd();
-		sprintf(dsp_buff[0], "Voltage Precision:  ");
-		if (voltage_precision == 0x00)
-			sprintf(dsp_buff[1], "HIGH PRECISION MODE ");
-		else
-			sprintf(dsp_buff[1], "LOW PRECISION MODE  ");
-		update_lcd();
+		/* ADC0 is reconfigured on the next cell read and the scan restarts from main() */
+		adc_cell_profile++;
+		if (adc_cell_profile >= ADC_PROFILE_COUNT)
+			adc_cell_profile = ADC_PROFILE_FAST;
+		display_acquisition_profiles();
 	}
 	/* BACK pushbutton press -> Return to settings menu */
-	else if (PB_PRESS == BACK)
+	else if (pb_type == BACK)
 	{
 		SETTING_CURRENT_STATE =	SCROLL_SETTINGS;
 		display_settings_menu();
 	}
+	/* Entering the screen -> show the profiles */
+	else if (pb_type == NONE)
+		display_acquisition_profiles();
 	else {asm volatile ("nop");}	// do nothing for UP/DOWN pushbutton presses
 }
 
+//***************************************************************************
+//
+// Function Name : "display_acquisition_profiles"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+//	Lists the acquisition profiles, one per line, with the last measured
+//	conversion time of each. An arrow marks the selected profile.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//**************************************************************************
+void display_acquisition_profiles(void)
+{
+	clear_lcd();
+	for (uint8_t i = 0; i < ADC_PROFILE_COUNT; i++)
+		sprintf(dsp_buff[i], "%-7s %5uus     ", adc_profiles[i].name, adc_profile_conversion_us[i]);
+	
+	/* Arrow pointing to selected profile */
+	dsp_buff[adc_cell_profile][18] = '<';
+	dsp_buff[adc_cell_profile][19] = '-';
+	update_lcd();
+}
+
+//***************************************************************************
+//
+// Function Name : "adjust_battery_settings"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+//	Function to handle a pushbutton press while the settings state is
+//	displaying the battery settings. UP/DOWN select the battery type or the
+//	number of cells in series, OK steps the selected one to its next value.
+//	A new battery type sets the load current to its default, a new cell
+//	count rebuilds the scan sequences. Both are stored in EEPROM.
+//
+// Inputs : PB_INPUT_TYPE pb_type : Pushbutton input identifier
+//
+// Outputs : none
+//
+//**************************************************************************
+void adjust_battery_settings(PB_INPUT_TYPE pb_type)
+{
+	switch (pb_type)
+	{
+		/* UP/DOWN pushbutton press -> switch between the two lines */
+		case UP:
+		case DOWN:
+			cursor = (cursor == 1) ? 2 : 1;
+			display_battery_settings();
+			break;
+		/* OK pushbutton press -> next battery type or cell count, wraps around */
+		case OK:
+			if (cursor == 1)
+			{
+				chemistry_select((chemistry_selected + 1) % CHEMISTRY_COUNT);
+				chemistry_save();
+				chemistry_apply_defaults();
+			}
+			else
+			{
+				cell_map_configure((cell_count >= CELL_COUNT_MAX) ? CELL_COUNT_MIN : (cell_count + 1));
+				cell_map_save();
+			}
+			display_battery_settings();
+			break;
+		/* BACK pushbutton press -> Return to settings menu */
+		case BACK:
+			cursor = 4;
+			SETTING_CURRENT_STATE = SCROLL_SETTINGS;
+			display_settings_menu();
+			break;
+		/* Entering the screen -> battery type selected */
+		default:
+			cursor = 1;
+			display_battery_settings();
+			break;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "display_battery_settings"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+//	Displays the battery type on line 1 and the number of cells in series
+//	on line 2, with an arrow on the selected line.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//**************************************************************************
+void display_battery_settings(void)
+{
+	clear_lcd();
+	sprintf(dsp_buff[0], "Type: %-6s        ", chemistry_active->name);
+	sprintf(dsp_buff[1], "Cells: %uS          ", cell_count);
+	
+	/* Append Cursor */
+	dsp_buff[cursor - 1][18] = '<';
+	dsp_buff[cursor - 1][19] = '-';
+	update_lcd();
+}
+
 //***************************************************************************
 //
 // Function Name : "adjust_load_current_settings"
@@ -318,13 +416,10 @@ void display_load_current_setting(void)
 //**************************************************************************
 void display_settings_menu(void)
 {
-	
-	if (cursor == 4) //roll over cursor if on last line
-		cursor = 1;
-	
 	clear_lcd();
 	if (testing_mode == 0x00)	   {sprintf(dsp_buff[0], "Mode: Manual        ");}
 	else if (testing_mode == 0x01) {sprintf(dsp_buff[0], "Mode: Automated     ");}
+	else if (testing_mode == 0x02) {sprintf(dsp_buff[0], "Mode: DCIR          ");}
 	if (current_setting >= 100)
 		sprintf(dsp_buff[1], "Load Current: %uA  ", current_setting);
 	else if (current_setting >= 10)
@@ -333,9 +428,9 @@ void display_settings_menu(void)
 		sprintf(dsp_buff[1], "Load Current: %uA    " , current_setting);
 	
 
-	sprintf(dsp_buff[2], "Voltage Precision   ");	
+	sprintf(dsp_buff[2], "Profile: %-7s    ", adc_profiles[adc_cell_profile].name);	
 		
-	sprintf(dsp_buff[3], "Battery Type: Li-Ion");	// feature unavailable, default is Li-Ion....
+	sprintf(dsp_buff[3], "Battery: %-6s %uS  ", chemistry_active->name, cell_count);
 
 	/* Append Cursor */
 	dsp_buff[cursor - 1][18] = '<';
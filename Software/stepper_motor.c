@@ -18,25 +18,7 @@ void A4988_init(void)
 	PORTC.DIR |= (PIN4_bm | PIN5_bm | PIN6_bm);	// Configure STEP, DIR, & SLEEP pins as outputs
 	PORTC.OUT &= ~(PIN4_bm | PIN5_bm);	// Initialize both logic levels to LOW
 	PORTC.OUT &= ~PIN6_bm;	// Sleep Stepper motor
-}
-//***************************************************************************
-//
-// Function Name : "A4988_step"
-// Target MCU : AVR128DB48
-// DESCRIPTION
-// Triggers a rising edge pulse to step the DRV8825
-//
-// Inputs : none
-//
-// Outputs : none
-//
-//**************************************************************************
-void A4988_step(void)
-{	
-	PORTC.OUT |= PIN4_bm;			// Rising edge on STEP pin
-	_delay_us(0.5 * STEP_PERIOD_US);	// delay for half PERIOD
-	PORTC.OUT &= ~PIN4_bm;			// Falling edge on STEP pin
-	_delay_us(0.5 * STEP_PERIOD_US);	// delay for half PERIOD
+	PWM_init();	// TCA1 generates the STEP pulses of a move
 }
 //***************************************************************************
 //
@@ -78,54 +60,156 @@ void A4988_dir_LOW(void)
 // Target MCU : AVR128DB48
 // DESCRIPTION
 // Continuously adjusts the stepper motor position until the load current 
-//	drawn from the battery is equal to the programmed value in amps
+//	drawn from the battery is equal to the programmed value in amps. The
+//	current comes from the undervoltage monitor sequence (FAST acquisition
+//	profile), the ADC0 window comparator watches the cells meanwhile and
+//	stops the knob as soon as one drops below min_loaded_voltage, the
+//	load is then opened here. The step
+//	rate comes from the PI controller (see "current_control.c"): fast far
+//	from the target, slow close to it, one reading per step, and never
+//	accelerating faster than the ramp of the motion profile so no step is
+//	lost. Each step is generated by TCA1 while the current for the next one
+//	is read. Once the position of the knob is known, a profiled move first
+//	jumps to the learned position of FEED_FORWARD_PERCENT of the target
+//	at the present unloaded pack voltage (see "position_map.c"), never past
+//	the position predicted for the target itself, and the PI loop only
+//	trims the rest. The map learns from the settled position and the
+//	prediction error is kept. The
+//	time to settle, the overshoot past the target and the steps taken are
+//	logged.
 //
-// Inputs : float target_current_amps: the specified load current
+// Inputs : int32_t target_current_ma: the specified load current in mA
 //
 // Outputs : none
 //
 //**************************************************************************
-void set_load_current(float target_current_amps)
+void set_load_current(int32_t target_current_ma)
 {	
 	PORTC.OUT |= PIN6_bm;	// Wake up Stepper motor
 	
-	load_current_amps = load_current_Read();
-	volatile float error = load_current_amps - target_current_amps;	// error between measured current and target current
+	ADC_monitor_start();
+	load_current_ma = ADC_monitor_current();
+	int32_t error = load_current_ma - target_current_ma;	// error between measured current and target current in mA
+	int32_t initial_error = error;
+	uint32_t start = timebase_ticks();
+	uint32_t overshoot = 0;
+	uint16_t period_us = STEP_PERIOD_MAX_US;
+	uint8_t direction = MOTION_CLOCKWISE;
+	uint16_t run = 0;	// steps in the same direction, the position on the ramp of the profile
+	control_state state = {0};
+	control_steps = 0;
+	uint8_t settled = 0x01;
+	int32_t tolerance = chemistry_active->current_tolerance_ma;
+	uint32_t sweep_us = (uint32_t)adc_monitor_length * adc_sample_period_us;	// one reading per step
+	uint16_t pack_mv = position_map_pack_mv();	// unloaded, the map is keyed by the conductance of the load
 
-	/* Remain in while loop until load current = target current +/- 10 amps */
-	while(fabs(error) > 1)
+	/* Feed forward to the learned position short of the target at the speed of the motion profile */
+	position_map_predicted = POSITION_MAP_UNKNOWN;
+	position_map_error = 0;
+	if ((motion_position_valid == 0x01) && (pack_mv != 0))
+	{
+		position_map_predicted = position_map_predict(target_current_ma, pack_mv);
+		int16_t approach = position_map_predict((target_current_ma * FEED_FORWARD_PERCENT) / 100, pack_mv);
+		
+		/* The predicted current at the approach must stay below the target, also where the learned bins are not in order */
+		if ((approach != POSITION_MAP_UNKNOWN) && (approach >= position_map_predicted))
+			approach = position_map_predicted - 1;
+		
+		if ((approach != POSITION_MAP_UNKNOWN) && (((error < -tolerance) && (approach > motion_position)) || ((error > tolerance) && (approach < motion_position))))
+		{
+			if (approach > motion_position)
+				motion_move_profiled(approach - motion_position, MOTION_CLOCKWISE, 0);
+			else
+				motion_move_profiled(motion_position - approach, MOTION_COUNTER_CLOCKWISE, 0);
+			motion_wait();
+			control_steps = motion_steps_done;
+			
+			load_current_ma = ADC_monitor_current();
+			error = load_current_ma - target_current_ma;
+			
+			/* A cell dropped below the floor on the way, the trip stopped the knob */
+			if (adc_monitor_tripped == 0x01)
+			{
+				open_circuit_load();
+				cancel_test = 0x01;
+				settled = 0x00;
+			}
+		}
+	}
+
+	/* Remain in while loop until load current = target current +/- the tolerance of the chemistry */
+	while((settled == 0x01) && ((error > tolerance) || (error < -tolerance)))
 	{	
 		/* Check if test needs to be canceled */
 		if (( (VPORTA_INTFLAGS & PIN3_bm) && (~VPORTD.IN & PIN3_bm) )  || USART3_RXDATAL == 'a')
 		{
 			/* Turn off load current and exit infinite while loop */
 			VPORTA_INTFLAGS |= PIN5_bm;
+			ADC_monitor_stop();
 			open_circuit_load();
 			cancel_test = 0x01;
 			LOCAL_INTERFACE_CURRENT_STATE = MAIN_MENU_STATE;
 			display_main_menu();
+			settled = 0x00;
 			break;	
 		}		
 		
-		/* Poll the load current reading from the shunt and calculate error signal */
-		load_current_amps = load_current_Read();
-		error = load_current_amps - target_current_amps;
-			
-		/* Turn knob CLOCK-WISE if load current is LESS than target value*/
-		if (error <= 0)
+		/* Poll the load current reading from the shunt and calculate error signal, the previous step is still in progress */
+		load_current_ma = ADC_monitor_current();
+		
+		/* A cell dropped below the floor, the trip stopped the knob */
+		if (adc_monitor_tripped == 0x01)
 		{
-			A4988_dir_HIGH();
+			open_circuit_load();
+			cancel_test = 0x01;
+			settled = 0x00;
+			break;
 		}
-		/* Turn knob COUNTER-CLOCK-WISE if load current is MORE than target value*/
-		else if (error >= 0)
+		error = load_current_ma - target_current_ma;
+		
+		/* Past the target, on the other side from where the loop started */
+		if (((initial_error < 0) && (error > 0)) || ((initial_error > 0) && (error < 0)))
 		{
-			A4988_dir_LOW();
+			uint32_t excursion = (error < 0) ? -error : error;
+			if (excursion > overshoot)
+				overshoot = excursion;
 		}
 		
-		/* Rotate the knob by one step of the NEMA-17 on each iteration */
-		A4988_step();
+		int32_t rate = control_step_rate(&state, -error, period_us, control_rate_limit(sweep_us, run));
+		period_us = control_step_period(rate);
+		
+		/* CLOCK-WISE if load current is LESS than target value, COUNTER-CLOCK-WISE if it is MORE */
+		uint8_t step_direction = (rate >= 0) ? MOTION_CLOCKWISE : MOTION_COUNTER_CLOCKWISE;
+		if (step_direction != direction)
+			run = 0;	// the knob reverses from standstill
+		direction = step_direction;
+		
+		/* No faster than the ramp of the motion profile allows after run steps */
+		if (period_us < motion_ramp_period(run))
+			period_us = motion_ramp_period(run);
+		if (run < MOTION_RAMP_STEPS_MAX)
+			run++;
+			
+		/* Rotate the knob by one step of the NEMA-17 on each iteration, at the rate of the controller */
+		motion_wait();
+		motion_move(1, 1000000UL / period_us, direction, 0);
+		control_steps++;
+	}
+	motion_wait();
+
+	/* Learn from where the knob settled, the map follows the wear of the pile */
+	if ((settled == 0x01) && (motion_position_valid == 0x01) && (pack_mv != 0))
+	{
+		if (position_map_predicted != POSITION_MAP_UNKNOWN)
+			position_map_error = motion_position - position_map_predicted;
+		position_map_learn(motion_position, load_current_ma, pack_mv);
+		position_map_save();
 	}
 
+	uint32_t settle_ms = TIMEBASE_TICKS_TO_MS(timebase_ticks() - start);
+	control_settle_ms = (settle_ms > 0xFFFF) ? 0xFFFF : settle_ms;
+	control_overshoot_ma = (overshoot > 0xFFFF) ? 0xFFFF : overshoot;
+	ADC_monitor_stop();
 	PORTC.OUT &= ~PIN6_bm;	// Sleep Stepper motor
 }
 
@@ -134,7 +218,24 @@ void set_load_current(float target_current_amps)
 // Function Name : "open_circuit_load"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// Sets the load to an open circuit so zero amps are drawn from the battery
+// Sets the load to an open circuit so zero amps are drawn from the battery.
+//	The current is taken from the monitor sequence of the scan sequencer
+//	(window comparator not armed), so the release shows up in the sag
+//	capture. A move that is still running is stopped first. With the
+//	position of the knob known, it drives straight back by the counted
+//	steps to OPEN_CIRCUIT_EXTRA_STEPS past the reference in one move at
+//	the speed of the motion profile. The current is only checked after
+//	every sweep as a confirmation. Otherwise, or if the pile still conducts
+//	after that move, TCA1 turns the knob continuously at the fixed
+//	MOTION_RATE_DEFAULT_SPS until the current falls below
+//	LOAD_CURRENT_OFF_MA. That search has no ramp, so it stops within the
+//	step in progress instead of decelerating past the point it looks for.
+//	Where the current falls below becomes the new reference of the knob
+//	position and the knob is parked OPEN_CIRCUIT_EXTRA_STEPS past it, in
+//	either direction, the extra steps are turned blind if the position is
+//	not known yet. The time from the call until the
+//	current fell below LOAD_CURRENT_OFF_MA is logged, 0 if the load was
+//	already open.
 //
 // Inputs : none
 //
@@ -143,25 +244,75 @@ void set_load_current(float target_current_amps)
 //**************************************************************************
 void open_circuit_load(void)
 {	
+	uint32_t start = timebase_ticks();
+	
+	motion_stop();
 	PORTC.OUT |= PIN6_bm;	// Wake up Stepper motor
-	A4988_dir_LOW();	// rotate knob COUNTER-CLOCK-WISE
-	load_current_amps = load_current_Read();
+	ADC_scan_start_sequence(adc_monitor_sequence, adc_monitor_length, ADC_PROFILE_FAST, adc_sample_period_us);
+	ADC_scan_wait_sweep();
+	load_current_ma = ADC_scan_latest_current();
+	uint8_t loaded = (load_current_ma > LOAD_CURRENT_OFF_MA) ? 0x01 : 0x00;
+	control_release_ms = 0;
+
+	/* Drive straight back by the counted steps, the current only confirms the release */
+	if ((motion_position_valid == 0x01) && (motion_position > -OPEN_CIRCUIT_EXTRA_STEPS))
+	{
+		motion_move_profiled(motion_position + OPEN_CIRCUIT_EXTRA_STEPS, MOTION_COUNTER_CLOCKWISE, 0);
+		while (motion_active == 0x01)
+		{
+			ADC_scan_wait_sweep();
+			motion_poll();
+			load_current_ma = ADC_scan_latest_current();
+			
+			/* The pile opened here, the reference follows its wear */
+			if ((loaded == 0x01) && (load_current_ma <= LOAD_CURRENT_OFF_MA))
+			{
+				motion_position_reference();
+				control_release_ms = TIMEBASE_TICKS_TO_MS(timebase_ticks() - start);
+				loaded = 0x00;
+			}
+		}
+		
+		/* Confirm with a sweep taken at the parked position, a release between the last sweeps keeps the reference */
+		ADC_scan_wait_sweep();
+		load_current_ma = ADC_scan_latest_current();
+		if ((loaded == 0x01) && (load_current_ma <= LOAD_CURRENT_OFF_MA))
+		{
+			control_release_ms = TIMEBASE_TICKS_TO_MS(timebase_ticks() - start);
+			loaded = 0x00;
+		}
+	}
 
 	/* Rotate knob until current is at minimum measurable value */
-	while(load_current_amps > 1)
+	while(load_current_ma > LOAD_CURRENT_OFF_MA)
 	{
-		/* Poll the load current reading from the shunt */
-		load_current_amps = load_current_Read();
+		loaded = 0x01;
+
+		/* Rotate the knob COUNTER-CLOCK-WISE until stopped, slow enough to start and stop without a ramp */
+		if (motion_active == 0x00)
+			motion_move(0xFFFF, MOTION_RATE_DEFAULT_SPS, MOTION_COUNTER_CLOCKWISE, 0);
 
-		/* Rotate the knob by one step of the NEMA-17 on each iteration */
-		A4988_step();
+		/* Poll the load current reading from the shunt */
+		ADC_scan_wait_sweep();
+		motion_poll();
+		load_current_ma = ADC_scan_latest_current();
 	}
+	if (loaded == 0x01)
+	{
+		motion_position_reference();	// steps still decelerating count from here
+		uint32_t release_ms = TIMEBASE_TICKS_TO_MS(timebase_ticks() - start);
+		control_release_ms = (release_ms > 0xFFFF) ? 0xFFFF : release_ms;
+	}
+	motion_stop();
 	
 	/* Complete one more half rotation to ensure carbon pile is completely OFF */
-	for(uint8_t i = 0; i < 50; i++) 
-	{ 
-		A4988_step();	
-	}
+	if (motion_position_valid == 0x00)
+		motion_move_profiled(OPEN_CIRCUIT_EXTRA_STEPS, MOTION_COUNTER_CLOCKWISE, 0);
+	else if (motion_position > -OPEN_CIRCUIT_EXTRA_STEPS)
+		motion_move_profiled(motion_position + OPEN_CIRCUIT_EXTRA_STEPS, MOTION_COUNTER_CLOCKWISE, 0);
+	else if (motion_position < -OPEN_CIRCUIT_EXTRA_STEPS)
+		motion_move_profiled(-OPEN_CIRCUIT_EXTRA_STEPS - motion_position, MOTION_CLOCKWISE, 0);	// coasted further, drive back
+	motion_wait();
 	
 	PORTC.OUT &= ~PIN6_bm;	// Sleep Stepper motor
 }
@@ -0,0 +1,146 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "stream_stats_reset"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Empties a streaming statistics accumulator.
+//
+// Inputs :
+//		stream_stats *stats: accumulator to empty
+//
+// Outputs : None
+//
+//**************************************************************************
+void stream_stats_reset(stream_stats *stats)
+{
+	stats->count = 0;
+	stats->mean = 0;
+	stats->m2 = 0;
+	stats->min = INT32_MAX;
+	stats->max = INT32_MIN;
+}
+
+//***************************************************************************
+//
+// Function Name : "stream_stats_add"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adds one sample with Welford's method: the mean moves by the deviation
+//	over the count and the sum of squared deviations grows by the product
+//	of the deviations from the old and the new mean, so no sample is kept
+//	and no sum of squares can lose the variance to rounding. All integer,
+//	the mean is kept in Q16 so it keeps moving once the deviation is
+//	smaller than the count, the deviations enter the sum of squares in Q8
+//	and the products are scaled back to the units of the samples. When the count is full
+//	the count and the sum of squared deviations are halved, the variance is
+//	unchanged and older samples weigh less from then on.
+//
+// Inputs :
+//		stream_stats *stats: accumulator
+//		int32_t value: sample, |value| below 2^22 (uV at the ADC pins, 0.1 C)
+//
+// Outputs : None
+//
+//**************************************************************************
+void stream_stats_add(stream_stats *stats, int32_t value)
+{
+	if (stats->count == STREAM_STATS_MAX_COUNT)
+	{
+		stats->count /= 2;
+		stats->m2 /= 2;
+	}
+	stats->count++;
+
+	int64_t value_q16 = (int64_t)value << 16;
+	int64_t delta = value_q16 - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += (((delta >> 8) * ((value_q16 - stats->mean) >> 8)) + 0x8000) >> 16;
+
+	if (value < stats->min)
+		stats->min = value;
+	if (value > stats->max)
+		stats->max = value;
+}
+
+//***************************************************************************
+//
+// Function Name : "stream_stats_mean"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the running mean rounded to the units of the samples.
+//
+// Inputs :
+//		const stream_stats *stats: accumulator
+//
+// Outputs :
+//		int32_t mean: mean in the units of the samples, 0 with no samples
+//
+//**************************************************************************
+int32_t stream_stats_mean(const stream_stats *stats)
+{
+	return (int32_t)((stats->mean + 0x8000) >> 16);
+}
+
+//***************************************************************************
+//
+// Function Name : "stream_stats_deviation"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the sample standard deviation, the square root of the sum of
+//	squared deviations over count - 1.
+//
+// Inputs :
+//		const stream_stats *stats: accumulator
+//
+// Outputs :
+//		uint32_t deviation: standard deviation in the units of the samples,
+//							0 with fewer than 2 samples
+//
+//**************************************************************************
+uint32_t stream_stats_deviation(const stream_stats *stats)
+{
+	if ((stats->count < 2) || (stats->m2 <= 0))
+		return 0;
+
+	return stream_stats_sqrt((uint64_t)stats->m2 / (stats->count - 1));
+}
+
+//***************************************************************************
+//
+// Function Name : "stream_stats_sqrt"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Bitwise integer square root, two bits of the value per iteration and no
+//	multiplication or division.
+//
+// Inputs :
+//		uint64_t value: radicand
+//
+// Outputs :
+//		uint32_t root: square root rounded down
+//
+//**************************************************************************
+uint32_t stream_stats_sqrt(uint64_t value)
+{
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value)
+		bit >>= 2;
+	while (bit != 0)
+	{
+		if (value >= (root + bit))
+		{
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)root;
+}
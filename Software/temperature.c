@@ -0,0 +1,113 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "temperature_apply"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Adjusts the ADC0 configuration of a temperature sensor conversion. The
+//	sensor needs a long sampling time, so the sample length is extended.
+//	The reference of the profile is kept, switching it for one slot would
+//	cost two reference settling waits per sweep; temperature_convert()
+//	scales the result to the 2.048 V reference of the factory calibration
+//	instead. The sensor is converted inside the sweep of the cells, no
+//	settling delay is added for it.
+//
+// Inputs :
+//		adc_config *config: configuration built from the acquisition profile
+//
+// Outputs : None
+//
+//**************************************************************************
+void temperature_apply(adc_config *config)
+{
+	config->mode = 0x00;
+	if (config->sampctrl < TEMPERATURE_SAMPCTRL)
+		config->sampctrl = TEMPERATURE_SAMPCTRL;
+}
+
+//***************************************************************************
+//
+// Function Name : "temperature_convert"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Converts a raw accumulated temperature sensor result to degrees Celsius
+//	with the factory calibration in the signature row (offset TEMPSENSE1,
+//	slope TEMPSENSE0). The calibration is taken on the 2.048 V reference,
+//	a result on another reference is scaled to it first (the VDD reference
+//	of WIDE assumes the nominal 3.3 V, so it is only as good as the supply).
+//	The accumulated result keeps the bits below one sample, so the offset is
+//	scaled up to it instead of averaging first.
+//
+// Inputs :
+//		uint16_t result: raw ADC0.RES value of SCAN_TEMPERATURE
+//		uint8_t profile: acquisition profile the result was taken with
+//
+// Outputs :
+//		int16_t temperature: die temperature in 0.1 degrees Celsius
+//
+//**************************************************************************
+int16_t temperature_convert(uint16_t result, uint8_t profile)
+{
+	uint8_t shift = adc_profiles[profile].shift;
+	uint32_t result_2v048 = (((uint32_t)result * ADC_profile_vref_mv(profile)) + 1024) / 2048;
+	int32_t counts = ((int32_t)SIGROW.TEMPSENSE1 << shift) - (int32_t)result_2v048;
+	int64_t kelvin_x10 = (int64_t)counts * SIGROW.TEMPSENSE0 * 10;
+
+	/* Sensor slope is in 1/4096 K per count, round to the nearest 0.1 K */
+	kelvin_x10 = (kelvin_x10 + (2048L << shift)) >> (12 + shift);
+	return (int16_t)(kelvin_x10 - 2732);
+}
+
+//***************************************************************************
+//
+// Function Name : "temperature_ambient"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the ambient temperature from the measurement cache. The sensor
+//	is on the die, away from the load, so with the analyzer idle it reads
+//	the air around the board. Call after ADC_cache_acquire().
+//
+// Inputs : None
+//
+// Outputs :
+//		int16_t temperature: ambient temperature in 0.1 degrees Celsius
+//
+//**************************************************************************
+int16_t temperature_ambient(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t result = adc_cache_raw[SCAN_TEMPERATURE];
+	uint8_t profile = adc_cache_profile[SCAN_TEMPERATURE];
+	SREG = sreg;
+
+	ambient_temperature_dc = temperature_convert(result, profile);
+	return ambient_temperature_dc;
+}
+
+//***************************************************************************
+//
+// Function Name : "temperature_record"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Rounds a temperature to the whole degrees stored with a test result,
+//	limited to the range of the record field.
+//
+// Inputs :
+//		int16_t temperature_dc: temperature in 0.1 degrees Celsius
+//
+// Outputs :
+//		int8_t temperature: temperature in degrees Celsius
+//
+//**************************************************************************
+int8_t temperature_record(int16_t temperature_dc)
+{
+	if (temperature_dc >= 1270)
+		return 127;
+	if (temperature_dc <= -1280)
+		return -128;
+	if (temperature_dc < 0)
+		return (temperature_dc - 5) / 10;
+	return (temperature_dc + 5) / 10;
+}
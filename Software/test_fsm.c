@@ -36,8 +36,16 @@ void test_fsm(void)
 				TEST_CURRENT_STATE = SCROLL_TEST_RESULT_MENU_T;
 				display_result_menu();
 			}
-			else //else stay in voltage reading menu
+			else if (PB_PRESS == OK) //if ok, show min/max of the sag capture
+			{
+				TEST_CURRENT_STATE = SAG_SUMMARY_T;
+				display_sag_summary();
+			}
+			else //else stay in voltage reading menu, UP/DOWN page through the cells
+			{
+				scroll_cell_page(PB_PRESS, current_test_result);
 				display_voltage_readings(current_test_result);
+			}
 			break;
 		case HEALTH_RATINGS_T: //if in health rating menu
 			if (PB_PRESS == BACK)  //if back, go back to test result menu
@@ -45,8 +53,25 @@ void test_fsm(void)
 				TEST_CURRENT_STATE = SCROLL_TEST_RESULT_MENU_T;
 				display_result_menu();
 			}
-			else //else stay in health rating menu
+			else if (PB_PRESS == OK) //if ok, show the balance of the cells
+			{
+				TEST_CURRENT_STATE = CELL_BALANCE_T;
+				display_cell_balance(current_test_result);
+			}
+			else //else stay in health rating menu, UP/DOWN page through the cells
+			{
+				scroll_cell_page(PB_PRESS, current_test_result);
 				display_health_ratings(current_test_result);
+			}
+			break;
+		case CELL_BALANCE_T: //cell balance page
+			if (PB_PRESS == BACK) //if back, go back to health rating menu
+			{
+				TEST_CURRENT_STATE = HEALTH_RATINGS_T;
+				display_health_ratings(current_test_result);
+			}
+			else //else stay on cell balance page
+				display_cell_balance(current_test_result);
 			break;
 		case TEST_CONDITIONS_T: //if in test conditions menu
 			if (PB_PRESS == BACK) //if back, go back to test result menu
@@ -69,6 +94,9 @@ void test_fsm(void)
 		case OVERWRITE_RESULTS: //overwrite old results
 			overwrite_previous_results(PB_PRESS);			
 			break;
+		case SAG_SUMMARY_T: //sag capture min/max
+			scroll_sag_summary(PB_PRESS);
+			break;
 		default:
 			break;
 	}
@@ -146,6 +174,9 @@ void scroll_test_result_menu(PB_INPUT_TYPE PB_PRESS, test_result result_data)
 //**************************************************************************
 void display_result_data(test_result result_data)
 {
+	/* Cell pages start at B1 */
+	cell_page = 0;
+	
 	/* Update display based on cursor position */
 	switch (cursor)
 	{
@@ -206,9 +237,9 @@ void display_result_data(test_result result_data)
 // Target MCU : AVR128DB48
 // DESCRIPTION
 // Display the conditions under which the test was performed. This includes
-//	the max load current that was drawn, the ambient temperature during the
-//	test, the date of the test, and whether it was a manual test or an 
-//	automated test.
+//	the max load current that was drawn, the battery chemistry, the ambient
+//	temperature during the test, the date of the test, and whether it was
+//	a manual, automated or DCIR test.
 //
 // Inputs  : test_result result_data : test result data struct
 //
@@ -217,13 +248,18 @@ void display_result_data(test_result result_data)
 //**************************************************************************
 void display_test_conditions(test_result result)
 {
+	chemistry_profile profile;
+
 	clear_lcd();
 
-	sprintf(dsp_buff[0], "Load Current: %u A   ", result.max_load_current);
-	sprintf(dsp_buff[2], "Amb Temp: 70 C       ", result.ampient_temp);
+	chemistry_profile_read(result.chemistry, &profile);
+	sprintf(dsp_buff[0], "Load: %3u A  %-6s ", result.max_load_current, profile.name);
+	sprintf(dsp_buff[2], "Amb Temp: %4d C    ", result.ampient_temp);
 	sprintf(dsp_buff[3], "Date: 2025/5/1      ", result.year, result.month, result.day);
 	if (result.test_mode == 0x00)
 		sprintf(dsp_buff[1], "Mode: Manual        ");
+	else if (result.test_mode == 0x02)
+		sprintf(dsp_buff[1], "Mode: DCIR          ");
 	else
 		sprintf(dsp_buff[1], "Mode: Automated     ");
 	update_lcd();
@@ -235,7 +271,8 @@ void display_test_conditions(test_result result)
 // DESCRIPTION
 // Display the loaded and unloaded battery cell voltages from the test. The
 // unloaded voltages are on the left column and the unloaded voltages are 
-//	on the right column.
+//	on the right column. One line per cell, the page of CELL_PAGE_CELLS
+//	cells is selected by cell_page.
 //
 // Inputs  : test_result result_data : test result data struct
 //
@@ -244,11 +281,16 @@ void display_test_conditions(test_result result)
 //**************************************************************************
 void display_voltage_readings(test_result result) 
 {
+	uint8_t cells = cell_count_checked(result.cell_count);
+	
 	clear_lcd();
-	sprintf(dsp_buff[0], "B1: %.3f  B1: %.3f", result.UNLOADED_battery_voltages[0], result.LOADED_battery_voltages[0]);
-	sprintf(dsp_buff[1], "B2: %.3f  B2: %.3f", result.UNLOADED_battery_voltages[1], result.LOADED_battery_voltages[1]);
-	sprintf(dsp_buff[2], "B3: %.3f  B3: %.3f", result.UNLOADED_battery_voltages[2], result.LOADED_battery_voltages[2]);
-	sprintf(dsp_buff[3], "B4: %.3f  B4: %.3f", result.UNLOADED_battery_voltages[3], result.LOADED_battery_voltages[3]);
+	for (uint8_t line = 0; line < 4; line++)
+	{
+		uint8_t i = (cell_page * CELL_PAGE_CELLS) + line;
+		if (i < cells)
+			sprintf(dsp_buff[line], "B%u: %u.%03u  B%u: %u.%03u", i + 1, MV_WHOLE(result.UNLOADED_battery_voltages[i]), MV_FRAC(result.UNLOADED_battery_voltages[i]),
+					i + 1, MV_WHOLE(result.LOADED_battery_voltages[i]), MV_FRAC(result.LOADED_battery_voltages[i]));
+	}
 	update_lcd();
 }
 
@@ -257,11 +299,10 @@ void display_voltage_readings(test_result result)
 // Function Name : "decode_health_rating"
 // Target MCU : AVR128DB48
 // DESCRIPTION
-// Assigns health ratings to a quad pack based on the loaded voltages. This
-//	function calculates the largest threshold from the grading table that the
-//	loaded voltage is greater than or equal to and assigns a health rating. 
-//	An index is then used to load the string for that health rating from a 
-//	look-up table. 
+// Writes the health ratings of a pack into the character buffer. The
+//	grades were assigned once by health_grade_result() when the test
+//	finished and are only looked up here. A record without valid grades,
+//	e.g. an erased EEPROM entry, is graded from its loaded voltages.
 //
 // Inputs  : test_result result_data : test result data struct
 //
@@ -270,24 +311,12 @@ void display_voltage_readings(test_result result)
 //**************************************************************************
 void decode_health_rating(test_result result)
 {
-	uint8_t lut_idx = 0;	// index to lut containing health rating strings
-	float rating_threshold = 2.9;	// minimum threshold for A = 2.9
-	
-	/* Determine health rating of all 4 battery cells in the quad pack */
-	for (uint8_t i = 0; i < 4; i++)		// outer for loop, 4 battery cells
+	/* Look up the health rating of all battery cells in the pack */
+	for (uint8_t i = 0; i < cell_count_checked(result.cell_count); i++)		// outer for loop, one per battery cell
 	{
-		rating_threshold = 2.9;	// minimum threshold for A = 2.9
-		lut_idx = 0;
-		/* Loop until threshold falls below 1.69, F, or loaded voltage no longer meets minimum threshold */
-		while ( (rating_threshold > 1.69) && (rating_threshold >= result.LOADED_battery_voltages[i]) )
-		{
-			/* Compare loaded voltage with threshold to determine health rating */
-			if (result.LOADED_battery_voltages[i] < rating_threshold)
-			{
-				lut_idx++;	// Incrementing lut index lowers rating
-				rating_threshold -= 0.1;	// lower threshold to compare with a lower health rating
-			}
-		}	
+		uint8_t lut_idx = result.health_grades[i];	// index to lut containing health rating strings
+		if (lut_idx >= HEALTH_GRADES)
+			lut_idx = health_grade(result.LOADED_battery_voltages[i]);
 		
 		/* Copy health rating strings from look-up table into buffer array */
 		for (uint8_t j = 0; j < 2; j++)	// inner for loop, 3 characters per health rating
@@ -303,7 +332,10 @@ void decode_health_rating(test_result result)
 // Target MCU : AVR128DB48
 // DESCRIPTION
 // Calls the function to assign health ratings to the battery cells and then
-//	displays them on the screen.
+//	displays them on the screen, with the internal resistance of each cell
+//	in mOhm when the result comes from a DCIR test. The page of
+//	CELL_PAGE_CELLS cells is selected by cell_page. OK opens the cell
+//	balance page.
 //
 // Inputs  : test_result result_data : test result data struct
 //
@@ -315,15 +347,49 @@ void display_health_ratings(test_result result)
 	/* Write health ratings into character buffer */
 	decode_health_rating(result);
 	
-	/* Update display, array index mapping of char buffer: [0:1]->B1, [2:3]->B2, [4:5]->B3, [6:7]->B4 */
+	/* Update display, array index mapping of char buffer: [0:1]->B1, [2:3]->B2, ... [14:15]->B8 */
+	uint8_t cells = cell_count_checked(result.cell_count);
+	
 	clear_lcd();
-	sprintf(dsp_buff[0], "B1: %c%c              ", health_rating_characters[0],health_rating_characters[1]);
-	sprintf(dsp_buff[1], "B2: %c%c              ", health_rating_characters[2],health_rating_characters[3]);
-	sprintf(dsp_buff[2], "B3: %c%c              ", health_rating_characters[4],health_rating_characters[5]);
-	sprintf(dsp_buff[3], "B4: %c%c              ", health_rating_characters[6],health_rating_characters[7]);
+	for (uint8_t line = 0; line < 4; line++)
+	{
+		uint8_t i = (cell_page * CELL_PAGE_CELLS) + line;
+		if (i >= cells)
+			break;
+		if (result.dcir_uohm[i] != 0)
+			sprintf(dsp_buff[line], "B%u: %c%c   %2u.%03umOhm", i + 1, health_rating_characters[2*i], health_rating_characters[(2*i) + 1],
+					result.dcir_uohm[i] / 1000, result.dcir_uohm[i] % 1000);
+		else
+			sprintf(dsp_buff[line], "B%u: %c%c              ", i + 1, health_rating_characters[2*i], health_rating_characters[(2*i) + 1]);
+	}
 	update_lcd();
 }
 
+//***************************************************************************
+//
+// Function Name : "scroll_cell_page"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Moves the voltage and health rating screens to the next (DOWN) or
+//	previous (UP) page of CELL_PAGE_CELLS cells, wrapping around. Packs of
+//	up to 4 cells have a single page.
+//
+// Inputs  : PB_INPUT_TYPE pb_type   : Pushbutton press identifier
+//			 test_result result_data : test result data struct
+//
+// Outputs : none
+//
+//**************************************************************************
+void scroll_cell_page(PB_INPUT_TYPE pb_type, test_result result)
+{
+	uint8_t pages = (cell_count_checked(result.cell_count) + CELL_PAGE_CELLS - 1) / CELL_PAGE_CELLS;
+	
+	if (pb_type == DOWN)
+		cell_page = (cell_page + 1) % pages;
+	else if (pb_type == UP)
+		cell_page = (cell_page == 0) ? (pages - 1) : (cell_page - 1);
+}
+
 //***************************************************************************
 //
 // Function Name : "display_result_menu"
@@ -416,7 +482,7 @@ void overwrite_previous_results(PB_INPUT_TYPE pb_type)
 	if (pb_type == OK)
 	{
 		/* Store data in EEPROM slot pointed to be quad pack entry index */
-		eeprom_update_block(&current_test_result, &test_results_history_eeprom[quad_pack_entry], sizeof(test_result));		
+		test_history_save(quad_pack_entry);
 		/* Return to main menu */
 		cursor = 1;		// Initialize cursor to line 1
 		quad_pack_entry = 0;	// Initialize quad pack entry to 1. Row index to 2D array, 0 is index to 1st entry
@@ -457,15 +523,33 @@ void overwrite_previous_results(PB_INPUT_TYPE pb_type)
 //**************************************************************************
 void perform_test(void)
 {	
-	// Read load current
-	load_current_amps = load_current_Read();
+	// Zero the shunt channel while the load is still open
+	calibration_auto_zero(0x00);
 	
-	/* Manual or automated test? */
+	// Read load current, reuses the sweep of the safety check when it is fresh
+	ADC_cache_acquire();
+	load_current_ma = ADC_cache_load_current();
+	
+	/* Chemistry the test runs with, no internal resistance unless the DCIR test measures it */
+	current_test_result.chemistry = chemistry_selected;
+	for (uint8_t i = 0; i < CELL_COUNT_MAX; i++)
+		current_test_result.dcir_uohm[i] = 0;
+	
+	/* Manual, automated or DCIR test? */
 	if (testing_mode == 0x01)
 		automated_test();
+	else if (testing_mode == 0x02)
+		dcir_test();
 	else
 		manual_test();
 
+	// Canceled or tripped -> the test already returned to the main menu, nothing to grade
+	if (LOCAL_INTERFACE_CURRENT_STATE != TEST_STATE)
+		return;
+
+	// Grade the cells once, the grades are kept with the result
+	health_grade_result(&current_test_result);
+	
 	// Proceed to next state -> display test results
 	TEST_CURRENT_STATE = SCROLL_TEST_RESULT_MENU_T;	
 	display_result_menu();
@@ -496,14 +580,22 @@ void automated_test(void)
 	sprintf(dsp_buff[3], "                    ");
 	update_lcd();
 
+	/* Record the sag curve of the whole test */
+	sag_capture_start();
+
 	/* Perform loaded and unloaded tests */
 	read_UNLOADED_battery_voltages();
-	set_load_current(current_setting);
+	set_load_current((int32_t)current_setting * 1000);
 	
 	/* Check if test was canceled */
 	if (cancel_test == 0x01)
 	{		
+		/* Undervoltage trip during the ramp -> show which cell tripped and at what current */
+		if (adc_monitor_tripped == 0x01)
+			display_undervoltage_trip();
+		
 		/* Clear cancel flag and return to main menu */
+		sag_capture_stop();
 		cancel_test = 0x00;	
 		LOCAL_INTERFACE_CURRENT_STATE = MAIN_MENU_STATE;
 		display_main_menu();
@@ -516,18 +608,20 @@ void automated_test(void)
 		buzzer_ON();
 
 		/* Record Test conditions */
-		current_test_result.max_load_current = load_current_amps;
+		current_test_result.max_load_current = MA_WHOLE(load_current_ma);
 		current_test_result.test_mode = 0x01;
 
 		open_circuit_load();
-		_delay_ms(1000);
+		current_test_result.release_ms = control_release_ms;
+		ADC_scan_poll_ms(1000);	// keep capturing while the cells recover
 		buzzer_OFF();
+		sag_capture_stop();
 	
 		/* Display message indicating test is complete */
 		clear_lcd();
 		sprintf(dsp_buff[0], "Automated Test is   ");
 		sprintf(dsp_buff[1], "Complete...         ");
-		sprintf(dsp_buff[2], "Load Current: %.1fA  ", load_current_amps);
+		sprintf(dsp_buff[2], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		sprintf(dsp_buff[3], "                    ");
 		update_lcd();
 	
@@ -535,6 +629,126 @@ void automated_test(void)
 	}
 }
 
+//***************************************************************************
+//
+// Function Name : "dcir_test"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Measures the DC internal resistance of every cell. The unloaded voltages
+//	are the first point, then the load is stepped up through the plateaus
+//	of dcir_step_percent[] of the programmed current. At each plateau all
+//	cells are sampled with the loaded snapshot and added to the least-squares
+//	fit with the current at the moment the cell was sampled, so the
+//	resistances are up to date after every plateau and shown while the test
+//	runs. The last plateau is the programmed current and provides the
+//	LOADED voltages of the record, as in the automated test.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//**************************************************************************
+void dcir_test(void)
+{
+	/* Record the sag curve of the whole test */
+	sag_capture_start();
+	
+	/* Unloaded point: the open-circuit voltage at the load current read before the test */
+	read_UNLOADED_battery_voltages();
+	dcir_fit_reset();
+	for (uint8_t i = 0; i < cell_count; i++)
+		dcir_fit_add(i, load_current_ma, current_test_result.UNLOADED_battery_voltages[i]);
+	
+	for (uint8_t step = 0; step < DCIR_STEPS; step++)
+	{
+		/* Display progress and the fit so far, above 4 cells the steps alternate between the pages */
+		uint8_t first = (step % ((cell_count + CELL_PAGE_CELLS - 1) / CELL_PAGE_CELLS)) * CELL_PAGE_CELLS;
+		clear_lcd();
+		sprintf(dsp_buff[0], "DCIR Test Step %u/%u  ", step + 1, DCIR_STEPS);
+		for (uint8_t row = 0; row < 2; row++)
+		{
+			uint8_t i = first + (2*row);
+			if ((i + 1) < cell_count)
+				sprintf(dsp_buff[row + 1], "B%u %2u.%03u B%u %2u.%03u", i + 1, current_test_result.dcir_uohm[i] / 1000, current_test_result.dcir_uohm[i] % 1000,
+						i + 2, current_test_result.dcir_uohm[i + 1] / 1000, current_test_result.dcir_uohm[i + 1] % 1000);
+			else if (i < cell_count)
+				sprintf(dsp_buff[row + 1], "B%u %2u.%03u          ", i + 1, current_test_result.dcir_uohm[i] / 1000, current_test_result.dcir_uohm[i] % 1000);
+		}
+		sprintf(dsp_buff[3], "DCIR in mOhm        ");
+		update_lcd();
+		
+		set_load_current(((int32_t)current_setting * 1000 * dcir_step_percent[step]) / 100);
+		
+		/* Canceled or undervoltage trip -> abort, the load is already open */
+		if (cancel_test == 0x01)
+		{
+			if (adc_monitor_tripped == 0x01)
+				display_undervoltage_trip();
+			
+			sag_capture_stop();
+			cancel_test = 0x00;
+			LOCAL_INTERFACE_CURRENT_STATE = MAIN_MENU_STATE;
+			display_main_menu();
+			return;
+		}
+		
+		/* Hold the plateau, then add one point per cell and update the fit */
+		ADC_scan_poll_ms(DCIR_PLATEAU_MS);
+		read_LOADED_battery_voltages();
+		for (uint8_t i = 0; i < cell_count; i++)
+		{
+			dcir_fit_add(i, loaded_cell_current_ma[i], current_test_result.LOADED_battery_voltages[i]);
+			current_test_result.dcir_uohm[i] = dcir_fit_resistance(i);
+		}
+	}
+	
+	buzzer_ON();
+	
+	/* Record Test conditions */
+	current_test_result.max_load_current = MA_WHOLE(load_current_ma);
+	current_test_result.test_mode = 0x02;
+	
+	open_circuit_load();
+	current_test_result.release_ms = control_release_ms;
+	ADC_scan_poll_ms(1000);	// keep capturing while the cells recover
+	buzzer_OFF();
+	sag_capture_stop();
+	
+	/* Display message indicating test is complete */
+	clear_lcd();
+	sprintf(dsp_buff[0], "DCIR Test is        ");
+	sprintf(dsp_buff[1], "Complete...         ");
+	sprintf(dsp_buff[2], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
+	sprintf(dsp_buff[3], "                    ");
+	update_lcd();
+	
+	_delay_ms(2000);
+}
+
+//***************************************************************************
+//
+// Function Name : "display_undervoltage_trip"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Shows which cell tripped the undervoltage monitor during a load ramp and
+//	at what current, for two seconds.
+//
+// Inputs : none
+//
+// Outputs : none
+//
+//**************************************************************************
+void display_undervoltage_trip(void)
+{
+	clear_lcd();
+	sprintf(dsp_buff[0], "Undervoltage Trip   ");
+	sprintf(dsp_buff[1], "Cell %u below %u.%02uV  ", adc_monitor_trip_cell, MV_WHOLE(chemistry_active->min_loaded_mv), MV_FRAC(chemistry_active->min_loaded_mv) / 10);
+	snprintf(dsp_buff[2], sizeof dsp_buff[2], "Load Current: %uA   ", adc_monitor_trip_current);	// padding is cut at 100 A and above, row stays 20 characters
+	sprintf(dsp_buff[3], "Test Aborted...     ");
+	update_lcd();
+	_delay_ms(2000);
+}
+
 //***************************************************************************
 //
 // Function Name : "manual_test"
@@ -553,54 +767,59 @@ void automated_test(void)
 //**************************************************************************
 void manual_test(void)
 {
+	/* Record the sag curve of the whole test, the scan keeps running through the delays */
+	sag_capture_start();
+	
 	// read voltage of each cell and store in array when unloaded
 	read_UNLOADED_battery_voltages();
 	
-	// Read load current
-	load_current_amps = load_current_Read();
+	// Read load current, a cache hit leaves the scan as it was -> keep it running for the loops below
+	load_current_ma = ADC_cache_load_current();
+	ADC_scan_start();
 	
 	/* Tell user to rotate knob of carbon pile until beep indicates limit... */
 	clear_lcd();
 	sprintf(dsp_buff[0], "Rotate Knob Until   ");
 	sprintf(dsp_buff[1], "Beeping Sound is    ");
 	sprintf(dsp_buff[2], "Heard...            ");
-	sprintf(dsp_buff[3], "Load Current: %.1fA  ", load_current_amps);
+	sprintf(dsp_buff[3], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 	update_lcd();
 	
 	/* Infinite loop until current reaches current limit */
-	while (load_current_amps < current_setting)	
+	while (load_current_ma < ((int32_t)current_setting * 1000))	
 	{
 		/* Check if BACK button is pressed to cancel the manual test */
 		if (VPORTA_INTFLAGS & PIN3_bm)
 		{
 			/* Infinite while loop until user turns off carbon pile load */
-			while (load_current_amps > 1)
+			while (load_current_ma > LOAD_CURRENT_OFF_MA)
 			{
 				/* Tell user to turn off carbon pile load... */
-				load_current_amps = load_current_Read();
-				_delay_ms(50);	// delay to prevent LCD to updating too fast
+				load_current_ma = ADC_scan_latest_current();
+				ADC_scan_poll_ms(50);	// delay to prevent LCD to updating too fast
 				clear_lcd();
 				sprintf(dsp_buff[0], "Test Canceled...    ");
 				sprintf(dsp_buff[1], "Rotate Knob Until   ");
 				sprintf(dsp_buff[2], "Beeping Stops...    ");
-				sprintf(dsp_buff[3], "Load Current: %.1fA  ", load_current_amps);
+				sprintf(dsp_buff[3], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 				update_lcd();
 			}
 			
 			/* Return to main menu */
+			sag_capture_stop();
 			LOCAL_INTERFACE_CURRENT_STATE = MAIN_MENU_STATE;
 			display_main_menu();
 			return;			
 		}
 		
 		/* Update current reading on display */
-		load_current_amps = load_current_Read();
-		_delay_ms(50);	// delay to prevent LCD to updating too fast
+		load_current_ma = ADC_scan_latest_current();
+		ADC_scan_poll_ms(50);	// delay to prevent LCD to updating too fast
 		clear_lcd();
 		sprintf(dsp_buff[0], "Rotate Knob Until   ");
 		sprintf(dsp_buff[1], "Beeping Sound is    ");
 		sprintf(dsp_buff[2], "Heard...            ");
-		sprintf(dsp_buff[3], "Load Current: %.1fA  ", load_current_amps);
+		sprintf(dsp_buff[3], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		update_lcd();
 	}
 	
@@ -608,26 +827,28 @@ void manual_test(void)
 	read_LOADED_battery_voltages();
 
 	/* Record Test conditions */
-	current_test_result.max_load_current = load_current_amps;
+	current_test_result.max_load_current = MA_WHOLE(load_current_ma);
 	current_test_result.test_mode = 0x00;
 	
 
 	/* Make buzzer beep until current is below 1A */
-	while (load_current_amps > 1)
+	while (load_current_ma > LOAD_CURRENT_OFF_MA)
 	{
 		/* Tell user to turn off carbon pile load... */
-		load_current_amps = load_current_Read();
-		_delay_ms(50);	// delay to prevent LCD to updating too fast
+		load_current_ma = ADC_scan_latest_current();
+		ADC_scan_poll_ms(50);	// delay to prevent LCD to updating too fast
 		clear_lcd();
 		sprintf(dsp_buff[0], "Test Complete...    ");
 		sprintf(dsp_buff[1], "Rotate Knob Until   ");
 		sprintf(dsp_buff[2], "Beeping Stops...    ");
-		sprintf(dsp_buff[3], "Load Current: %.1fA  ", load_current_amps);
+		sprintf(dsp_buff[3], "Load Current: %ld.%ldA  ", MA_WHOLE(load_current_ma), MA_TENTHS(load_current_ma));
 		update_lcd();
 		
 		buzzer_ON();
-		_delay_ms(1000);	    // wait 1 second
+		ADC_scan_poll_ms(1000);	    // wait 1 second
 		buzzer_OFF();
-		_delay_ms(1000);		// wait 1 second
+		ADC_scan_poll_ms(1000);		// wait 1 second
 	}
+	
+	sag_capture_stop();
 }
@@ -0,0 +1,162 @@
+#include "main.h"
+
+/* The record sizes counted by hand in main.h must match the fields test_record_fields() copies */
+typedef char test_record_fixed_size[(TEST_RECORD_FIXED_BYTES == (2 + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t) + sizeof(int8_t) + 3 + (2 * sizeof(cell_balance)) + sizeof(uint16_t) + sizeof(uint8_t) + (3 * sizeof(uint16_t)))) ? 1 : -1];
+typedef char test_record_cell_size[(TEST_RECORD_CELL_BYTES == ((4 * sizeof(uint16_t)) + sizeof(uint8_t))) ? 1 : -1];
+
+/* The history must hold at least one record of the largest pack */
+typedef char test_history_fits_record[(TEST_HISTORY_BYTES >= TEST_RECORD_BYTES(CELL_COUNT_MAX)) ? 1 : -1];
+
+//***************************************************************************
+//
+// Function Name : "test_record_field"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Copies one field between a test_result and a packed record and moves the
+//	record position past it. The same field order packs and unpacks.
+//
+// Inputs :
+//		uint8_t **record: position in the packed record
+//		volatile void *field: field of the test_result
+//		uint8_t size: bytes of the field
+//		uint8_t pack: 0x01 -> field into the record, 0x00 -> record into the field
+//
+// Outputs : None
+//
+//**************************************************************************
+static void test_record_field(uint8_t **record, volatile void *field, uint8_t size, uint8_t pack)
+{
+	if (pack == 0x01)
+		memcpy(*record, (void *)field, size);
+	else
+		memcpy((void *)field, *record, size);
+	*record += size;
+}
+
+//***************************************************************************
+//
+// Function Name : "test_record_fields"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Walks the fields of current_test_result in record order: version and
+//	cell count, the fields that do not depend on the cell count, then the
+//	per cell fields of cell_count cells only.
+//
+// Inputs :
+//		uint8_t *record: packed record, TEST_RECORD_BYTES(cells) long
+//		uint8_t cells: cells in the record
+//		uint8_t pack: 0x01 -> current_test_result into the record, 0x00 -> record into current_test_result
+//
+// Outputs : None
+//
+//**************************************************************************
+static void test_record_fields(uint8_t *record, uint8_t cells, uint8_t pack)
+{
+	record += 2;	// version and cell count, handled by the callers
+	test_record_field(&record, &current_test_result.chemistry, sizeof(uint8_t), pack);
+	test_record_field(&record, &current_test_result.test_mode, sizeof(uint8_t), pack);
+	test_record_field(&record, &current_test_result.max_load_current, sizeof(uint16_t), pack);
+	test_record_field(&record, &current_test_result.ampient_temp, sizeof(int8_t), pack);
+	test_record_field(&record, &current_test_result.year, sizeof(uint8_t), pack);
+	test_record_field(&record, &current_test_result.month, sizeof(uint8_t), pack);
+	test_record_field(&record, &current_test_result.day, sizeof(uint8_t), pack);
+	test_record_field(&record, &current_test_result.unloaded_balance, sizeof(cell_balance), pack);
+	test_record_field(&record, &current_test_result.loaded_balance, sizeof(cell_balance), pack);
+	test_record_field(&record, &current_test_result.sag_permille, sizeof(uint16_t), pack);
+	test_record_field(&record, &current_test_result.sag_cell, sizeof(uint8_t), pack);
+	test_record_field(&record, &current_test_result.settle_ms, sizeof(uint16_t), pack);
+	test_record_field(&record, &current_test_result.overshoot_ma, sizeof(uint16_t), pack);
+	test_record_field(&record, &current_test_result.release_ms, sizeof(uint16_t), pack);
+
+	for (uint8_t i = 0; i < cells; i++)
+	{
+		test_record_field(&record, &current_test_result.UNLOADED_battery_voltages[i], sizeof(uint16_t), pack);
+		test_record_field(&record, &current_test_result.LOADED_battery_voltages[i], sizeof(uint16_t), pack);
+		test_record_field(&record, &current_test_result.LOADED_load_currents[i], sizeof(uint16_t), pack);
+		test_record_field(&record, &current_test_result.dcir_uohm[i], sizeof(uint16_t), pack);
+		test_record_field(&record, &current_test_result.health_grades[i], sizeof(uint8_t), pack);
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "test_history_configure"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Sizes the history for the configured cell count. The records are packed
+//	to cell_count cells, so the history holds as many of them as fit
+//	TEST_HISTORY_BYTES: 8 at 2S, 6 at 4S, 3 at 8S. Changing the cell count
+//	changes the slot size, the records of another cell count then read as
+//	empty. Called by cell_map_configure().
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void test_history_configure(void)
+{
+	test_history_entries = TEST_HISTORY_BYTES / TEST_RECORD_BYTES(cell_count);
+	if (quad_pack_entry >= test_history_entries)
+		quad_pack_entry = 0;
+}
+
+//***************************************************************************
+//
+// Function Name : "test_history_save"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Packs current_test_result into a record of the configured cell count and
+//	writes it to a history entry, only bytes that changed are written.
+//
+// Inputs :
+//		uint8_t entry: history entry, 0..test_history_entries-1
+//
+// Outputs : None
+//
+//**************************************************************************
+void test_history_save(uint8_t entry)
+{
+	uint8_t record[TEST_RECORD_BYTES(CELL_COUNT_MAX)];
+	uint8_t cells = cell_count;
+
+	if (entry >= test_history_entries)
+		return;
+
+	record[0] = TEST_RECORD_VERSION;
+	record[1] = cells;
+	current_test_result.cell_count = cells;
+	test_record_fields(record, cells, 0x01);
+	eeprom_update_block(record, &test_history_eeprom[entry * TEST_RECORD_BYTES(cells)], TEST_RECORD_BYTES(cells));
+}
+
+//***************************************************************************
+//
+// Function Name : "test_history_load"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Reads a history entry into current_test_result. An entry of another
+//	layout version or cell count, erased EEPROM included, reads as an empty
+//	result of the configured cell count.
+//
+// Inputs :
+//		uint8_t entry: history entry, 0..test_history_entries-1
+//
+// Outputs : None
+//
+//**************************************************************************
+void test_history_load(uint8_t entry)
+{
+	uint8_t record[TEST_RECORD_BYTES(CELL_COUNT_MAX)];
+	uint8_t cells = cell_count;
+
+	if (entry >= test_history_entries)
+		return;
+
+	eeprom_read_block(record, &test_history_eeprom[entry * TEST_RECORD_BYTES(cells)], TEST_RECORD_BYTES(cells));
+	if ((record[0] != TEST_RECORD_VERSION) || (record[1] != cells))
+		memset(record, 0, sizeof(record));
+
+	current_test_result.cell_count = cells;
+	test_record_fields(record, cells, 0x00);
+}
@@ -0,0 +1,100 @@
+#include "main.h"
+
+//***************************************************************************
+//
+// Function Name : "ISR(RTC_CNT_vect)"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// RTC overflow interrupt, extends the 16-bit RTC count to 32 bits while
+//	global interrupts are enabled.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+ISR(RTC_CNT_vect)
+{
+	timebase_service();
+}
+
+//***************************************************************************
+//
+// Function Name : "timebase_init"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Starts the RTC as a free running timebase clocked from the internal
+//	32.768 kHz oscillator, one tick = 30.5 us. The counter keeps running
+//	while the FSMs execute with interrupts disabled.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void timebase_init(void)
+{
+	timebase_overflows = 0;
+
+	while (RTC.STATUS & RTC_CTRLABUSY_bm);	// wait for RTC to synchronize
+	RTC.CLKSEL = RTC_CLKSEL_OSC32K_gc;		// 32.768 kHz internal oscillator
+	RTC.PER = 0xFFFF;						// count the full 16 bits
+	RTC.INTCTRL = RTC_OVF_bm;				// overflow interrupt
+	RTC.CTRLA = (RTC_PRESCALER_DIV1_gc | RTC_RTCEN_bm);
+}
+
+//***************************************************************************
+//
+// Function Name : "timebase_service"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Counts an RTC overflow if one is pending. Called from the overflow ISR
+//	and from timebase_ticks(), so the timebase stays correct while global
+//	interrupts are disabled as long as it is read at least every 2 seconds.
+//
+// Inputs : None
+//
+// Outputs : None
+//
+//**************************************************************************
+void timebase_service(void)
+{
+	if (RTC.INTFLAGS & RTC_OVF_bm)
+	{
+		RTC.INTFLAGS = RTC_OVF_bm;	// clear overflow flag
+		timebase_overflows++;
+	}
+}
+
+//***************************************************************************
+//
+// Function Name : "timebase_ticks"
+// Target MCU : AVR128DB48
+// DESCRIPTION
+// Returns the 32-bit timebase count in RTC ticks (TIMEBASE_HZ per second).
+//
+// Inputs : None
+//
+// Outputs :
+//		uint32_t ticks: RTC ticks since timebase_init()
+//
+//**************************************************************************
+uint32_t timebase_ticks(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+
+	timebase_service();
+	uint16_t count = RTC.CNT;
+
+	/* Counter overflowed between the flag check and the read -> read again */
+	if (RTC.INTFLAGS & RTC_OVF_bm)
+	{
+		timebase_service();
+		count = RTC.CNT;
+	}
+	uint32_t ticks = ((uint32_t)timebase_overflows << 16) | count;
+
+	SREG = sreg;
+	return ticks;
+}
@@ -29,8 +29,11 @@ void view_history_fsm(void)
 				VIEW_HISTORY_CURRENT_STATE = SCROLL_TEST_RESULT_MENU_H;
 				scroll_test_result_menu(NONE, current_test_result);
 			}
-			else //else stay on voltage readings screen
+			else //else stay on voltage readings screen, UP/DOWN page through the cells
+			{
+				scroll_cell_page(PB_PRESS, current_test_result);
 				display_voltage_readings(current_test_result);
+			}
 			break;
 		case HEALTH_RATINGS_H: //health ratings screen
 			if (PB_PRESS == BACK) //if back is pressed, go back to test result menu
@@ -38,8 +41,25 @@ void view_history_fsm(void)
 				VIEW_HISTORY_CURRENT_STATE = SCROLL_TEST_RESULT_MENU_H;
 				scroll_test_result_menu(NONE, current_test_result);
 			}
-			else //else stay on health ratings screen
+			else if (PB_PRESS == OK) //if ok, show the balance of the cells
+			{
+				VIEW_HISTORY_CURRENT_STATE = CELL_BALANCE_H;
+				display_cell_balance(current_test_result);
+			}
+			else //else stay on health ratings screen, UP/DOWN page through the cells
+			{
+				scroll_cell_page(PB_PRESS, current_test_result);
+				display_health_ratings(current_test_result);
+			}
+			break;
+		case CELL_BALANCE_H: //cell balance screen
+			if (PB_PRESS == BACK) //if back is pressed, go back to health ratings screen
+			{
+				VIEW_HISTORY_CURRENT_STATE = HEALTH_RATINGS_H;
 				display_health_ratings(current_test_result);
+			}
+			else //else stay on cell balance screen
+				display_cell_balance(current_test_result);
 			break;
 		case TEST_CONDITIONS_H: //test conditions screen
 			if (PB_PRESS == BACK) //if back is pressed, go back to test result menu